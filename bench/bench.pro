@@ -0,0 +1,10 @@
+# Benchmarks, built separately from the application:
+#   cd bench && qmake bench.pro && make
+#   ./blendkernels_bench
+#   ./pipeline_bench --work-dir=/tmp/retawny_bench
+TEMPLATE = subdirs
+
+SUBDIRS += kernels pipeline
+
+kernels.file = blendkernels_bench.pro
+pipeline.file = pipeline_bench.pro
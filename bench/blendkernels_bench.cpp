@@ -0,0 +1,144 @@
+// Level-0 sized benchmark of the blender row kernels: vectorized vs reference.
+// Usage: blendkernels_bench [width] [height] [iterations]
+#include "blendkernels.h"
+
+#include <opencv2/core.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+
+using namespace std;
+
+namespace {
+double bestMs(int iterations, const function<void()> &setup, const function<void()> &run) {
+    double best = 1e300;
+    for (int i = 0; i < iterations; ++i) {
+        setup();
+        const int64 start = cv::getTickCount();
+        run();
+        best = min(best, (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency());
+    }
+    return best;
+}
+
+void report(const char *name, double referenceMs, double vectorMs, double maxDiff) {
+    cout << "  " << name << ": reference " << referenceMs << " ms, vectorized " << vectorMs
+         << " ms (x" << referenceMs / vectorMs << "), max difference " << maxDiff << endl;
+}
+}
+
+int main(int argc, char *argv[]) {
+    const int width = argc > 1 ? atoi(argv[1]) : 8192;
+    const int height = argc > 2 ? atoi(argv[2]) : 2048;
+    const int iterations = argc > 3 ? atoi(argv[3]) : 5;
+    if (width <= 0 || height <= 0 || iterations <= 0) {
+        cerr << "Usage: " << argv[0] << " [width] [height] [iterations]" << endl;
+        return 1;
+    }
+
+    cv::setNumThreads(1);
+    cv::RNG rng(42);
+    cout << "Level 0: " << width << "x" << height << ", best of " << iterations << endl;
+
+    // Laplacian level and accumulated destination in the ranges met while blending
+    cv::Mat src(height, width, CV_16SC3), dst0(height, width, CV_16SC3);
+    rng.fill(src, cv::RNG::UNIFORM, -255, 256);
+    rng.fill(dst0, cv::RNG::UNIFORM, -2000, 2000);
+
+    {
+        cv::Mat masks(height, width, CV_32FC2), dstWeight0(height, width, CV_32F);
+        rng.fill(masks, cv::RNG::UNIFORM, 0.f, 1.f);
+        rng.fill(dstWeight0, cv::RNG::UNIFORM, 0.f, 4.f);
+
+        cv::Mat dstRef, weightRef, dstVec, weightVec;
+        const double referenceMs = bestMs(iterations, [&] { dst0.copyTo(dstRef); dstWeight0.copyTo(weightRef); }, [&] {
+            for (int y = 0; y < height; ++y)
+                blendkernels::reference::accumulateRow(src.ptr<short>(y), masks.ptr<float>(y),
+                                                       dstRef.ptr<short>(y), weightRef.ptr<float>(y), width);
+        });
+        const double vectorMs = bestMs(iterations, [&] { dst0.copyTo(dstVec); dstWeight0.copyTo(weightVec); }, [&] {
+            for (int y = 0; y < height; ++y)
+                blendkernels::accumulateRow(src.ptr<short>(y), masks.ptr<float>(y),
+                                            dstVec.ptr<short>(y), weightVec.ptr<float>(y), width);
+        });
+        report("accumulate CV_32F", referenceMs, vectorMs,
+               max(cv::norm(dstRef, dstVec, cv::NORM_INF), cv::norm(weightRef, weightVec, cv::NORM_INF)));
+
+        cv::Mat rowsRef, rowsVec;
+        const double normRefMs = bestMs(iterations, [&] { dst0.copyTo(rowsRef); }, [&] {
+            for (int y = 0; y < height; ++y)
+                blendkernels::reference::normalizeRow(rowsRef.ptr<short>(y), dstWeight0.ptr<float>(y), 1e-5f, width);
+        });
+        const double normVecMs = bestMs(iterations, [&] { dst0.copyTo(rowsVec); }, [&] {
+            for (int y = 0; y < height; ++y)
+                blendkernels::normalizeRow(rowsVec.ptr<short>(y), dstWeight0.ptr<float>(y), 1e-5f, width);
+        });
+        report("normalize CV_32F", normRefMs, normVecMs, cv::norm(rowsRef, rowsVec, cv::NORM_INF));
+    }
+
+    {
+        cv::Mat masks(height, width, CV_16SC2), dstWeight0(height, width, CV_16S);
+        rng.fill(masks, cv::RNG::UNIFORM, 0, 257);
+        rng.fill(dstWeight0, cv::RNG::UNIFORM, 0, 1024);
+
+        cv::Mat dstRef, weightRef, dstVec, weightVec;
+        const double referenceMs = bestMs(iterations, [&] { dst0.copyTo(dstRef); dstWeight0.copyTo(weightRef); }, [&] {
+            for (int y = 0; y < height; ++y)
+                blendkernels::reference::accumulateRow(src.ptr<short>(y), masks.ptr<short>(y),
+                                                       dstRef.ptr<short>(y), weightRef.ptr<short>(y), width);
+        });
+        const double vectorMs = bestMs(iterations, [&] { dst0.copyTo(dstVec); dstWeight0.copyTo(weightVec); }, [&] {
+            for (int y = 0; y < height; ++y)
+                blendkernels::accumulateRow(src.ptr<short>(y), masks.ptr<short>(y),
+                                            dstVec.ptr<short>(y), weightVec.ptr<short>(y), width);
+        });
+        report("accumulate CV_16S", referenceMs, vectorMs,
+               max(cv::norm(dstRef, dstVec, cv::NORM_INF), cv::norm(weightRef, weightVec, cv::NORM_INF)));
+
+        cv::Mat rowsRef, rowsVec;
+        const double normRefMs = bestMs(iterations, [&] { dst0.copyTo(rowsRef); }, [&] {
+            for (int y = 0; y < height; ++y)
+                blendkernels::reference::normalizeRow(rowsRef.ptr<short>(y), dstWeight0.ptr<short>(y), width);
+        });
+        const double normVecMs = bestMs(iterations, [&] { dst0.copyTo(rowsVec); }, [&] {
+            for (int y = 0; y < height; ++y)
+                blendkernels::normalizeRow(rowsVec.ptr<short>(y), dstWeight0.ptr<short>(y), width);
+        });
+        report("normalize CV_16S", normRefMs, normVecMs, cv::norm(rowsRef, rowsVec, cv::NORM_INF));
+    }
+
+    {
+        cv::Mat masks(height, width, CV_16SC2), dstWeight0(height, width, CV_32S);
+        rng.fill(masks, cv::RNG::UNIFORM, 0, 257);
+        rng.fill(dstWeight0, cv::RNG::UNIFORM, 0, 65536);
+
+        cv::Mat dstRef, weightRef, dstVec, weightVec;
+        const double referenceMs = bestMs(iterations, [&] { dst0.copyTo(dstRef); dstWeight0.copyTo(weightRef); }, [&] {
+            for (int y = 0; y < height; ++y)
+                blendkernels::reference::accumulateRow(src.ptr<short>(y), masks.ptr<short>(y),
+                                                       dstRef.ptr<short>(y), weightRef.ptr<int>(y), width);
+        });
+        const double vectorMs = bestMs(iterations, [&] { dst0.copyTo(dstVec); dstWeight0.copyTo(weightVec); }, [&] {
+            for (int y = 0; y < height; ++y)
+                blendkernels::accumulateRow(src.ptr<short>(y), masks.ptr<short>(y),
+                                            dstVec.ptr<short>(y), weightVec.ptr<int>(y), width);
+        });
+        report("accumulate CV_32S", referenceMs, vectorMs,
+               max(cv::norm(dstRef, dstVec, cv::NORM_INF), cv::norm(weightRef, weightVec, cv::NORM_INF)));
+
+        cv::Mat rowsRef, rowsVec;
+        const double normRefMs = bestMs(iterations, [&] { dst0.copyTo(rowsRef); }, [&] {
+            for (int y = 0; y < height; ++y)
+                blendkernels::reference::normalizeRow(rowsRef.ptr<short>(y), dstWeight0.ptr<int>(y), width);
+        });
+        const double normVecMs = bestMs(iterations, [&] { dst0.copyTo(rowsVec); }, [&] {
+            for (int y = 0; y < height; ++y)
+                blendkernels::normalizeRow(rowsVec.ptr<short>(y), dstWeight0.ptr<int>(y), width);
+        });
+        report("normalize CV_32S", normRefMs, normVecMs, cv::norm(rowsRef, rowsVec, cv::NORM_INF));
+    }
+
+    return 0;
+}
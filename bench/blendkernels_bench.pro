@@ -0,0 +1,17 @@
+# Row kernel microbenchmark (see bench.pro)
+TEMPLATE = app
+TARGET = blendkernels_bench
+
+CONFIG += console c++17 link_pkgconfig
+CONFIG -= qt app_bundle
+
+PKGCONFIG += opencv4
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    blendkernels_bench.cpp \
+    ../blendkernels.cpp
+
+HEADERS += \
+    ../blendkernels.h
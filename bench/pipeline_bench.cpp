@@ -0,0 +1,514 @@
+// End-to-end benchmark of the blending pipeline on a synthetic tile set.
+// Generates cols x rows overlapping Ort_ tiles with TFWs and PC_ masks in the
+// layout OrthoLoader expects, then times metadata loading, Voronoi masks,
+// coverage masks, feed and blend per pyramid level and TIFF output for every
+// combination of band count, precision and thread count.
+//
+// Usage: pipeline_bench [--key=value ...]
+//   --work-dir=DIR         Dataset and outputs (default: ./pipeline_bench_data)
+//   --cols=N --rows=N      Tile grid (default: 4 x 3)
+//   --tile-size=WxH        Tile size in pixels (default: 2048x1536)
+//   --overlap=F            Fraction of a tile shared with each neighbour (default: 0.3)
+//   --pc-coverage=F        Fraction of tile pixels left usable by the PC_ mask (default: 0.9)
+//   --bands=LIST           Band counts, comma separated (default: 5,8)
+//   --precision=LIST       accurate and/or fast (default: accurate,fast)
+//   --threads=LIST         OpenCV thread counts (default: 1,<all>)
+//   --strip-height=N       Rows per strip, 0 = whole canvas (default: 0)
+//   --check-partition=N    Also blend every case as blocks of N x N pixels, each over
+//                          its own support like `retawny --job`, and exit with 1 unless
+//                          the blocks are pixel-identical to the whole-canvas blend
+//   --golden=FILE          Compare output checksums with FILE; exit with 1 on mismatch
+//   --update-golden        Write the checksums of this run to --golden instead
+//
+// Tiles are fed on the calling thread, so every case is deterministic and its
+// checksum must not depend on the thread count.
+#include "coveragemask.h"
+#include "ortholoader.h"
+#include "streamingblender.h"
+#include "tiffwriter.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+#include <QTextStream>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+namespace {
+struct Dataset {
+    int cols = 4;
+    int rows = 3;
+    cv::Size tileSize{2048, 1536};
+    double overlap = 0.3;
+    double pcCoverage = 0.9;
+
+    QString stamp() const {
+        return QStringLiteral("%1x%2 tiles of %3x%4, overlap %5, PC_ coverage %6")
+            .arg(cols).arg(rows).arg(tileSize.width).arg(tileSize.height).arg(overlap).arg(pcCoverage);
+    }
+};
+
+double msSince(int64 start) {
+    return (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+}
+
+// Pixel noise depending on canvas coordinates only, so overlapping tiles agree
+inline uint32_t hashXY(uint32_t x, uint32_t y) {
+    uint32_t h = x * 0x8da6b343u ^ y * 0xd8163841u;
+    h ^= h >> 13;
+    h *= 0x5bd1e995u;
+    return h ^ (h >> 15);
+}
+
+// Smooth terrain-like pattern plus noise, with a per-tile exposure shift so seams are visible
+cv::Mat syntheticImage(cv::Point tl, cv::Size size, int exposure) {
+    cv::Mat bgr(size, CV_8UC3);
+    for (int y = 0; y < size.height; ++y) {
+        cv::Vec3b *row = bgr.ptr<cv::Vec3b>(y);
+        const double cy = tl.y + y;
+        for (int x = 0; x < size.width; ++x) {
+            const double cx = tl.x + x;
+            const int noise = static_cast<int>(hashXY(static_cast<uint32_t>(cx), static_cast<uint32_t>(cy)) & 31) - 16;
+            const double base = 128 + 50 * sin(cx / 97.0) * cos(cy / 131.0) + 20 * sin((cx + cy) / 523.0);
+            row[x] = cv::Vec3b(cv::saturate_cast<uchar>(base * 0.8 + noise + exposure + 10),
+                               cv::saturate_cast<uchar>(base + noise + exposure),
+                               cv::saturate_cast<uchar>(base * 0.9 + noise + exposure - 5));
+        }
+    }
+    return bgr;
+}
+
+// PC_ mask, black = usable: an ellipse of (1 - coverage) of the tile is masked out
+cv::Mat syntheticPcMask(cv::Size size, double coverage, cv::RNG &rng) {
+    cv::Mat mask(size, CV_8U, cv::Scalar(0));
+    const double maskedArea = (1.0 - coverage) * size.area();
+    if (maskedArea >= 1.0) {
+        const double aspect = rng.uniform(0.5, 2.0);
+        const double a = sqrt(maskedArea * aspect / CV_PI);
+        const double b = maskedArea / (CV_PI * a);
+        const cv::Point center(rng.uniform(0, size.width), rng.uniform(0, size.height));
+        cv::ellipse(mask, center, cv::Size(cvRound(a), cvRound(b)), rng.uniform(0.0, 180.0), 0, 360, cv::Scalar(255), cv::FILLED);
+    }
+    return mask;
+}
+
+bool writeTfw(const QString &path, cv::Point tl) {
+    // 0.5 units per pixel; Y grows down the canvas so its scale is negative
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        return false;
+    QTextStream out(&file);
+    out.setRealNumberPrecision(12);
+    out << 0.5 << "\n" << 0.0 << "\n" << 0.0 << "\n" << -0.5 << "\n"
+        << 100000.0 + tl.x * 0.5 << "\n" << 200000.0 - tl.y * 0.5 << "\n";
+    return file.error() == QFile::NoError;
+}
+
+// Writes the tile set unless the directory already holds the same one
+bool generateDataset(const QString &dirPath, const Dataset &dataset) {
+    QDir dir(dirPath);
+    if (!dir.mkpath(QStringLiteral(".")))
+        return false;
+    const QString stampPath = dir.absoluteFilePath(QStringLiteral("dataset.txt"));
+    QFile stampFile(stampPath);
+    if (stampFile.open(QIODevice::ReadOnly | QIODevice::Text) && QString::fromUtf8(stampFile.readAll()) == dataset.stamp()) {
+        cout << "Reusing dataset in " << qPrintable(dirPath) << endl;
+        return true;
+    }
+    stampFile.close();
+
+    for (const QString &entry : dir.entryList(QDir::Files))
+        dir.remove(entry);
+
+    const int64 start = cv::getTickCount();
+    const int stepX = max(1, cvRound(dataset.tileSize.width * (1.0 - dataset.overlap)));
+    const int stepY = max(1, cvRound(dataset.tileSize.height * (1.0 - dataset.overlap)));
+    for (int r = 0; r < dataset.rows; ++r) {
+        for (int c = 0; c < dataset.cols; ++c) {
+            const int index = r * dataset.cols + c;
+            cv::RNG rng(1000 + index);
+            const cv::Point tl(c * stepX, r * stepY);
+            const QString base = QStringLiteral("%1_%2").arg(r, 3, 10, QLatin1Char('0')).arg(c, 3, 10, QLatin1Char('0'));
+            const cv::Mat image = syntheticImage(tl, dataset.tileSize, rng.uniform(-15, 16));
+            const cv::Mat pcMask = syntheticPcMask(dataset.tileSize, dataset.pcCoverage, rng);
+            if (!cv::imwrite(dir.absoluteFilePath("Ort_" + base + ".tif").toStdString(), image) ||
+                !cv::imwrite(dir.absoluteFilePath("PC_" + base + ".tif").toStdString(), pcMask) ||
+                !writeTfw(dir.absoluteFilePath("Ort_" + base + ".tfw"), tl))
+                return false;
+        }
+    }
+
+    if (!stampFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        return false;
+    stampFile.write(dataset.stamp().toUtf8());
+    cout << "Generated " << dataset.cols * dataset.rows << " tiles in " << qPrintable(dirPath) << " ("
+         << msSince(start) << " ms)" << endl;
+    return true;
+}
+
+// FNV-1a over the 8-bit output, row by row in canvas order
+struct Checksum {
+    uint64_t value = 1469598103934665603ull;
+
+    void add(const cv::Mat &rows) {
+        for (int y = 0; y < rows.rows; ++y) {
+            const uchar *p = rows.ptr<uchar>(y);
+            for (size_t i = 0, n = rows.cols * rows.elemSize(); i < n; ++i)
+                value = (value ^ p[i]) * 1099511628211ull;
+        }
+    }
+
+    QString hex() const { return QStringLiteral("%1").arg(static_cast<qulonglong>(value), 16, 16, QLatin1Char('0')); }
+};
+
+QVector<int> parseIntList(const QString &text) {
+    QVector<int> values;
+    for (const QString &item : text.split(QLatin1Char(','), Qt::SkipEmptyParts)) {
+        bool ok = false;
+        const int value = item.toInt(&ok);
+        if (!ok || value <= 0)
+            return QVector<int>();
+        values << value;
+    }
+    return values;
+}
+
+QMap<QString, QString> readGolden(const QString &path) {
+    QMap<QString, QString> golden;
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return golden;
+    while (!file.atEnd()) {
+        const QString line = QString::fromUtf8(file.readLine()).trimmed();
+        const int tab = line.lastIndexOf(QLatin1Char('\t'));
+        if (tab > 0)
+            golden.insert(line.left(tab), line.mid(tab + 1));
+    }
+    return golden;
+}
+
+struct CaseResult {
+    double decodeMs = 0, maskMs = 0, feedMs = 0, blendMs = 0, writeMs = 0;
+    DualMaskMultiBandBlender::Timings timings;
+    Checksum checksum;
+};
+
+// Same masks as the application: coverage of the PC_ mask for weights, of the Voronoi mask for blending
+void buildMasks(const OrthoLoader::Tile &tile, double featherRadius, cv::Mat *weightMask, cv::Mat *blendMask,
+                cv::Scalar *fill) {
+    *weightMask = buildCoverageMask(tile.image, tile.mask, featherRadius, false);
+    blendMask->release();
+    if (!tile.generatedMaskPath.isEmpty()) {
+        const cv::Mat voronoi = cv::imread(QFile::encodeName(tile.generatedMaskPath).toStdString(), cv::IMREAD_GRAYSCALE);
+        if (!voronoi.empty())
+            *blendMask = buildCoverageMask(tile.image, voronoi, featherRadius, true);
+    }
+    if (blendMask->empty())
+        *blendMask = weightMask->clone();
+    *fill = cv::mean(tile.image, *blendMask);
+}
+
+// Blends region of the canvas into the same pixels of *canvas (CV_8UC3),
+// feeding only the tiles within the blender's support as the ROI and job modes do
+bool blendRegion(OrthoLoader &loader, cv::Rect region, int bands, int weightType, int stripHeight,
+                 double featherRadius, cv::Mat *canvas) {
+    QVector<OrthoLoader::Tile> &tiles = loader.tiles();
+    const cv::Rect roi(0, 0, loader.canvasSize().width(), loader.canvasSize().height());
+
+    StreamingBlender blender(bands, stripHeight, 0, weightType);
+    blender.prepare(roi, region, [&](const cv::Mat &strip, const cv::Mat &, cv::Rect rect) {
+        strip.convertTo((*canvas)(rect), CV_8UC3);
+        return true;
+    });
+
+    QVector<int> order = loader.tilesNear(region, blender.padding());
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return tiles[a].y < tiles[b].y; });
+    QString error;
+    for (const int index : order) {
+        OrthoLoader::Tile &tile = tiles[index];
+        if (!loader.loadTile(&tile, &error)) {
+            cerr << qPrintable(error) << endl;
+            return false;
+        }
+        loader.loadPCMask(&tile, nullptr);
+        cv::Mat weightMask, blendMask;
+        cv::Scalar fill;
+        buildMasks(tile, featherRadius, &weightMask, &blendMask, &fill);
+        blender.feed(tile.image, weightMask, blendMask, cv::Point(tile.x, tile.y), &fill);
+        loader.unloadMask(&tile);
+        loader.unloadTile(&tile);
+    }
+    return blender.finish();
+}
+
+// Blends the canvas whole and as blocks of blockSize pixels; counts the pixels that differ
+bool checkPartition(OrthoLoader &loader, int blockSize, int bands, int weightType, int stripHeight,
+                    double featherRadius, int *differing, int *maxDifference) {
+    const cv::Size canvasSize(loader.canvasSize().width(), loader.canvasSize().height());
+    const cv::Rect roi(cv::Point(), canvasSize);
+    cv::Mat whole(canvasSize, CV_8UC3, cv::Scalar::all(0));
+    if (!blendRegion(loader, roi, bands, weightType, stripHeight, featherRadius, &whole))
+        return false;
+
+    cv::Mat blocks(canvasSize, CV_8UC3, cv::Scalar::all(0));
+    for (int y = 0; y < canvasSize.height; y += blockSize) {
+        for (int x = 0; x < canvasSize.width; x += blockSize) {
+            const cv::Rect block = cv::Rect(x, y, blockSize, blockSize) & roi;
+            if (!blendRegion(loader, block, bands, weightType, stripHeight, featherRadius, &blocks))
+                return false;
+        }
+    }
+
+    cv::Mat difference;
+    cv::absdiff(whole, blocks, difference);
+    double maxValue = 0;
+    cv::minMaxLoc(difference.reshape(1), nullptr, &maxValue);
+    cv::Mat differs;
+    cv::transform(difference, differs, cv::Matx13f(1, 1, 1));
+    *differing = cv::countNonZero(differs);
+    *maxDifference = static_cast<int>(maxValue);
+    return true;
+}
+
+bool runCase(OrthoLoader &loader, const QString &outputPath, int bands, int weightType, int stripHeight,
+             double featherRadius, CaseResult *result) {
+    QVector<OrthoLoader::Tile> &tiles = loader.tiles();
+    const cv::Rect roi(0, 0, loader.canvasSize().width(), loader.canvasSize().height());
+
+    TiledTiffWriter writer;
+    QString error;
+    if (!writer.open(outputPath, loader.canvasSize(), TiledTiffWriter::Compression::None, &error)) {
+        cerr << qPrintable(error) << endl;
+        return false;
+    }
+
+    StreamingBlender blender(bands, stripHeight, 0, weightType);
+    blender.prepare(roi, [&](const cv::Mat &strip, const cv::Mat &, cv::Rect) {
+        const int64 start = cv::getTickCount();
+        cv::Mat rows;
+        strip.convertTo(rows, CV_8UC3);
+        result->checksum.add(rows);
+        const bool ok = writer.writeRows(rows, &error);
+        result->writeMs += msSince(start);
+        return ok;
+    });
+
+    QVector<int> order(tiles.size());
+    for (int i = 0; i < tiles.size(); ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return tiles[a].y < tiles[b].y; });
+
+    // Same preparation as the application, on the calling thread
+    for (const int index : order) {
+        OrthoLoader::Tile &tile = tiles[index];
+        int64 start = cv::getTickCount();
+        if (!loader.loadTile(&tile, &error)) {
+            cerr << qPrintable(error) << endl;
+            return false;
+        }
+        result->decodeMs += msSince(start);
+
+        start = cv::getTickCount();
+        loader.loadPCMask(&tile, nullptr);
+        cv::Mat weightMask, blendMask;
+        cv::Scalar fill;
+        buildMasks(tile, featherRadius, &weightMask, &blendMask, &fill);
+        result->maskMs += msSince(start);
+
+        const double writeBefore = result->writeMs;
+        start = cv::getTickCount();
+        const bool fed = blender.feed(tile.image, weightMask, blendMask, cv::Point(tile.x, tile.y), &fill);
+        result->feedMs += msSince(start) - (result->writeMs - writeBefore);
+        loader.unloadMask(&tile);
+        loader.unloadTile(&tile);
+        if (!fed) {
+            cerr << qPrintable(error) << endl;
+            return false;
+        }
+    }
+
+    const double writeBefore = result->writeMs;
+    int64 start = cv::getTickCount();
+    if (!blender.finish()) {
+        cerr << qPrintable(error) << endl;
+        return false;
+    }
+    result->blendMs = msSince(start) - (result->writeMs - writeBefore);
+
+    start = cv::getTickCount();
+    if (!writer.close(&error)) {
+        cerr << qPrintable(error) << endl;
+        return false;
+    }
+    result->writeMs += msSince(start);
+    result->timings = blender.timings();
+    return true;
+}
+}
+
+int main(int argc, char *argv[]) {
+    QMap<QString, QString> options;
+    for (int i = 1; i < argc; ++i) {
+        const QString arg = QString::fromLocal8Bit(argv[i]);
+        const int eq = arg.indexOf(QLatin1Char('='));
+        if (!arg.startsWith(QStringLiteral("--"))) {
+            cerr << "Unexpected argument: " << argv[i] << " (see the usage at the top of pipeline_bench.cpp)" << endl;
+            return 1;
+        }
+        options.insert(eq < 0 ? arg.mid(2) : arg.mid(2, eq - 2), eq < 0 ? QString() : arg.mid(eq + 1));
+    }
+
+    Dataset dataset;
+    dataset.cols = options.value(QStringLiteral("cols"), QStringLiteral("4")).toInt();
+    dataset.rows = options.value(QStringLiteral("rows"), QStringLiteral("3")).toInt();
+    const QStringList size = options.value(QStringLiteral("tile-size"), QStringLiteral("2048x1536")).split(QLatin1Char('x'));
+    if (size.size() == 2)
+        dataset.tileSize = cv::Size(size[0].toInt(), size[1].toInt());
+    dataset.overlap = options.value(QStringLiteral("overlap"), QStringLiteral("0.3")).toDouble();
+    dataset.pcCoverage = options.value(QStringLiteral("pc-coverage"), QStringLiteral("0.9")).toDouble();
+    const QVector<int> bandList = parseIntList(options.value(QStringLiteral("bands"), QStringLiteral("5,8")));
+    const QVector<int> threadList = parseIntList(options.value(QStringLiteral("threads"),
+                                                               QStringLiteral("1,%1").arg(cv::getNumberOfCPUs())));
+    const QStringList precisionList = options.value(QStringLiteral("precision"), QStringLiteral("accurate,fast"))
+                                          .split(QLatin1Char(','), Qt::SkipEmptyParts);
+    const int stripHeight = options.value(QStringLiteral("strip-height"), QStringLiteral("0")).toInt();
+    const int partitionSize = options.value(QStringLiteral("check-partition"), QStringLiteral("0")).toInt();
+    const QString workDir = QFileInfo(options.value(QStringLiteral("work-dir"), QStringLiteral("pipeline_bench_data"))).absoluteFilePath();
+    const QString goldenPath = options.value(QStringLiteral("golden"));
+    const bool updateGolden = options.contains(QStringLiteral("update-golden"));
+    const double featherRadius = 64.0;
+    const double overlapMargin = 20.0;
+
+    if (dataset.cols <= 0 || dataset.rows <= 0 || dataset.cols * dataset.rows < 2 || dataset.tileSize.area() <= 0 ||
+        dataset.overlap < 0.0 || dataset.overlap >= 1.0 || dataset.pcCoverage <= 0.0 || dataset.pcCoverage > 1.0 ||
+        bandList.isEmpty() || threadList.isEmpty() || stripHeight < 0 || partitionSize < 0 || (updateGolden && goldenPath.isEmpty())) {
+        cerr << "Invalid options (see the usage at the top of pipeline_bench.cpp)" << endl;
+        return 1;
+    }
+    for (const QString &precision : precisionList) {
+        if (precision != QStringLiteral("accurate") && precision != QStringLiteral("fast")) {
+            cerr << "Invalid precision: " << qPrintable(precision) << endl;
+            return 1;
+        }
+    }
+
+    const QString dataDir = workDir + "/tiles";
+    if (!generateDataset(dataDir, dataset)) {
+        cerr << "Failed to generate the dataset in " << qPrintable(dataDir) << endl;
+        return 1;
+    }
+    cout << "Dataset: " << qPrintable(dataset.stamp()) << endl << fixed << setprecision(1);
+
+    const QMap<QString, QString> golden = goldenPath.isEmpty() || updateGolden ? QMap<QString, QString>() : readGolden(goldenPath);
+    QMap<QString, QString> checksums;
+    bool mismatch = false;
+    bool partitionMismatch = false;
+
+    for (const int threads : threadList) {
+        cv::setNumThreads(threads);
+        cout << endl << "=== " << threads << " thread(s) ===" << endl;
+
+        // Cold metadata scan and Voronoi generation: the caches are removed first
+        QFile::remove(dataDir + "/tile_metadata.json");
+        QFile::remove(dataDir + "/voronoi_masks.json");
+        OrthoLoader loader;
+        QString error;
+        int64 start = cv::getTickCount();
+        if (!loader.loadFromDirectory(dataDir, &error)) {
+            cerr << "Loading failed: " << qPrintable(error) << endl;
+            return 1;
+        }
+        cout << "Load metadata: " << msSince(start) << " ms (" << loader.tiles().size() << " tiles, canvas "
+             << loader.canvasSize().width() << "x" << loader.canvasSize().height() << ")" << endl;
+        start = cv::getTickCount();
+        if (!loader.generateVoronoiMasks(overlapMargin, &error)) {
+            cerr << "Voronoi masks failed: " << qPrintable(error) << endl;
+            return 1;
+        }
+        cout << "Voronoi masks: " << msSince(start) << " ms" << endl;
+
+        for (const int bands : bandList) {
+            for (const QString &precision : precisionList) {
+                const int weightType = precision == QStringLiteral("fast") ? CV_16S : CV_32F;
+                const QString name = QStringLiteral("bands=%1 precision=%2 strip=%3 [%4]")
+                                         .arg(bands).arg(precision).arg(stripHeight).arg(dataset.stamp());
+                CaseResult result;
+                const QString outputPath = QStringLiteral("%1/out_b%2_%3.tif").arg(workDir).arg(bands).arg(precision);
+                if (!runCase(loader, outputPath, bands, weightType, stripHeight, featherRadius, &result))
+                    return 1;
+
+                cout << "bands " << bands << ", " << qPrintable(precision) << ": decode " << result.decodeMs
+                     << " ms, masks " << result.maskMs << " ms, feed " << result.feedMs << " ms, blend "
+                     << result.blendMs << " ms, write " << result.writeMs << " ms, checksum "
+                     << qPrintable(result.checksum.hex());
+
+                // The checksum of a case must not change with the thread count either
+                const QString expected = checksums.contains(name) ? checksums.value(name) : golden.value(name);
+                if (!expected.isEmpty() && expected != result.checksum.hex()) {
+                    cout << " MISMATCH (expected " << qPrintable(expected) << ")";
+                    mismatch = true;
+                }
+                cout << endl;
+                checksums.insert(name, result.checksum.hex());
+
+                const DualMaskMultiBandBlender::Timings &t = result.timings;
+                cout << "  level   build  accumulate  normalize  restore (ms)" << endl;
+                for (size_t i = 0; i < t.build.size(); ++i) {
+                    cout << "  " << setw(5) << i << setw(8) << t.build[i] << setw(12) << t.accumulate[i]
+                         << setw(11) << t.normalize[i] << setw(9) << t.restore[i] << endl;
+                }
+                cout << "  lock wait " << t.lock_wait << " ms over " << t.feeds << " feeds" << endl;
+
+                if (partitionSize > 0) {
+                    int differing = 0, maxDifference = 0;
+                    if (!checkPartition(loader, partitionSize, bands, weightType, stripHeight, featherRadius,
+                                        &differing, &maxDifference))
+                        return 1;
+                    cout << "  blocks of " << partitionSize << ": " << differing << " pixels differ from the whole canvas"
+                         << " (at most by " << maxDifference << ")" << endl;
+                    partitionMismatch |= differing > 0;
+                }
+            }
+        }
+    }
+
+    if (updateGolden) {
+        QFile file(goldenPath);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+            cerr << "Failed to write " << qPrintable(goldenPath) << endl;
+            return 1;
+        }
+        for (auto it = checksums.begin(); it != checksums.end(); ++it)
+            file.write((it.key() + "\t" + it.value() + "\n").toUtf8());
+        cout << endl << "Wrote " << checksums.size() << " checksums to " << qPrintable(goldenPath) << endl;
+    } else if (!goldenPath.isEmpty()) {
+        for (auto it = checksums.begin(); it != checksums.end(); ++it) {
+            if (!golden.contains(it.key()))
+                cout << "No golden checksum for: " << qPrintable(it.key()) << endl;
+        }
+    }
+
+    if (mismatch) {
+        cerr << endl << "Checksum mismatch: the output changed" << endl;
+        return 1;
+    }
+    if (partitionMismatch) {
+        cerr << endl << "Partition mismatch: blocks differ from the whole-canvas blend" << endl;
+        return 1;
+    }
+    return 0;
+}
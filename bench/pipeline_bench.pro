@@ -0,0 +1,33 @@
+# End-to-end pipeline benchmark on a synthetic tile set (see bench.pro)
+TEMPLATE = app
+TARGET = pipeline_bench
+
+QT += core gui
+
+CONFIG += console c++17 link_pkgconfig
+CONFIG -= app_bundle
+
+PKGCONFIG += opencv4 libtiff-4
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    pipeline_bench.cpp \
+    ../ortholoader.cpp \
+    ../coveragemask.cpp \
+    ../dualmaskblender.cpp \
+    ../pyramidpool.cpp \
+    ../blendkernels.cpp \
+    ../streamingblender.cpp \
+    ../tiffwriter.cpp \
+    ../scratchmat.cpp
+
+HEADERS += \
+    ../ortholoader.h \
+    ../coveragemask.h \
+    ../dualmaskblender.h \
+    ../pyramidpool.h \
+    ../blendkernels.h \
+    ../streamingblender.h \
+    ../tiffwriter.h \
+    ../scratchmat.h
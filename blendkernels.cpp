@@ -0,0 +1,395 @@
+#include "blendkernels.h"
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/core/ocl.hpp>
+
+namespace blendkernels {
+
+namespace {
+#if CV_SIMD
+// short(s * b) per lane, b split over the low and high halves of s
+inline cv::v_int16 scale(const cv::v_int16 &s, const cv::v_float32 &b_lo, const cv::v_float32 &b_hi) {
+    cv::v_int32 lo, hi;
+    cv::v_expand(s, lo, hi);
+    return cv::v_pack(cv::v_trunc(cv::v_cvt_f32(lo) * b_lo), cv::v_trunc(cv::v_cvt_f32(hi) * b_hi));
+}
+
+// (s * b) >> 8 per lane
+inline cv::v_int16 scaleFixed(const cv::v_int16 &s, const cv::v_int16 &b) {
+    cv::v_int32 lo, hi;
+    cv::v_mul_expand(s, b, lo, hi);
+    return cv::v_pack(cv::v_shr<8>(lo), cv::v_shr<8>(hi));
+}
+
+// Keeps the low 16 bits, sign extended, like a static_cast<short> of an int
+inline cv::v_int32 wrap16(const cv::v_int32 &v) {
+    return cv::v_shr<16>(cv::v_shl<16>(v));
+}
+
+// a / w rounded towards zero, exact for |a| < 2^23: rounded float quotient, then
+// one correction step from the integer remainder
+inline cv::v_int32 divTrunc(const cv::v_int32 &a, const cv::v_int32 &w, const cv::v_float32 &w_rcp) {
+    const cv::v_int32 zero = cv::vx_setzero_s32();
+    cv::v_int32 q = cv::v_round(cv::v_cvt_f32(a) * w_rcp);
+    const cv::v_int32 r = a - q * w;
+    const cv::v_int32 non_negative = a >= zero;
+    // Masks are -1 where set
+    const cv::v_int32 too_high = (non_negative & (r < zero)) | (~non_negative & (r <= zero - w));
+    const cv::v_int32 too_low = (non_negative & (r >= w)) | (~non_negative & (r > zero));
+    return q + too_high - too_low;
+}
+#endif
+
+// Same arithmetic as the CPU kernels, one work item per pixel. The weight
+// type is selected by WEIGHT_FLOAT, WEIGHT_SHORT or WEIGHT_INT.
+const char *const kOclSource = R"CLC(
+#ifdef WEIGHT_FLOAT
+#define MASK_T float
+#define WEIGHT_T float
+#elif defined(WEIGHT_SHORT)
+#define MASK_T short
+#define WEIGHT_T short
+#else
+#define MASK_T short
+#define WEIGHT_T int
+#endif
+
+inline short scaleLaplace(short s, MASK_T b)
+{
+#ifdef WEIGHT_FLOAT
+    return convert_short_sat(convert_int_sat_rtz(convert_float(s) * b));
+#else
+    return convert_short_sat((convert_int(s) * convert_int(b)) >> 8);
+#endif
+}
+
+__kernel void accumulate(__global const uchar *srcptr, int src_step, int src_offset,
+                         __global const uchar *maskptr, int mask_step, int mask_offset,
+                         __global uchar *dstptr, int dst_step, int dst_offset, int rows, int cols,
+                         __global uchar *weightptr, int weight_step, int weight_offset)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    if (x >= cols || y >= rows)
+        return;
+
+    __global const short *src = (__global const short *)(srcptr + mad24(y, src_step, mad24(x, 6, src_offset)));
+    __global const MASK_T *mask = (__global const MASK_T *)(maskptr + mad24(y, mask_step, mad24(x, (int)(2 * sizeof(MASK_T)), mask_offset)));
+    __global short *dst = (__global short *)(dstptr + mad24(y, dst_step, mad24(x, 6, dst_offset)));
+    __global WEIGHT_T *weight = (__global WEIGHT_T *)(weightptr + mad24(y, weight_step, mad24(x, (int)sizeof(WEIGHT_T), weight_offset)));
+
+    const MASK_T blend = mask[1];
+    dst[0] = (short)(dst[0] + scaleLaplace(src[0], blend));
+    dst[1] = (short)(dst[1] + scaleLaplace(src[1], blend));
+    dst[2] = (short)(dst[2] + scaleLaplace(src[2], blend));
+#ifdef WEIGHT_SHORT
+    weight[0] = add_sat(weight[0], mask[0]);
+#else
+    weight[0] += mask[0];
+#endif
+}
+
+__kernel void normalize(__global uchar *levelptr, int level_step, int level_offset, int rows, int cols,
+                        __global const uchar *weightptr, int weight_step, int weight_offset, float eps)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    if (x >= cols || y >= rows)
+        return;
+
+    __global short *pixel = (__global short *)(levelptr + mad24(y, level_step, mad24(x, 6, level_offset)));
+    __global const WEIGHT_T *weight = (__global const WEIGHT_T *)(weightptr + mad24(y, weight_step, mad24(x, (int)sizeof(WEIGHT_T), weight_offset)));
+
+#ifdef WEIGHT_FLOAT
+    const float r = 1.f / (weight[0] + eps);
+    pixel[0] = (short)convert_int_sat_rtz(pixel[0] * r);
+    pixel[1] = (short)convert_int_sat_rtz(pixel[1] * r);
+    pixel[2] = (short)convert_int_sat_rtz(pixel[2] * r);
+#else
+    const int w = convert_int(weight[0]) + 1;
+    pixel[0] = convert_short_sat((pixel[0] * 256) / w);
+    pixel[1] = convert_short_sat((pixel[1] * 256) / w);
+    pixel[2] = convert_short_sat((pixel[2] * 256) / w);
+#endif
+}
+)CLC";
+
+const cv::ocl::ProgramSource &oclProgram() {
+    static const cv::ocl::ProgramSource source(kOclSource);
+    return source;
+}
+
+const char *weightOption(int depth) {
+    switch (depth) {
+    case CV_16S: return "-D WEIGHT_SHORT";
+    case CV_32S: return "-D WEIGHT_INT";
+    default: return "-D WEIGHT_FLOAT";
+    }
+}
+} // anonymous namespace
+
+bool accumulateOcl(const cv::UMat &src, const cv::UMat &masks, cv::UMat &dst, cv::UMat &dst_weight) {
+    if (!cv::ocl::useOpenCL())
+        return false;
+    CV_Assert(src.type() == CV_16SC3 && dst.type() == CV_16SC3);
+    CV_Assert(src.size() == dst.size() && masks.size() == dst.size() && dst_weight.size() == dst.size());
+
+    cv::ocl::Kernel kernel("accumulate", oclProgram(), weightOption(dst_weight.depth()));
+    if (kernel.empty())
+        return false;
+    kernel.args(cv::ocl::KernelArg::ReadOnlyNoSize(src), cv::ocl::KernelArg::ReadOnlyNoSize(masks),
+                cv::ocl::KernelArg::ReadWrite(dst), cv::ocl::KernelArg::ReadWriteNoSize(dst_weight));
+    size_t globalsize[2] = {static_cast<size_t>(dst.cols), static_cast<size_t>(dst.rows)};
+    return kernel.run(2, globalsize, nullptr, true);
+}
+
+bool normalizeOcl(cv::UMat &level, const cv::UMat &weight, float eps) {
+    if (!cv::ocl::useOpenCL())
+        return false;
+    CV_Assert(level.type() == CV_16SC3 && weight.size() == level.size());
+
+    cv::ocl::Kernel kernel("normalize", oclProgram(), weightOption(weight.depth()));
+    if (kernel.empty())
+        return false;
+    kernel.args(cv::ocl::KernelArg::ReadWrite(level), cv::ocl::KernelArg::ReadOnlyNoSize(weight), eps);
+    size_t globalsize[2] = {static_cast<size_t>(level.cols), static_cast<size_t>(level.rows)};
+    return kernel.run(2, globalsize, nullptr, true);
+}
+
+void accumulateRow(const short *src, const float *masks, short *dst, float *dst_weight, int width) {
+    int x = 0;
+#if CV_SIMD
+    const int step = cv::v_int16::nlanes;
+    const int half = cv::v_float32::nlanes;
+    for (; x <= width - step; x += step) {
+        cv::v_float32 w_lo, b_lo, w_hi, b_hi;
+        cv::v_load_deinterleave(masks + 2 * x, w_lo, b_lo);
+        cv::v_load_deinterleave(masks + 2 * (x + half), w_hi, b_hi);
+
+        cv::v_int16 s0, s1, s2, d0, d1, d2;
+        cv::v_load_deinterleave(src + 3 * x, s0, s1, s2);
+        cv::v_load_deinterleave(dst + 3 * x, d0, d1, d2);
+        d0 = cv::v_add_wrap(d0, scale(s0, b_lo, b_hi));
+        d1 = cv::v_add_wrap(d1, scale(s1, b_lo, b_hi));
+        d2 = cv::v_add_wrap(d2, scale(s2, b_lo, b_hi));
+        cv::v_store_interleave(dst + 3 * x, d0, d1, d2);
+
+        cv::v_store(dst_weight + x, cv::vx_load(dst_weight + x) + w_lo);
+        cv::v_store(dst_weight + x + half, cv::vx_load(dst_weight + x + half) + w_hi);
+    }
+    cv::vx_cleanup();
+#endif
+    reference::accumulateRow(src + 3 * x, masks + 2 * x, dst + 3 * x, dst_weight + x, width - x);
+}
+
+void accumulateRow(const short *src, const short *masks, short *dst, short *dst_weight, int width) {
+    int x = 0;
+#if CV_SIMD
+    const int step = cv::v_int16::nlanes;
+    for (; x <= width - step; x += step) {
+        cv::v_int16 w, b;
+        cv::v_load_deinterleave(masks + 2 * x, w, b);
+
+        cv::v_int16 s0, s1, s2, d0, d1, d2;
+        cv::v_load_deinterleave(src + 3 * x, s0, s1, s2);
+        cv::v_load_deinterleave(dst + 3 * x, d0, d1, d2);
+        d0 = cv::v_add_wrap(d0, scaleFixed(s0, b));
+        d1 = cv::v_add_wrap(d1, scaleFixed(s1, b));
+        d2 = cv::v_add_wrap(d2, scaleFixed(s2, b));
+        cv::v_store_interleave(dst + 3 * x, d0, d1, d2);
+
+        cv::v_store(dst_weight + x, cv::vx_load(dst_weight + x) + w); // Saturating
+    }
+    cv::vx_cleanup();
+#endif
+    reference::accumulateRow(src + 3 * x, masks + 2 * x, dst + 3 * x, dst_weight + x, width - x);
+}
+
+void accumulateRow(const short *src, const short *masks, short *dst, int *dst_weight, int width) {
+    int x = 0;
+#if CV_SIMD
+    const int step = cv::v_int16::nlanes;
+    const int half = cv::v_int32::nlanes;
+    for (; x <= width - step; x += step) {
+        cv::v_int16 w, b;
+        cv::v_load_deinterleave(masks + 2 * x, w, b);
+
+        cv::v_int16 s0, s1, s2, d0, d1, d2;
+        cv::v_load_deinterleave(src + 3 * x, s0, s1, s2);
+        cv::v_load_deinterleave(dst + 3 * x, d0, d1, d2);
+        d0 = cv::v_add_wrap(d0, scaleFixed(s0, b));
+        d1 = cv::v_add_wrap(d1, scaleFixed(s1, b));
+        d2 = cv::v_add_wrap(d2, scaleFixed(s2, b));
+        cv::v_store_interleave(dst + 3 * x, d0, d1, d2);
+
+        cv::v_int32 w_lo, w_hi;
+        cv::v_expand(w, w_lo, w_hi);
+        cv::v_store(dst_weight + x, cv::vx_load(dst_weight + x) + w_lo);
+        cv::v_store(dst_weight + x + half, cv::vx_load(dst_weight + x + half) + w_hi);
+    }
+    cv::vx_cleanup();
+#endif
+    reference::accumulateRow(src + 3 * x, masks + 2 * x, dst + 3 * x, dst_weight + x, width - x);
+}
+
+void normalizeRow(short *row, const float *weight, float eps, int width) {
+    int x = 0;
+#if CV_SIMD
+    const int step = cv::v_int16::nlanes;
+    const int half = cv::v_float32::nlanes;
+    const cv::v_float32 v_one = cv::vx_setall_f32(1.f);
+    const cv::v_float32 v_eps = cv::vx_setall_f32(eps);
+    for (; x <= width - step; x += step) {
+        const cv::v_float32 r_lo = v_one / (cv::vx_load(weight + x) + v_eps);
+        const cv::v_float32 r_hi = v_one / (cv::vx_load(weight + x + half) + v_eps);
+
+        cv::v_int16 c[3];
+        cv::v_load_deinterleave(row + 3 * x, c[0], c[1], c[2]);
+        for (cv::v_int16 &channel : c) {
+            cv::v_int32 lo, hi;
+            cv::v_expand(channel, lo, hi);
+            channel = cv::v_pack(wrap16(cv::v_trunc(cv::v_cvt_f32(lo) * r_lo)),
+                                 wrap16(cv::v_trunc(cv::v_cvt_f32(hi) * r_hi)));
+        }
+        cv::v_store_interleave(row + 3 * x, c[0], c[1], c[2]);
+    }
+    cv::vx_cleanup();
+#endif
+    for (; x < width; ++x) {
+        const float r = 1.f / (weight[x] + eps);
+        short *pixel = row + 3 * x;
+        pixel[0] = static_cast<short>(static_cast<int>(pixel[0] * r));
+        pixel[1] = static_cast<short>(static_cast<int>(pixel[1] * r));
+        pixel[2] = static_cast<short>(static_cast<int>(pixel[2] * r));
+    }
+}
+
+void normalizeRow(short *row, const short *weight, int width) {
+    int x = 0;
+#if CV_SIMD
+    const int step = cv::v_int16::nlanes;
+    const cv::v_int32 v_one = cv::vx_setall_s32(1);
+    const cv::v_float32 v_onef = cv::vx_setall_f32(1.f);
+    for (; x <= width - step; x += step) {
+        cv::v_int32 w_lo, w_hi;
+        cv::v_expand(cv::vx_load(weight + x), w_lo, w_hi);
+        w_lo = w_lo + v_one;
+        w_hi = w_hi + v_one;
+        const cv::v_float32 r_lo = v_onef / cv::v_cvt_f32(w_lo);
+        const cv::v_float32 r_hi = v_onef / cv::v_cvt_f32(w_hi);
+
+        cv::v_int16 c[3];
+        cv::v_load_deinterleave(row + 3 * x, c[0], c[1], c[2]);
+        for (cv::v_int16 &channel : c) {
+            cv::v_int32 lo, hi;
+            cv::v_expand(channel, lo, hi);
+            channel = cv::v_pack(divTrunc(cv::v_shl<8>(lo), w_lo, r_lo), divTrunc(cv::v_shl<8>(hi), w_hi, r_hi));
+        }
+        cv::v_store_interleave(row + 3 * x, c[0], c[1], c[2]);
+    }
+    cv::vx_cleanup();
+#endif
+    reference::normalizeRow(row + 3 * x, weight + x, width - x);
+}
+
+void normalizeRow(short *row, const int *weight, int width) {
+    int x = 0;
+#if CV_SIMD
+    const int step = cv::v_int16::nlanes;
+    const int half = cv::v_int32::nlanes;
+    const cv::v_int32 v_one = cv::vx_setall_s32(1);
+    const cv::v_float32 v_onef = cv::vx_setall_f32(1.f);
+    for (; x <= width - step; x += step) {
+        const cv::v_int32 w_lo = cv::vx_load(weight + x) + v_one;
+        const cv::v_int32 w_hi = cv::vx_load(weight + x + half) + v_one;
+        const cv::v_float32 r_lo = v_onef / cv::v_cvt_f32(w_lo);
+        const cv::v_float32 r_hi = v_onef / cv::v_cvt_f32(w_hi);
+
+        cv::v_int16 c[3];
+        cv::v_load_deinterleave(row + 3 * x, c[0], c[1], c[2]);
+        for (cv::v_int16 &channel : c) {
+            cv::v_int32 lo, hi;
+            cv::v_expand(channel, lo, hi);
+            channel = cv::v_pack(divTrunc(cv::v_shl<8>(lo), w_lo, r_lo), divTrunc(cv::v_shl<8>(hi), w_hi, r_hi));
+        }
+        cv::v_store_interleave(row + 3 * x, c[0], c[1], c[2]);
+    }
+    cv::vx_cleanup();
+#endif
+    reference::normalizeRow(row + 3 * x, weight + x, width - x);
+}
+
+namespace reference {
+
+void accumulateRow(const short *src, const float *masks, short *dst, float *dst_weight, int width) {
+    const cv::Point3_<short> *src_row = reinterpret_cast<const cv::Point3_<short> *>(src);
+    const cv::Vec2f *mask_row = reinterpret_cast<const cv::Vec2f *>(masks);
+    cv::Point3_<short> *dst_row = reinterpret_cast<cv::Point3_<short> *>(dst);
+    for (int x = 0; x < width; ++x) {
+        const float blend = mask_row[x][1];
+        dst_row[x].x += static_cast<short>(src_row[x].x * blend);
+        dst_row[x].y += static_cast<short>(src_row[x].y * blend);
+        dst_row[x].z += static_cast<short>(src_row[x].z * blend);
+        dst_weight[x] += mask_row[x][0];
+    }
+}
+
+void accumulateRow(const short *src, const short *masks, short *dst, short *dst_weight, int width) {
+    const cv::Point3_<short> *src_row = reinterpret_cast<const cv::Point3_<short> *>(src);
+    const cv::Vec2s *mask_row = reinterpret_cast<const cv::Vec2s *>(masks);
+    cv::Point3_<short> *dst_row = reinterpret_cast<cv::Point3_<short> *>(dst);
+    for (int x = 0; x < width; ++x) {
+        const int blend = mask_row[x][1];
+        dst_row[x].x += short((src_row[x].x * blend) >> 8);
+        dst_row[x].y += short((src_row[x].y * blend) >> 8);
+        dst_row[x].z += short((src_row[x].z * blend) >> 8);
+        dst_weight[x] = cv::saturate_cast<short>(dst_weight[x] + mask_row[x][0]);
+    }
+}
+
+void accumulateRow(const short *src, const short *masks, short *dst, int *dst_weight, int width) {
+    const cv::Point3_<short> *src_row = reinterpret_cast<const cv::Point3_<short> *>(src);
+    const cv::Vec2s *mask_row = reinterpret_cast<const cv::Vec2s *>(masks);
+    cv::Point3_<short> *dst_row = reinterpret_cast<cv::Point3_<short> *>(dst);
+    for (int x = 0; x < width; ++x) {
+        const int blend = mask_row[x][1];
+        dst_row[x].x += short((src_row[x].x * blend) >> 8);
+        dst_row[x].y += short((src_row[x].y * blend) >> 8);
+        dst_row[x].z += short((src_row[x].z * blend) >> 8);
+        dst_weight[x] += mask_row[x][0];
+    }
+}
+
+void normalizeRow(short *row, const float *weight, float eps, int width) {
+    cv::Point3_<short> *pixels = reinterpret_cast<cv::Point3_<short> *>(row);
+    for (int x = 0; x < width; ++x) {
+        pixels[x].x = static_cast<short>(pixels[x].x / (weight[x] + eps));
+        pixels[x].y = static_cast<short>(pixels[x].y / (weight[x] + eps));
+        pixels[x].z = static_cast<short>(pixels[x].z / (weight[x] + eps));
+    }
+}
+
+void normalizeRow(short *row, const short *weight, int width) {
+    cv::Point3_<short> *pixels = reinterpret_cast<cv::Point3_<short> *>(row);
+    for (int x = 0; x < width; ++x) {
+        int w = weight[x] + 1;
+        pixels[x].x = cv::saturate_cast<short>((pixels[x].x * 256) / w);
+        pixels[x].y = cv::saturate_cast<short>((pixels[x].y * 256) / w);
+        pixels[x].z = cv::saturate_cast<short>((pixels[x].z * 256) / w);
+    }
+}
+
+void normalizeRow(short *row, const int *weight, int width) {
+    cv::Point3_<short> *pixels = reinterpret_cast<cv::Point3_<short> *>(row);
+    for (int x = 0; x < width; ++x) {
+        int w = weight[x] + 1;
+        pixels[x].x = cv::saturate_cast<short>((pixels[x].x * 256) / w);
+        pixels[x].y = cv::saturate_cast<short>((pixels[x].y * 256) / w);
+        pixels[x].z = cv::saturate_cast<short>((pixels[x].z * 256) / w);
+    }
+}
+
+} // namespace reference
+
+} // namespace blendkernels
@@ -0,0 +1,87 @@
+#ifndef BLENDKERNELS_H
+#define BLENDKERNELS_H
+
+#include <opencv2/core.hpp>
+
+/**
+ * @brief Row kernels of the dual-mask blender
+ *
+ * Rows are interleaved 3-channel shorts (cv::Point3_<short>). The default
+ * versions use OpenCV universal intrinsics when available; the versions in
+ * blendkernels::reference are the original scalar loops, kept for tests and
+ * benchmarks. The OpenCL versions work on whole device levels with the same
+ * arithmetic.
+ */
+namespace blendkernels {
+
+/**
+ * @brief dst += short(src * blend) per channel, dst_weight += weight
+ *
+ * masks holds interleaved (weight, blend) pairs, one per pixel.
+ */
+void accumulateRow(const short *src, const float *masks, short *dst, float *dst_weight, int width);
+
+/**
+ * @brief dst += (src * blend) >> 8 per channel, dst_weight += weight (fixed point, 256 = 1)
+ *
+ * masks holds interleaved (weight, blend) pairs, one per pixel. dst_weight
+ * saturates at SHRT_MAX (about 127 fully overlapping images).
+ */
+void accumulateRow(const short *src, const short *masks, short *dst, short *dst_weight, int width);
+
+/**
+ * @brief Same as the CV_16S version with 32-bit accumulated weights
+ */
+void accumulateRow(const short *src, const short *masks, short *dst, int *dst_weight, int width);
+
+/**
+ * @brief row = short(row * (1 / (weight + eps))) per channel
+ *
+ * One reciprocal per pixel instead of one division per channel; may differ
+ * from the reference by one where the quotient is within rounding of an integer.
+ */
+void normalizeRow(short *row, const float *weight, float eps, int width);
+
+/**
+ * @brief row = saturate((row << 8) / (weight + 1)) per channel, exact integer division
+ */
+void normalizeRow(short *row, const short *weight, int width);
+
+/**
+ * @brief Same as the CV_16S version with 32-bit weights, exact for weights below 2^24
+ */
+void normalizeRow(short *row, const int *weight, int width);
+
+/**
+ * @brief OpenCL version of accumulateRow() over a whole level
+ * @param src Source Laplacian level (CV_16SC3)
+ * @param masks Source (weight, blend) mask level (CV_32FC2 or CV_16SC2)
+ * @param dst Destination Laplacian region (CV_16SC3)
+ * @param dst_weight Destination weight region (CV_32F, CV_16S or CV_32S)
+ * @return false if OpenCL is off or the kernel cannot run; nothing is changed then
+ *
+ * Waits for the kernel, so callers' locks cover the device work.
+ */
+bool accumulateOcl(const cv::UMat &src, const cv::UMat &masks, cv::UMat &dst, cv::UMat &dst_weight);
+
+/**
+ * @brief OpenCL version of normalizeRow() over a whole level
+ * @param level Laplacian level (CV_16SC3)
+ * @param weight Accumulated weights (CV_32F, CV_16S or CV_32S)
+ * @param eps Added to CV_32F weights
+ * @return false if OpenCL is off or the kernel cannot run; nothing is changed then
+ */
+bool normalizeOcl(cv::UMat &level, const cv::UMat &weight, float eps);
+
+namespace reference {
+void accumulateRow(const short *src, const float *masks, short *dst, float *dst_weight, int width);
+void accumulateRow(const short *src, const short *masks, short *dst, short *dst_weight, int width);
+void accumulateRow(const short *src, const short *masks, short *dst, int *dst_weight, int width);
+void normalizeRow(short *row, const float *weight, float eps, int width);
+void normalizeRow(short *row, const short *weight, int width);
+void normalizeRow(short *row, const int *weight, int width);
+} // namespace reference
+
+} // namespace blendkernels
+
+#endif // BLENDKERNELS_H
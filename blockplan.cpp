@@ -0,0 +1,227 @@
+#include "blockplan.h"
+
+#include "tiffwriter.h"
+
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+
+namespace {
+const QString kPlanName = QStringLiteral("plan.json");
+
+// Bump when the plan or job layout changes
+constexpr int kBlockPlanVersion = 1;
+
+// Rows merged at a time: one band of output tiles
+constexpr int kMergeBandRows = TiledTiffWriter::kDefaultTileSize;
+
+QJsonArray rectToJson(const cv::Rect &rect) {
+	return QJsonArray{rect.x, rect.y, rect.width, rect.height};
+}
+
+cv::Rect rectFromJson(const QJsonValue &value) {
+	const QJsonArray array = value.toArray();
+	if (array.size() != 4)
+		return cv::Rect();
+	return cv::Rect(array.at(0).toInt(), array.at(1).toInt(), array.at(2).toInt(), array.at(3).toInt());
+}
+
+bool saveJson(const QString &path, const QJsonObject &root, QString *errorMessage) {
+	QSaveFile file(path);
+	if (!file.open(QIODevice::WriteOnly)) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Unable to write %1").arg(path);
+		return false;
+	}
+	file.write(QJsonDocument(root).toJson());
+	if (!file.commit()) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Unable to write %1").arg(path);
+		return false;
+	}
+	return true;
+}
+
+bool loadJson(const QString &path, QJsonObject *root, QString *errorMessage) {
+	QFile file(path);
+	if (!file.open(QIODevice::ReadOnly)) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Unable to open %1").arg(path);
+		return false;
+	}
+	QJsonParseError parseError;
+	const QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &parseError);
+	if (!document.isObject()) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Invalid JSON in %1: %2").arg(path, parseError.errorString());
+		return false;
+	}
+	*root = document.object();
+	if (root->value(QStringLiteral("version")).toInt() != kBlockPlanVersion) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Unsupported version in %1").arg(path);
+		return false;
+	}
+	return true;
+}
+}
+
+QVector<cv::Rect> partitionCanvas(const QSize &canvasSize, int blockSize, int gridSize) {
+	CV_Assert(blockSize > 0 && gridSize > 0);
+	const int step = (blockSize + gridSize - 1) / gridSize * gridSize;
+
+	QVector<cv::Rect> blocks;
+	for (int y = 0; y < canvasSize.height(); y += step) {
+		for (int x = 0; x < canvasSize.width(); x += step)
+			blocks.push_back(cv::Rect(x, y, std::min(step, canvasSize.width() - x), std::min(step, canvasSize.height() - y)));
+	}
+	return blocks;
+}
+
+bool writeBlockPlan(const QString &directory, const BlockPlan &plan, QString *errorMessage) {
+	QJsonArray blocks;
+	for (const BlockJob &block : plan.blocks) {
+		QJsonObject job;
+		job.insert(QStringLiteral("version"), kBlockPlanVersion);
+		job.insert(QStringLiteral("rect"), rectToJson(block.rect));
+		job.insert(QStringLiteral("halo"), plan.halo);
+		job.insert(QStringLiteral("tiles"), QJsonArray::fromStringList(block.tiles));
+		job.insert(QStringLiteral("output"), block.output);
+		job.insert(QStringLiteral("arguments"), QJsonArray::fromStringList(block.arguments));
+		if (!saveJson(block.jobPath, job, errorMessage))
+			return false;
+
+		QJsonObject entry;
+		entry.insert(QStringLiteral("rect"), rectToJson(block.rect));
+		entry.insert(QStringLiteral("output"), block.output);
+		entry.insert(QStringLiteral("job"), block.jobPath);
+		blocks.push_back(entry);
+	}
+
+	QJsonObject root;
+	root.insert(QStringLiteral("version"), kBlockPlanVersion);
+	root.insert(QStringLiteral("canvas"), QJsonArray{plan.canvasSize.width(), plan.canvasSize.height()});
+	root.insert(QStringLiteral("halo"), plan.halo);
+	root.insert(QStringLiteral("output"), plan.output);
+	root.insert(QStringLiteral("compression"), plan.compression);
+	root.insert(QStringLiteral("overviews"), plan.overviewLevels);
+	root.insert(QStringLiteral("blocks"), blocks);
+	return saveJson(QDir(directory).absoluteFilePath(kPlanName), root, errorMessage);
+}
+
+bool readBlockPlan(const QString &path, BlockPlan *plan, QString *errorMessage) {
+	QJsonObject root;
+	if (!loadJson(path, &root, errorMessage))
+		return false;
+
+	const QJsonArray canvas = root.value(QStringLiteral("canvas")).toArray();
+	*plan = BlockPlan();
+	plan->canvasSize = QSize(canvas.at(0).toInt(), canvas.at(1).toInt());
+	plan->halo = root.value(QStringLiteral("halo")).toInt();
+	plan->output = root.value(QStringLiteral("output")).toString();
+	plan->compression = root.value(QStringLiteral("compression")).toString();
+	plan->overviewLevels = root.value(QStringLiteral("overviews")).toInt();
+	for (const QJsonValue &value : root.value(QStringLiteral("blocks")).toArray()) {
+		const QJsonObject entry = value.toObject();
+		BlockJob block;
+		block.rect = rectFromJson(entry.value(QStringLiteral("rect")));
+		block.output = entry.value(QStringLiteral("output")).toString();
+		block.jobPath = entry.value(QStringLiteral("job")).toString();
+		plan->blocks.push_back(block);
+	}
+
+	const cv::Rect canvasRect(0, 0, plan->canvasSize.width(), plan->canvasSize.height());
+	for (const BlockJob &block : plan->blocks) {
+		if (block.rect.empty() || (block.rect & canvasRect) != block.rect || block.output.isEmpty()) {
+			if (errorMessage)
+				*errorMessage = QStringLiteral("Invalid block in %1").arg(path);
+			return false;
+		}
+	}
+	if (canvasRect.empty() || plan->output.isEmpty() || plan->overviewLevels < -1) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Invalid canvas, output or overviews in %1").arg(path);
+		return false;
+	}
+	return true;
+}
+
+bool readBlockJob(const QString &path, QStringList *arguments, QStringList *tiles, QString *errorMessage) {
+	QJsonObject root;
+	if (!loadJson(path, &root, errorMessage))
+		return false;
+
+	*arguments = QStringList();
+	for (const QJsonValue &value : root.value(QStringLiteral("arguments")).toArray())
+		arguments->push_back(value.toString());
+	*tiles = QStringList();
+	for (const QJsonValue &value : root.value(QStringLiteral("tiles")).toArray())
+		tiles->push_back(value.toString());
+	if (arguments->isEmpty()) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("No worker arguments in %1").arg(path);
+		return false;
+	}
+	return true;
+}
+
+bool mergeBlocks(const BlockPlan &plan, QString *errorMessage) {
+	TiledTiffWriter::Compression compression = TiledTiffWriter::Compression::None;
+	if (!plan.compression.isEmpty() && !TiledTiffWriter::parseCompression(plan.compression, &compression)) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Invalid compression in plan: %1").arg(plan.compression);
+		return false;
+	}
+
+	TiledTiffWriter writer;
+	writer.setOverviewLevels(plan.overviewLevels);
+	if (!writer.open(plan.output, plan.canvasSize, compression, errorMessage))
+		return false;
+
+	// One band of output tiles at a time; only the blocks crossing it are open.
+	// Pixels no block covers stay black.
+	std::map<int, std::unique_ptr<TiledTiffReader>> readers;
+	cv::Mat band;
+	for (int y = 0; y < plan.canvasSize.height(); y += kMergeBandRows) {
+		const int rows = std::min(kMergeBandRows, plan.canvasSize.height() - y);
+		band.create(rows, plan.canvasSize.width(), CV_8UC3);
+		band.setTo(cv::Scalar::all(0));
+
+		for (int i = 0; i < plan.blocks.size(); ++i) {
+			const BlockJob &block = plan.blocks.at(i);
+			if (block.rect.br().y <= y) {
+				readers.erase(i);
+				continue;
+			}
+			const cv::Rect part = block.rect & cv::Rect(0, y, plan.canvasSize.width(), rows);
+			if (part.empty())
+				continue;
+
+			std::unique_ptr<TiledTiffReader> &reader = readers[i];
+			if (!reader) {
+				reader.reset(new TiledTiffReader());
+				if (!reader->open(block.output, errorMessage))
+					return false;
+				if (reader->size() != QSize(block.rect.width, block.rect.height)) {
+					if (errorMessage)
+						*errorMessage = QStringLiteral("Block %1 does not match its rectangle in the plan").arg(block.output);
+					return false;
+				}
+			}
+			cv::Mat dst = band(part - cv::Point(0, y));
+			if (!reader->readRegion(part - block.rect.tl(), dst, errorMessage))
+				return false;
+		}
+
+		if (!writer.writeRows(band, errorMessage))
+			return false;
+	}
+	return writer.close(errorMessage);
+}
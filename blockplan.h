@@ -0,0 +1,47 @@
+#ifndef BLOCKPLAN_H
+#define BLOCKPLAN_H
+
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <opencv2/core.hpp>
+
+// One block of a partitioned canvas, blended on its own by `retawny --job=FILE`
+struct BlockJob {
+	cv::Rect rect;          // canvas pixels produced by the block
+	QStringList tiles;      // tiles within the halo of rect, the only ones the worker feeds
+	QString output;         // block TIFF written by the worker
+	QString jobPath;        // job description file
+	QStringList arguments;  // worker command line (after the program name)
+};
+
+// A canvas split into blocks that can run on different machines. Each block
+// is blended over itself plus a halo of the pyramid support
+// (DualMaskMultiBandBlender::supportForBands()), so that its pixels can match
+// a blend of the whole canvas; bench/pipeline_bench --check-partition compares
+// the two, and no passing run is recorded yet. `retawny --merge=FILE` then
+// assembles the blocks into the final tiled TIFF.
+struct BlockPlan {
+	QSize canvasSize;
+	int halo = 0;
+	QString output;       // merged TIFF
+	QString compression;  // of the block and merged TIFFs, as accepted by TiledTiffWriter::parseCompression()
+	int overviewLevels = 0;  // of the merged TIFF, see TiledTiffWriter::setOverviewLevels()
+	QVector<BlockJob> blocks;  // row by row, top to bottom
+};
+
+// Blocks of blockSize pixels (rounded up to whole gridSize tiles) covering the canvas, row by row
+QVector<cv::Rect> partitionCanvas(const QSize &canvasSize, int blockSize, int gridSize);
+
+// Writes plan.json and each block's job file (block.jobPath) into directory
+bool writeBlockPlan(const QString &directory, const BlockPlan &plan, QString *errorMessage = nullptr);
+bool readBlockPlan(const QString &path, BlockPlan *plan, QString *errorMessage = nullptr);
+// Worker command line of a job file, and the tiles it feeds
+bool readBlockJob(const QString &path, QStringList *arguments, QStringList *tiles, QString *errorMessage = nullptr);
+
+// Assembles the block TIFFs (cropped to their blocks by the workers) into plan.output, tile band by tile band
+bool mergeBlocks(const BlockPlan &plan, QString *errorMessage = nullptr);
+
+#endif // BLOCKPLAN_H
@@ -0,0 +1,70 @@
+#include "coveragemask.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+
+namespace {
+// Per-thread scratch for feathering; create() keeps the buffers while tile sizes repeat
+struct MaskArena {
+	cv::Mat binary;        // CV_8U coverage before feathering
+	cv::Mat distance;      // CV_32F distance to masked pixels, then to the nearest of those and the border
+	cv::Mat columnBorder;  // CV_32F row of min(x, w - 1 - x)
+};
+
+MaskArena &maskArena() {
+	thread_local MaskArena arena;
+	return arena;
+}
+
+// Writes coverage of the loaded mask or of the non-magenta pixels to mask
+void binarize(const cv::Mat &bgr, const cv::Mat &loadedMask, cv::Mat &mask) {
+	if (!loadedMask.empty()) {
+		// PC_: invert and binarize (black/0=utile → 255, white/255=masqué → 0)
+		cv::compare(loadedMask, 128, mask, cv::CMP_LT);
+	} else {
+		// Fallback: detect magenta pixels in source image
+		cv::inRange(bgr, cv::Scalar(255, 0, 255), cv::Scalar(255, 0, 255), mask);
+		cv::bitwise_not(mask, mask);
+	}
+}
+}
+
+cv::Mat buildCoverageMask(const cv::Mat &bgr, const cv::Mat &loadedMask, double featherRadius, bool sharp) {
+	if (bgr.empty())
+		return cv::Mat();
+
+	// Voronoi: preserve gradient (already 255=utile from generation)
+	if (sharp && !loadedMask.empty())
+		return loadedMask;
+
+	if (sharp || featherRadius <= 1.0) {
+		cv::Mat mask;
+		binarize(bgr, loadedMask, mask);
+		return mask;
+	}
+
+	MaskArena &arena = maskArena();
+	binarize(bgr, loadedMask, arena.binary);
+
+	// Distance transform from masked regions (magenta pixels)
+	cv::distanceTransform(arena.binary, arena.distance, cv::DIST_L2, 3);
+
+	// Distance to the nearest border pixel, in closed form: min(x, y, w - 1 - x, h - 1 - y)
+	const int width = arena.distance.cols;
+	const int height = arena.distance.rows;
+	arena.columnBorder.create(1, width, CV_32F);
+	float *columnBorder = arena.columnBorder.ptr<float>();
+	for (int x = 0; x < width; ++x)
+		columnBorder[x] = static_cast<float>(std::min(x, width - 1 - x));
+	for (int y = 0; y < height; ++y) {
+		cv::Mat row = arena.distance.row(y);
+		cv::min(row, arena.columnBorder, row);
+		cv::min(row, static_cast<double>(std::min(y, height - 1 - y)), row);
+	}
+
+	// Normalize by feather radius; converting to 8 bits saturates at 1
+	cv::Mat feathered;
+	arena.distance.convertTo(feathered, CV_8UC1, 255.0 / featherRadius);
+	return feathered;
+}
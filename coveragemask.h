@@ -0,0 +1,15 @@
+#ifndef COVERAGEMASK_H
+#define COVERAGEMASK_H
+
+#include <opencv2/core.hpp>
+
+// Builds the CV_8U coverage mask of a tile (255 = usable pixel).
+// loadedMask is a CV_8UC1 PC_ mask (black = usable, binarized and feathered)
+// or, with sharp, a Voronoi mask returned as is, without a copy. Without a
+// loaded mask, magenta pixels of bgr are masked out. Feathering ramps to 255
+// over featherRadius pixels away from masked pixels and the tile border.
+// Scratch buffers are kept per thread and reused across tiles.
+cv::Mat buildCoverageMask(const cv::Mat &bgr, const cv::Mat &loadedMask = cv::Mat(),
+                          double featherRadius = 512.0, bool sharp = false);
+
+#endif // COVERAGEMASK_H
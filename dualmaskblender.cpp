@@ -1,4 +1,5 @@
 #include "dualmaskblender.h"
+#include "blendkernels.h"
 #include <opencv2/imgproc.hpp>
 #include <opencv2/stitching/detail/util.hpp>
 #include <cmath>
@@ -7,60 +8,266 @@
 namespace {
 static const float WEIGHT_EPS = 1e-5f;
 
-// Helper function to create Laplacian pyramid
-void createLaplacePyr(cv::InputArray img, int num_levels, std::vector<cv::UMat> &pyr) {
-    pyr.resize(num_levels + 1);
+// Smallest margin, in level-i pixels, kept around the footprint at every level.
+// Covers the spread of the mask Gaussian pyramids (about 2 pixels per level),
+// so the mask pyramids are exact inside the windows. The image pyramids are
+// not: they reflect at the window edges, and at deep levels that reflection
+// reaches inside the footprint, so sources blended through windows only
+// approximate an unwindowed blend there.
+static const int FOOTPRINT_MARGIN = 8;
 
-    if (img.depth() == CV_8U) {
-        if (num_levels == 0) {
-            img.getUMat().convertTo(pyr[0], CV_16S);
-            return;
-        }
+// Rows of level 0 taking the directly copied pixels at once
+static const int DIRECT_BAND_ROWS = 256;
 
-        cv::UMat downNext;
-        cv::UMat current = img.getUMat();
-        cv::pyrDown(img, downNext);
+// Milliseconds elapsed since a cv::getTickCount() value
+double msSince(int64 start) {
+    return (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+}
 
-        for (int i = 1; i < num_levels; ++i) {
-            cv::UMat lvl_up;
-            cv::UMat lvl_down;
+// Windows (in level-i destination coordinates) holding the pyramid levels of a
+// source whose non-zero masks lie in footprint. The margin halves with each
+// level down to FOOTPRINT_MARGIN, so every window is covered by twice the next one.
+std::vector<cv::Rect> footprintWindows(const cv::Rect &footprint, int margin, const std::vector<cv::Size> &level_sizes) {
+    std::vector<cv::Rect> windows(level_sizes.size());
+    for (size_t i = 0; i < level_sizes.size(); ++i) {
+        const int scale = 1 << i;
+        const int m = std::max(FOOTPRINT_MARGIN, (margin + scale - 1) / scale);
+        const int x0 = std::max(0, (footprint.x >> i) - m);
+        const int y0 = std::max(0, (footprint.y >> i) - m);
+        const int x1 = std::min(level_sizes[i].width, ((footprint.br().x + scale - 1) >> i) + m);
+        const int y1 = std::min(level_sizes[i].height, ((footprint.br().y + scale - 1) >> i) + m);
+        windows[i] = cv::Rect(x0, y0, x1 - x0, y1 - y0);
+    }
+    return windows;
+}
 
-            cv::pyrDown(downNext, lvl_down);
-            cv::pyrUp(downNext, lvl_up, current.size());
-            cv::subtract(current, lvl_up, pyr[i-1], cv::noArray(), CV_16S);
+// Gaussian level over window next from the previous level known over window cur.
+// Pixels of the previous level outside cur are filled with border_type.
+void pyrDownWindow(const cv::UMat &level, const cv::Rect &cur, const cv::Rect &next, int border_type,
+                   PyramidPool &pool, cv::UMat &dst) {
+    const cv::Rect src(next.x * 2, next.y * 2, next.width * 2, next.height * 2);
+    const cv::Rect avail = src & cur;
+    cv::UMat extended = pool.take(src.size(), level.type());
+    cv::copyMakeBorder(level(avail - cur.tl()), extended,
+                       avail.y - src.y, src.br().y - avail.br().y,
+                       avail.x - src.x, src.br().x - avail.br().x, border_type);
+    dst = pool.take(next.size(), level.type());
+    cv::pyrDown(extended, dst, next.size());
+    pool.give(extended);
+}
 
-            current = downNext;
-            downNext = lvl_down;
-        }
+// pyrDownWindow() for a level known over a band cur inside its full window:
+// beyond the sides cur shares with full the level is reflected, as
+// pyrDownWindow() does over full; beyond the others it is the constant value.
+void pyrDownBand(const cv::UMat &level, const cv::Rect &cur, const cv::Rect &full, const cv::Rect &next,
+                 const cv::Scalar &value, PyramidPool &pool, cv::UMat &dst) {
+    const cv::Rect src(next.x * 2, next.y * 2, next.width * 2, next.height * 2);
+    const cv::Rect avail = src & cur;
+    const int pads[4] = {avail.y - src.y, src.br().y - avail.br().y, avail.x - src.x, src.br().x - avail.br().x};
+    const bool shared[4] = {cur.y == full.y, cur.br().y == full.br().y, cur.x == full.x, cur.br().x == full.br().x};
+    int reflected[4], constant[4];
+    for (int k = 0; k < 4; ++k) {
+        reflected[k] = shared[k] ? pads[k] : 0;
+        constant[k] = pads[k] - reflected[k];
+    }
+    cv::UMat mirrored = pool.take(cv::Size(avail.width + reflected[2] + reflected[3],
+                                           avail.height + reflected[0] + reflected[1]), level.type());
+    cv::copyMakeBorder(level(avail - cur.tl()), mirrored, reflected[0], reflected[1], reflected[2], reflected[3],
+                       cv::BORDER_REFLECT);
+    cv::UMat extended = pool.take(src.size(), level.type());
+    cv::copyMakeBorder(mirrored, extended, constant[0], constant[1], constant[2], constant[3],
+                       cv::BORDER_CONSTANT, value);
+    pool.give(mirrored);
+    dst = pool.take(next.size(), level.type());
+    cv::pyrDown(extended, dst, next.size());
+    pool.give(extended);
+}
 
-        {
-            cv::UMat lvl_up;
-            cv::pyrUp(downNext, lvl_up, current.size());
-            cv::subtract(current, lvl_up, pyr[num_levels-1], cv::noArray(), CV_16S);
+// Copies src, known over rect inside window, to a window-sized level padded with value
+void padToWindow(cv::UMat &src, const cv::Rect &rect, const cv::Rect &window, const cv::Scalar &value,
+                 PyramidPool &pool, cv::UMat &dst) {
+    dst = pool.take(window.size(), src.type());
+    cv::copyMakeBorder(src, dst, rect.y - window.y, window.br().y - rect.br().y,
+                       rect.x - window.x, window.br().x - rect.br().x, cv::BORDER_CONSTANT, value);
+    pool.give(src);
+}
 
-            downNext.convertTo(pyr[num_levels], CV_16S);
-        }
+// Laplacian pyramid over per-level windows, from level 0 known over windows[0].
+// The time spent on each level is added to level_ms.
+void createLaplacePyr(cv::UMat &img, const std::vector<cv::Rect> &windows, PyramidPool &pool,
+                      std::vector<cv::UMat> &pyr, std::vector<double> &level_ms) {
+    const int num_levels = static_cast<int>(windows.size()) - 1;
+    pyr.resize(num_levels + 1);
+
+    cv::UMat current = img;
+    img.release();
+    for (int i = 0; i < num_levels; ++i) {
+        const int64 start = cv::getTickCount();
+        cv::UMat next;
+        pyrDownWindow(current, windows[i], windows[i + 1], cv::BORDER_REFLECT, pool, next);
+
+        // The upsampled next level covers twice its window, which contains windows[i]
+        const cv::Rect up_rect(windows[i + 1].x * 2, windows[i + 1].y * 2,
+                               windows[i + 1].width * 2, windows[i + 1].height * 2);
+        cv::UMat up = pool.take(up_rect.size(), next.type());
+        cv::pyrUp(next, up, up_rect.size());
+        pyr[i] = pool.take(windows[i].size(), CV_MAKETYPE(CV_16S, current.channels()));
+        cv::subtract(current, up(windows[i] - up_rect.tl()), pyr[i], cv::noArray(), CV_16S);
+        pool.give(up);
+        pool.give(current);
+        current = next;
+        level_ms[i] += msSince(start);
+    }
+    const int64 start = cv::getTickCount();
+    if (current.depth() == CV_16S) {
+        pyr[num_levels] = current;
     } else {
-        pyr[0] = img.getUMat();
-        for (int i = 0; i < num_levels; ++i)
-            cv::pyrDown(pyr[i], pyr[i + 1]);
-        cv::UMat tmp;
-        for (int i = 0; i < num_levels; ++i) {
-            cv::pyrUp(pyr[i + 1], tmp, pyr[i].size());
-            cv::subtract(pyr[i], tmp, pyr[i]);
-        }
+        pyr[num_levels] = pool.take(current.size(), CV_MAKETYPE(CV_16S, current.channels()));
+        current.convertTo(pyr[num_levels], CV_16S);
+        pool.give(current);
+    }
+    level_ms[num_levels] += msSince(start);
+}
+
+// createLaplacePyr() of a level 0 that equals the constant value outside band
+// windows (inside windows). Both pyramids are computed over the band windows
+// only; the Laplacian levels are zero beyond them and the coarsest level is
+// the constant, so the result is padded out to windows.
+void createBandLaplacePyr(cv::UMat &img, const std::vector<cv::Rect> &bands, const std::vector<cv::Rect> &windows,
+                          const cv::Scalar &value, PyramidPool &pool, std::vector<cv::UMat> &pyr,
+                          std::vector<double> &level_ms) {
+    const int num_levels = static_cast<int>(windows.size()) - 1;
+    pyr.resize(num_levels + 1);
+
+    cv::UMat current = img;
+    img.release();
+    for (int i = 0; i < num_levels; ++i) {
+        const int64 start = cv::getTickCount();
+        cv::UMat next;
+        pyrDownBand(current, bands[i], windows[i], bands[i + 1], value, pool, next);
+
+        const cv::Rect up_rect(bands[i + 1].x * 2, bands[i + 1].y * 2, bands[i + 1].width * 2, bands[i + 1].height * 2);
+        cv::UMat up = pool.take(up_rect.size(), next.type());
+        cv::pyrUp(next, up, up_rect.size());
+        cv::UMat band = pool.take(bands[i].size(), CV_MAKETYPE(CV_16S, current.channels()));
+        cv::subtract(current, up(bands[i] - up_rect.tl()), band, cv::noArray(), CV_16S);
+        pool.give(up);
+        pool.give(current);
+        padToWindow(band, bands[i], windows[i], cv::Scalar::all(0), pool, pyr[i]);
+        current = next;
+        level_ms[i] += msSince(start);
+    }
+    const int64 start = cv::getTickCount();
+    cv::UMat coarsest = current;
+    if (current.depth() != CV_16S) {
+        coarsest = pool.take(current.size(), CV_MAKETYPE(CV_16S, current.channels()));
+        current.convertTo(coarsest, CV_16S);
+        pool.give(current);
     }
+    padToWindow(coarsest, bands[num_levels], windows[num_levels], value, pool, pyr[num_levels]);
+    level_ms[num_levels] += msSince(start);
 }
 
-// Helper function to restore image from Laplacian pyramid
-void restoreImageFromLaplacePyr(std::vector<cv::UMat> &pyr) {
-    if (pyr.empty())
+// Calls run(x0, x1) for each run of zeros of a skip row, or once for the whole row without one
+template <typename Run>
+void forEachKeptRun(const uchar *skip, int width, Run run) {
+    if (!skip) {
+        run(0, width);
         return;
-    cv::UMat tmp;
-    for (size_t i = pyr.size() - 1; i > 0; --i) {
-        cv::pyrUp(pyr[i], tmp, pyr[i - 1].size());
-        cv::add(tmp, pyr[i - 1], pyr[i - 1]);
     }
+    for (int x = 0; x < width;) {
+        while (x < width && skip[x])
+            ++x;
+        const int x0 = x;
+        while (x < width && !skip[x])
+            ++x;
+        if (x > x0)
+            run(x0, x);
+    }
+}
+
+// Lookup table from 8-bit mask values to weights: v / 255 for CV_32F, or
+// fixed point v + (v != 0) (256 = 1) for CV_16S
+cv::Mat maskLut(int weight_type) {
+    cv::Mat lut(1, 256, weight_type);
+    for (int v = 0; v < 256; ++v) {
+        if (weight_type == CV_32F)
+            lut.at<float>(v) = v / 255.f;
+        else
+            lut.at<short>(v) = static_cast<short>(v + (v != 0));
+    }
+    return lut;
+}
+
+// Gaussian pyramid of a mask over per-level windows; the mask is zero outside them.
+// The time spent on each level is added to level_ms.
+void createMaskPyr(cv::UMat &mask, const std::vector<cv::Rect> &windows, PyramidPool &pool,
+                   std::vector<cv::UMat> &pyr, std::vector<double> &level_ms) {
+    pyr.resize(windows.size());
+    pyr[0] = mask;
+    mask.release();
+    for (size_t i = 0; i + 1 < windows.size(); ++i) {
+        const int64 start = cv::getTickCount();
+        pyrDownWindow(pyr[i], windows[i], windows[i + 1], cv::BORDER_CONSTANT, pool, pyr[i + 1]);
+        level_ms[i + 1] += msSince(start);
+    }
+}
+
+// Calls f(rect) for each horizontal run of non-zero blocks of a block grid,
+// rect being the run's pixels in a level of the given size, in row order
+template <typename F>
+void forEachBlockRun(const cv::Mat &blocks, int block_size, cv::Size size, F f) {
+    for (int by = 0; by < blocks.rows; ++by) {
+        const uchar *row = blocks.ptr<uchar>(by);
+        for (int bx = 0; bx < blocks.cols;) {
+            while (bx < blocks.cols && !row[bx])
+                ++bx;
+            const int bx0 = bx;
+            while (bx < blocks.cols && row[bx])
+                ++bx;
+            const cv::Rect run = cv::Rect(bx0 * block_size, by * block_size, (bx - bx0) * block_size, block_size) &
+                                 cv::Rect(cv::Point(), size);
+            if (!run.empty())
+                f(run);
+        }
+    }
+}
+
+// Coarse pixels pyrUp() needs, two extra on each side, for the fine rows or
+// columns [p0, p1): the slab borders then do not reach them
+void coarseRange(int p0, int p1, int coarse_size, int *c0, int *c1) {
+    *c0 = std::max(0, p0 / 2 - 2);
+    *c1 = std::min(coarse_size, (p1 + 1) / 2 + 2);
+}
+
+// Collapses levels 0 .. coarsest of a pyramid known over per-level windows (in
+// level-i destination coordinates) into its level-0 pixels over target, as
+// restoreLevels() does. level(i) returns the level-i pixels over windows[i], or
+// an empty Mat for a level of zeros. Each coarser rectangle holds the pixels the
+// finer one expands from (see coarseRange()), clipped to its window, so away
+// from the window edges the pixels match a collapse of the whole levels.
+template <typename Level>
+cv::Mat collapseRect(Level level, const std::vector<cv::Rect> &windows, int coarsest, const cv::Rect &target) {
+    std::vector<cv::Rect> rects(coarsest + 1);
+    rects[0] = target & windows[0];
+    for (int i = 1; i <= coarsest; ++i) {
+        const cv::Rect &fine = rects[i - 1];
+        const cv::Rect &window = windows[i];
+        const int x0 = std::max(window.x, fine.x / 2 - 2), y0 = std::max(window.y, fine.y / 2 - 2);
+        const int x1 = std::min(window.br().x, (fine.br().x + 1) / 2 + 2);
+        const int y1 = std::min(window.br().y, (fine.br().y + 1) / 2 + 2);
+        rects[i] = cv::Rect(x0, y0, x1 - x0, y1 - y0);
+    }
+    cv::Mat current = level(coarsest)(rects[coarsest] - windows[coarsest].tl()).clone();
+    for (int i = coarsest; i > 0; --i) {
+        cv::Mat up;
+        cv::pyrUp(current, up, cv::Size(2 * rects[i].width, 2 * rects[i].height));
+        current = up(rects[i - 1] - 2 * rects[i].tl()).clone();
+        const cv::Mat finer = level(i - 1);
+        if (!finer.empty())
+            cv::add(current, finer(rects[i - 1] - windows[i - 1].tl()), current);
+    }
+    return current;
 }
 
 // Helper function to normalize using weight map
@@ -71,30 +278,16 @@ void normalizeUsingWeightMap(cv::InputArray _weight, cv::InputOutputArray _src)
     CV_Assert(src.type() == CV_16SC3);
 
     if (weight.type() == CV_32FC1) {
-        for (int y = 0; y < src.rows; ++y) {
-            cv::Point3_<short> *row = src.ptr<cv::Point3_<short>>(y);
-            const float *weight_row = weight.ptr<float>(y);
-
-            for (int x = 0; x < src.cols; ++x) {
-                row[x].x = static_cast<short>(row[x].x / (weight_row[x] + WEIGHT_EPS));
-                row[x].y = static_cast<short>(row[x].y / (weight_row[x] + WEIGHT_EPS));
-                row[x].z = static_cast<short>(row[x].z / (weight_row[x] + WEIGHT_EPS));
-            }
-        }
+        for (int y = 0; y < src.rows; ++y)
+            blendkernels::normalizeRow(src.ptr<short>(y), weight.ptr<float>(y), WEIGHT_EPS, src.cols);
+    } else if (weight.type() == CV_32SC1) {
+        for (int y = 0; y < src.rows; ++y)
+            blendkernels::normalizeRow(src.ptr<short>(y), weight.ptr<int>(y), src.cols);
     } else {
         CV_Assert(weight.type() == CV_16SC1);
 
-        for (int y = 0; y < src.rows; ++y) {
-            const short *weight_row = weight.ptr<short>(y);
-            cv::Point3_<short> *row = src.ptr<cv::Point3_<short>>(y);
-
-            for (int x = 0; x < src.cols; ++x) {
-                int w = weight_row[x] + 1;
-                row[x].x = static_cast<short>((row[x].x << 8) / w);
-                row[x].y = static_cast<short>((row[x].y << 8) / w);
-                row[x].z = static_cast<short>((row[x].z << 8) / w);
-            }
-        }
+        for (int y = 0; y < src.rows; ++y)
+            blendkernels::normalizeRow(src.ptr<short>(y), weight.ptr<short>(y), src.cols);
     }
 }
 
@@ -102,7 +295,7 @@ void normalizeUsingWeightMap(cv::InputArray _weight, cv::InputOutputArray _src)
 
 
 DualMaskMultiBandBlender::DualMaskMultiBandBlender(int num_bands, int weight_type)
-    : actual_num_bands_(0), num_bands_(0), weight_type_(weight_type) {
+    : actual_num_bands_(0), num_bands_(0), weight_type_(weight_type), pool_(std::make_shared<PyramidPool>()) {
     CV_Assert(weight_type == CV_32F || weight_type == CV_16S);
     setNumBands(num_bands);
 }
@@ -112,200 +305,591 @@ void DualMaskMultiBandBlender::setNumBands(int num_bands) {
     actual_num_bands_ = num_bands;
 }
 
+int DualMaskMultiBandBlender::bandWeightType(int level) const {
+    // Fixed-point weights: deeper levels gather the weights of many more tiles
+    // per pixel but are small, so they accumulate in 32 bits
+    return weight_type_ == CV_16S && level >= kWideWeightLevel ? CV_32S : weight_type_;
+}
+
+int DualMaskMultiBandBlender::bandsForSize(int num_bands, cv::Size size) {
+    // Crop unnecessary bands
+    double max_len = static_cast<double>(std::max(size.width, size.height));
+    return std::min(num_bands, static_cast<int>(std::ceil(std::log(max_len) / std::log(2.0))));
+}
+
+int DualMaskMultiBandBlender::supportForBands(int bands) {
+    return 8 << bands;
+}
+
+int DualMaskMultiBandBlender::directCopyMargin(int bands) {
+    return 4 << std::min(bands, kDirectCopyLevel);
+}
+
 void DualMaskMultiBandBlender::prepare(cv::Rect dst_roi) {
+    prepare(dst_roi, dst_roi);
+}
+
+std::vector<DualMaskMultiBandBlender::LevelPlan> DualMaskMultiBandBlender::planLevels(cv::Rect dst_roi,
+                                                                                     cv::Rect canvas_roi) const {
+    const int num_bands = bandsForSize(actual_num_bands_, canvas_roi.size());
+    const int align = 1 << num_bands;
+
+    // Padded sizes allocated by prepare()
+    std::vector<LevelPlan> plan(num_bands + 1);
+    cv::Size level_size(dst_roi.width + (align - dst_roi.width % align) % align,
+                        dst_roi.height + (align - dst_roi.height % align) % align);
+    for (int i = 0; i <= num_bands; ++i) {
+        const size_t pixels = static_cast<size_t>(level_size.width) * level_size.height;
+        plan[i].size = level_size;
+        plan[i].laplace_bytes = pixels * CV_ELEM_SIZE(CV_16SC3);
+        plan[i].weight_bytes = pixels * CV_ELEM_SIZE(bandWeightType(i));
+        plan[i].direct_bytes = direct_copy_ && i == 0 ? pixels * (CV_ELEM_SIZE(CV_16SC3) + 1) : 0;
+        plan[i].storage = !scratch_directory_.empty() && plan[i].laplace_bytes + plan[i].weight_bytes >= scratch_min_bytes_
+                        ? LevelStorage::Scratch : LevelStorage::Host;
+        level_size = cv::Size((level_size.width + 1) / 2, (level_size.height + 1) / 2);
+    }
+
+    // Device memory goes to the coarse levels first: they are small and
+    // cheap, while level 0 alone may exceed the device
+    size_t device_bytes = 0;
+    for (int i = num_bands; i >= 0; --i) {
+        LevelPlan &level = plan[i];
+        const size_t bytes = level.laplace_bytes + level.weight_bytes;
+        if (level.storage != LevelStorage::Host || device_bytes + bytes > device_budget_ ||
+            std::max(level.laplace_bytes, level.weight_bytes) > device_max_alloc_)
+            break;
+        level.storage = LevelStorage::Device;
+        device_bytes += bytes;
+    }
+    return plan;
+}
+
+void DualMaskMultiBandBlender::prepare(cv::Rect dst_roi, cv::Rect canvas_roi) {
+    const std::vector<LevelPlan> plan = planLevels(dst_roi, canvas_roi);
     dst_roi_final_ = dst_roi;
 
-    // Crop unnecessary bands
-    double max_len = static_cast<double>(std::max(dst_roi.width, dst_roi.height));
-    num_bands_ = std::min(actual_num_bands_, static_cast<int>(std::ceil(std::log(max_len) / std::log(2.0))));
+    num_bands_ = bandsForSize(actual_num_bands_, canvas_roi.size());
+    CV_Assert((dst_roi.x - canvas_roi.x) % (1 << num_bands_) == 0 && (dst_roi.y - canvas_roi.y) % (1 << num_bands_) == 0);
 
     // Add border to the final image, to ensure sizes are divided by (1 << num_bands_)
     dst_roi.width += ((1 << num_bands_) - dst_roi.width % (1 << num_bands_)) % (1 << num_bands_);
     dst_roi.height += ((1 << num_bands_) - dst_roi.height % (1 << num_bands_)) % (1 << num_bands_);
 
+    // Release the previous result and its scratch files
+    dst_.release();
+    dst_mask_.release();
+    dst_pyr_laplace_.clear();
+    dst_band_weights_.clear();
+    scratch_.clear();
+
     // Prepare base destination
     dst_roi_ = dst_roi;
-    dst_.create(dst_roi.size(), CV_16SC3);
-    dst_.setTo(cv::Scalar::all(0));
     dst_mask_.create(dst_roi.size(), CV_8U);
     dst_mask_.setTo(cv::Scalar::all(0));
 
     // Prepare pyramids
-    dst_pyr_laplace_.clear();
-    dst_band_weights_.clear();
-
     dst_pyr_laplace_.resize(num_bands_ + 1);
-    dst_pyr_laplace_[0] = dst_;
-
     dst_band_weights_.resize(num_bands_ + 1);
-    dst_band_weights_[0].create(dst_roi.size(), weight_type_);
-    dst_band_weights_[0].setTo(0);
 
-    for (int i = 1; i <= num_bands_; ++i) {
-        dst_pyr_laplace_[i].create((dst_pyr_laplace_[i - 1].rows + 1) / 2,
-            (dst_pyr_laplace_[i - 1].cols + 1) / 2, CV_16SC3);
-        dst_band_weights_[i].create((dst_band_weights_[i - 1].rows + 1) / 2,
-            (dst_band_weights_[i - 1].cols + 1) / 2, weight_type_);
-        dst_pyr_laplace_[i].setTo(cv::Scalar::all(0));
-        dst_band_weights_[i].setTo(0);
+    lock_cols_ = (dst_roi.width + kLockBlockSize - 1) / kLockBlockSize;
+    const int lock_rows = (dst_roi.height + kLockBlockSize - 1) / kLockBlockSize;
+    block_locks_.reset(new std::mutex[lock_cols_ * lock_rows]);
+
+    {
+        std::lock_guard<std::mutex> lock(timings_mutex_);
+        timings_ = Timings();
+        timings_.build.assign(num_bands_ + 1, 0.0);
+        timings_.accumulate.assign(num_bands_ + 1, 0.0);
+        timings_.normalize.assign(num_bands_ + 1, 0.0);
+        timings_.restore.assign(num_bands_ + 1, 0.0);
+    }
+
+    level_storage_.resize(num_bands_ + 1);
+    occupied_.resize(num_bands_ + 1);
+    for (int i = 0; i <= num_bands_; ++i) {
+        level_storage_[i] = plan[i].storage;
+        occupied_[i] = cv::Mat::zeros((plan[i].size.height + kOccupancyBlockSize - 1) / kOccupancyBlockSize,
+                                      (plan[i].size.width + kOccupancyBlockSize - 1) / kOccupancyBlockSize, CV_8U);
+        createLevel(plan[i].size, CV_16SC3, plan[i].storage, dst_pyr_laplace_[i]);
+        createLevel(plan[i].size, bandWeightType(i), plan[i].storage, dst_band_weights_[i]);
+    }
+    dst_ = dst_pyr_laplace_[0];
+
+    dst_direct_.release();
+    dst_direct_mask_.release();
+    if (direct_copy_) {
+        dst_direct_.create(plan[0].size, CV_16SC3);
+        dst_direct_mask_ = cv::Mat::zeros(plan[0].size, CV_8U);
     }
 }
 
-void DualMaskMultiBandBlender::feed(cv::InputArray _img, cv::InputArray _weight_mask, 
-                                     cv::InputArray _blend_mask, cv::Point tl) {
-    cv::UMat img = _img.getUMat();
+DualMaskMultiBandBlender::Timings DualMaskMultiBandBlender::timings() const {
+    std::lock_guard<std::mutex> lock(timings_mutex_);
+    return timings_;
+}
 
-    CV_Assert(img.type() == CV_16SC3 || img.type() == CV_8UC3);
-    CV_Assert(_weight_mask.type() == CV_8U);
-    CV_Assert(_blend_mask.type() == CV_8U);
-
-    // Keep source image in memory with small border
-    int gap = 3 * (1 << num_bands_);
-    cv::Point tl_new(std::max(dst_roi_.x, tl.x - gap),
-                     std::max(dst_roi_.y, tl.y - gap));
-    cv::Point br_new(std::min(dst_roi_.br().x, tl.x + img.cols + gap),
-                     std::min(dst_roi_.br().y, tl.y + img.rows + gap));
-
-    // Ensure coordinates of top-left, bottom-right corners are divided by (1 << num_bands_)
-    tl_new.x = dst_roi_.x + (((tl_new.x - dst_roi_.x) >> num_bands_) << num_bands_);
-    tl_new.y = dst_roi_.y + (((tl_new.y - dst_roi_.y) >> num_bands_) << num_bands_);
-    int width = br_new.x - tl_new.x;
-    int height = br_new.y - tl_new.y;
-    width += ((1 << num_bands_) - width % (1 << num_bands_)) % (1 << num_bands_);
-    height += ((1 << num_bands_) - height % (1 << num_bands_)) % (1 << num_bands_);
-    br_new.x = tl_new.x + width;
-    br_new.y = tl_new.y + height;
-    int dy = std::max(br_new.y - dst_roi_.br().y, 0);
-    int dx = std::max(br_new.x - dst_roi_.br().x, 0);
-    tl_new.x -= dx; br_new.x -= dx;
-    tl_new.y -= dy; br_new.y -= dy;
-
-    int top = tl.y - tl_new.y;
-    int left = tl.x - tl_new.x;
-    int bottom = br_new.y - tl.y - img.rows;
-    int right = br_new.x - tl.x - img.cols;
+void DualMaskMultiBandBlender::Timings::add(const Timings &other) {
+    const auto addLevels = [](std::vector<double> &dst, const std::vector<double> &src) {
+        if (dst.size() < src.size())
+            dst.resize(src.size(), 0.0);
+        for (size_t i = 0; i < src.size(); ++i)
+            dst[i] += src[i];
+    };
+    addLevels(build, other.build);
+    addLevels(accumulate, other.accumulate);
+    addLevels(normalize, other.normalize);
+    addLevels(restore, other.restore);
+    lock_wait += other.lock_wait;
+    feeds += other.feeds;
+}
 
-    // Create the source image Laplacian pyramid
-    cv::UMat img_with_border;
-    cv::copyMakeBorder(_img, img_with_border, top, bottom, left, right, cv::BORDER_REFLECT);
+void DualMaskMultiBandBlender::setScratch(const std::string &directory, size_t min_level_bytes) {
+    scratch_directory_ = directory;
+    scratch_min_bytes_ = min_level_bytes;
+}
 
-    std::vector<cv::UMat> src_pyr_laplace;
-    createLaplacePyr(img_with_border, num_bands_, src_pyr_laplace);
+void DualMaskMultiBandBlender::setDeviceMemory(size_t budget_bytes, size_t max_alloc_bytes) {
+    device_budget_ = budget_bytes;
+    device_max_alloc_ = max_alloc_bytes;
+}
 
-    // Create the weight map Gaussian pyramid (from weight_mask)
-    cv::UMat weight_map;
-    std::vector<cv::UMat> weight_pyr_gauss(num_bands_ + 1);
+void DualMaskMultiBandBlender::createLevel(cv::Size size, int type, LevelStorage storage, cv::UMat &level) {
+    if (storage != LevelStorage::Device) {
+        // Mappings start zeroed, and pages are only committed once written
+        scratch_.emplace_back(new ScratchMat(storage == LevelStorage::Scratch ? scratch_directory_ : std::string(),
+                                             size, type));
+        level = scratch_.back()->mat().getUMat(cv::ACCESS_RW);
+        return;
+    }
+    level.create(size, type, cv::USAGE_ALLOCATE_DEVICE_MEMORY);
+    level.setTo(cv::Scalar::all(0));
+}
 
-    if (weight_type_ == CV_32F) {
-        _weight_mask.getUMat().convertTo(weight_map, CV_32F, 1./255.);
-    } else {
-        _weight_mask.getUMat().convertTo(weight_map, CV_16S);
-        cv::UMat add_mask;
-        cv::compare(_weight_mask, 0, add_mask, cv::CMP_NE);
-        cv::add(weight_map, cv::Scalar::all(1), weight_map, add_mask);
+const char *DualMaskMultiBandBlender::storageName(LevelStorage storage) {
+    switch (storage) {
+    case LevelStorage::Device: return "device";
+    case LevelStorage::Scratch: return "scratch";
+    case LevelStorage::Host: break;
     }
+    return "host";
+}
+
+void DualMaskMultiBandBlender::feed(cv::InputArray _img, cv::InputArray _weight_mask, 
+                                     cv::InputArray _blend_mask, cv::Point tl, const cv::Scalar *fill,
+                                     cv::InputArray _owned) {
+    SourcePyramids src;
+    buildSourcePyramids(_img, _weight_mask, _blend_mask, tl, &src, fill, _owned);
+    accumulate(src);
+    recycle(&src);
+}
 
-    cv::copyMakeBorder(weight_map, weight_pyr_gauss[0], top, bottom, left, right, cv::BORDER_CONSTANT);
+void DualMaskMultiBandBlender::recycle(SourcePyramids *src) const {
+    pool_->give(src->laplace);
+    pool_->give(src->masks);
+    src->windows.clear();
+    src->skip.clear();
+    src->direct.release();
+    src->direct_mask.release();
+}
+
+void DualMaskMultiBandBlender::setPool(std::shared_ptr<PyramidPool> pool) {
+    CV_Assert(pool);
+    pool_ = std::move(pool);
+}
 
-    for (int i = 0; i < num_bands_; ++i)
-        cv::pyrDown(weight_pyr_gauss[i], weight_pyr_gauss[i + 1]);
+void DualMaskMultiBandBlender::buildSourcePyramids(cv::InputArray _img, cv::InputArray _weight_mask,
+                                                   cv::InputArray _blend_mask, cv::Point tl,
+                                                   SourcePyramids *src, const cv::Scalar *fill,
+                                                   cv::InputArray _owned) const {
+    cv::Mat img = _img.getMat();
+    cv::Mat weight_mask = _weight_mask.getMat();
+    cv::Mat blend_mask = _blend_mask.getMat();
 
-    // Create the blend map Gaussian pyramid (from blend_mask)
-    cv::UMat blend_map;
-    std::vector<cv::UMat> blend_pyr_gauss(num_bands_ + 1);
+    CV_Assert(img.type() == CV_16SC3 || img.type() == CV_8UC3);
+    CV_Assert(weight_mask.type() == CV_8U);
+    CV_Assert(blend_mask.type() == CV_8U);
+
+    src->windows.clear();
+    src->skip.clear();
+    src->direct.release();
+    src->direct_mask.release();
+    src->footprint = cv::Rect();
+
+    // Only pixels where one of the masks is non-zero contribute: pyramids are
+    // built around their bounding box, clipped to the destination
+    const cv::Rect tile(tl - dst_roi_.tl(), img.size());
+    const cv::Rect footprint = ((cv::boundingRect(weight_mask) | cv::boundingRect(blend_mask)) + tile.tl())
+                               & cv::Rect(cv::Point(), dst_roi_.size());
+    if (footprint.empty())
+        return;
 
-    if (weight_type_ == CV_32F) {
-        _blend_mask.getUMat().convertTo(blend_map, CV_32F, 1./255.);
+    // Keep source image in memory with small border: 3 * 2^bands, enough for
+    // the mask spread at every level, unless it exceeds the tile, halving per
+    // level down to a few pixels (the reach of the blend is supportForBands())
+    std::vector<cv::Size> level_sizes(num_bands_ + 1);
+    for (int i = 0; i <= num_bands_; ++i)
+        level_sizes[i] = dst_band_weights_[i].size();
+    const int gap = std::min(3 * (1 << num_bands_), std::max(img.cols, img.rows));
+    src->windows = footprintWindows(footprint, gap, level_sizes);
+
+    // Level 0 over its window: tile pixels where available, reflected beyond the tile edges
+    const cv::Rect window0 = src->windows[0];
+    const cv::Rect inside = window0 & tile;
+    const int top = inside.y - window0.y;
+    const int left = inside.x - window0.x;
+    const int bottom = window0.br().y - inside.br().y;
+    const int right = window0.br().x - inside.br().x;
+    const cv::Rect local = inside - tile.tl();
+
+    // Matrices come from the pool and go back to it as soon as they are
+    // consumed; the pyramids themselves are returned by recycle()
+    PyramidPool &pool = *pool_;
+    std::vector<double> build_ms(num_bands_ + 1, 0.0);
+
+    // Create the source image Laplacian pyramid
+    int64 start = cv::getTickCount();
+    cv::UMat img_with_border = pool.take(window0.size(), img.type());
+    cv::copyMakeBorder(img(local), img_with_border, top, bottom, left, right, cv::BORDER_REFLECT);
+    if (fill) {
+        // Fill masked pixels in the bordered copy only, with the mask reflected like
+        // the image: same result as filling the tile first, without touching it
+        cv::Scalar value;
+        for (int c = 0; c < 3; ++c)
+            value[c] = img.depth() == CV_8U ? cv::saturate_cast<uchar>((*fill)[c]) : cv::saturate_cast<short>((*fill)[c]);
+        cv::UMat masked = pool.take(local.size(), CV_8U);
+        cv::compare(blend_mask(local), 0, masked, cv::CMP_EQ);
+        cv::UMat masked_with_border = pool.take(window0.size(), CV_8U);
+        cv::copyMakeBorder(masked, masked_with_border, top, bottom, left, right, cv::BORDER_REFLECT);
+        img_with_border.setTo(value, masked_with_border);
+
+        // The filled image is constant away from the kept pixels (and their
+        // reflections in the border): far from the Voronoi band of the tile
+        // every level is the fill colour, so the image pyramid is only built
+        // around the band. Coarse levels get the same values as a pyramid of
+        // the whole window, at the cost of the band.
+        cv::bitwise_not(masked_with_border, masked_with_border);
+        cv::Rect band = cv::boundingRect(masked_with_border);
+        pool.give(masked);
+        pool.give(masked_with_border);
+        if (band.empty())
+            band = cv::Rect(0, 0, 1, 1);
+        std::vector<cv::Rect> bands = footprintWindows(band + window0.tl(), 0, level_sizes);
+        for (int i = 0; i <= num_bands_; ++i)
+            bands[i] &= src->windows[i];
+        cv::UMat band0 = pool.take(bands[0].size(), img.type());
+        img_with_border(bands[0] - window0.tl()).copyTo(band0);
+        pool.give(img_with_border);
+        build_ms[0] += msSince(start);
+        createBandLaplacePyr(band0, bands, src->windows, value, pool, src->laplace, build_ms);
     } else {
-        _blend_mask.getUMat().convertTo(blend_map, CV_16S);
-        cv::UMat add_mask;
-        cv::compare(_blend_mask, 0, add_mask, cv::CMP_NE);
-        cv::add(blend_map, cv::Scalar::all(1), blend_map, add_mask);
+        build_ms[0] += msSince(start);
+        createLaplacePyr(img_with_border, src->windows, pool, src->laplace, build_ms);
     }
 
-    cv::copyMakeBorder(blend_map, blend_pyr_gauss[0], top, bottom, left, right, cv::BORDER_CONSTANT);
+    // Create the combined mask Gaussian pyramid: weight_mask and blend_mask
+    // interleaved in one 2-channel image, converted by a single table lookup
+    start = cv::getTickCount();
+    cv::UMat masks_8u = pool.take(local.size(), CV_8UC2);
+    cv::merge(std::vector<cv::Mat>{weight_mask(local), blend_mask(local)}, masks_8u);
+    cv::UMat mask_map = pool.take(local.size(), CV_MAKETYPE(weight_type_, 2));
+    cv::LUT(masks_8u, maskLut(weight_type_), mask_map);
+    pool.give(masks_8u);
+    cv::UMat mask_level0 = pool.take(window0.size(), mask_map.type());
+    cv::copyMakeBorder(mask_map, mask_level0, top, bottom, left, right, cv::BORDER_CONSTANT);
+    pool.give(mask_map);
+    build_ms[0] += msSince(start);
+    createMaskPyr(mask_level0, src->windows, pool, src->masks, build_ms);
+
+    // Owned pixels keep their source detail: a destination pixel of the levels
+    // below directLevel() only matters through the pixels it reaches in the
+    // collapse (level i + 1 pixel q reaches level i pixels 2q - 2 .. 2q + 2),
+    // and where they are all owned, accumulating it is skipped. The copy is the
+    // collapse of the source's own levels below directLevel(); blend() adds the
+    // blended coarser levels to it.
+    const int direct_level = directLevel();
+    if (direct_copy_ && direct_level > 0 && !_owned.empty()) {
+        const cv::Mat owned = _owned.getMat();
+        CV_Assert(owned.type() == CV_8U && owned.size() == img.size());
+        const cv::Mat owned_local = owned(local);
+        const cv::Rect box = cv::boundingRect(owned_local);
+        if (!box.empty()) {
+            start = cv::getTickCount();
+            src->direct_rect = box + inside.tl();
+            src->direct_mask = owned_local(box).clone();
+            {
+                std::vector<cv::Mat> detail(direct_level);
+                for (int i = 0; i < direct_level; ++i)
+                    detail[i] = src->laplace[i].getMat(cv::ACCESS_READ);
+                src->direct = collapseRect([&](int i) { return detail[i]; }, src->windows, direct_level - 1, src->direct_rect);
+            }
+
+            src->skip.resize(1);
+            src->skip[0] = cv::Mat::zeros(window0.size(), CV_8U);
+            owned_local.copyTo(src->skip[0](cv::Rect(left, top, local.width, local.height)));
+            const cv::Mat reach = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(5, 5));
+            for (int i = 0; i + 1 < direct_level; ++i) {
+                cv::Mat eroded;
+                cv::erode(src->skip[i], eroded, reach, cv::Point(-1, -1), 1, cv::BORDER_CONSTANT, cv::Scalar::all(0));
+                const cv::Rect &cur = src->windows[i];
+                const cv::Rect &next = src->windows[i + 1];
+                cv::Mat skip = cv::Mat::zeros(next.size(), CV_8U);
+                for (int y = 0; y < next.height; ++y) {
+                    const int fy = 2 * (next.y + y) - cur.y;
+                    if (fy < 0 || fy >= cur.height)
+                        continue;
+                    const uchar *fine = eroded.ptr<uchar>(fy);
+                    uchar *row = skip.ptr<uchar>(y);
+                    for (int x = 0; x < next.width; ++x) {
+                        const int fx = 2 * (next.x + x) - cur.x;
+                        if (fx >= 0 && fx < cur.width)
+                            row[x] = fine[fx];
+                    }
+                }
+                if (cv::countNonZero(skip) == 0)
+                    break;
+                src->skip.push_back(skip);
+            }
+            build_ms[0] += msSince(start);
+        }
+    }
 
-    for (int i = 0; i < num_bands_; ++i)
-        cv::pyrDown(blend_pyr_gauss[i], blend_pyr_gauss[i + 1]);
+    {
+        std::lock_guard<std::mutex> lock(timings_mutex_);
+        for (int i = 0; i <= num_bands_; ++i)
+            timings_.build[i] += build_ms[i];
+    }
 
-    int y_tl = tl_new.y - dst_roi_.y;
-    int y_br = br_new.y - dst_roi_.y;
-    int x_tl = tl_new.x - dst_roi_.x;
-    int x_br = br_new.x - dst_roi_.x;
+    // Level-0 rectangle covering the windows of every level, for locking
+    for (int i = 0; i <= num_bands_; ++i) {
+        const cv::Rect &w = src->windows[i];
+        src->footprint |= cv::Rect(w.x << i, w.y << i, w.width << i, w.height << i);
+    }
+    src->footprint &= cv::Rect(cv::Point(), dst_roi_.size());
+}
+
+void DualMaskMultiBandBlender::accumulate(const SourcePyramids &src) {
+    if (src.windows.empty())
+        return;
+
+    // Lock every block the source covers, always in the same (row-major) order.
+    // The footprint covers the windows of all levels scaled to level 0, so
+    // sources in disjoint blocks are disjoint at every level.
+    const int64 lock_start = cv::getTickCount();
+    std::vector<std::unique_lock<std::mutex>> locks;
+    const int bx0 = src.footprint.x / kLockBlockSize, bx1 = (src.footprint.br().x - 1) / kLockBlockSize;
+    const int by0 = src.footprint.y / kLockBlockSize, by1 = (src.footprint.br().y - 1) / kLockBlockSize;
+    for (int by = by0; by <= by1; ++by)
+        for (int bx = bx0; bx <= bx1; ++bx)
+            locks.emplace_back(block_locks_[by * lock_cols_ + bx]);
+    const double lock_wait = msSince(lock_start);
+    std::vector<double> accumulate_ms(num_bands_ + 1, 0.0);
+
+    const std::vector<cv::UMat> &src_pyr_laplace = src.laplace;
+    const std::vector<cv::UMat> &mask_pyr_gauss = src.masks;
 
     // Add weighted layer of the source image to the final Laplacian pyramid layer
     // Key difference: use blend_mask for pixel blending, weight_mask for accumulation
     for (int i = 0; i <= num_bands_; ++i) {
-        cv::Rect rc(x_tl, y_tl, x_br - x_tl, y_br - y_tl);
-        
+        const cv::Rect &rc = src.windows[i];
+        const int64 start = cv::getTickCount();
+
+        // Device levels accumulate on the device, without mapping any level to the host
+        if (level_storage_[i] == LevelStorage::Device) {
+            cv::UMat dst_level = dst_pyr_laplace_[i](rc);
+            cv::UMat dst_weights = dst_band_weights_[i](rc);
+            if (blendkernels::accumulateOcl(src_pyr_laplace[i], mask_pyr_gauss[i], dst_level, dst_weights)) {
+                accumulate_ms[i] += msSince(start);
+                continue;
+            }
+        }
+
         cv::Mat _src_pyr_laplace = src_pyr_laplace[i].getMat(cv::ACCESS_READ);
         cv::Mat _dst_pyr_laplace = dst_pyr_laplace_[i](rc).getMat(cv::ACCESS_RW);
-        cv::Mat _weight_pyr_gauss = weight_pyr_gauss[i].getMat(cv::ACCESS_READ);
-        cv::Mat _blend_pyr_gauss = blend_pyr_gauss[i].getMat(cv::ACCESS_READ);
+        cv::Mat _mask_pyr_gauss = mask_pyr_gauss[i].getMat(cv::ACCESS_READ);
         cv::Mat _dst_band_weights = dst_band_weights_[i](rc).getMat(cv::ACCESS_RW);
-        
-        if (weight_type_ == CV_32F) {
+        const cv::Mat *skip = i < static_cast<int>(src.skip.size()) ? &src.skip[i] : nullptr;
+
+        // Blend pixels using blend_mask, accumulate weights using weight_mask,
+        // over the runs of pixels not skipped
+        const auto accumulateRows = [&](auto mask_type, auto weight_type) {
+            using Mask = decltype(mask_type);
+            using Weight = decltype(weight_type);
             for (int y = 0; y < rc.height; ++y) {
-                const cv::Point3_<short>* src_row = _src_pyr_laplace.ptr<cv::Point3_<short>>(y);
-                cv::Point3_<short>* dst_row = _dst_pyr_laplace.ptr<cv::Point3_<short>>(y);
-                const float* weight_row = _weight_pyr_gauss.ptr<float>(y);
-                const float* blend_row = _blend_pyr_gauss.ptr<float>(y);
-                float* dst_weight_row = _dst_band_weights.ptr<float>(y);
-
-                for (int x = 0; x < rc.width; ++x) {
-                    // Blend pixels using blend_mask
-                    dst_row[x].x += static_cast<short>(src_row[x].x * blend_row[x]);
-                    dst_row[x].y += static_cast<short>(src_row[x].y * blend_row[x]);
-                    dst_row[x].z += static_cast<short>(src_row[x].z * blend_row[x]);
-                    // Accumulate weights using weight_mask
-                    dst_weight_row[x] += weight_row[x];
-                }
+                const short *src_row = _src_pyr_laplace.ptr<short>(y);
+                const Mask *mask_row = _mask_pyr_gauss.ptr<Mask>(y);
+                short *dst_row = _dst_pyr_laplace.ptr<short>(y);
+                Weight *weight_row = _dst_band_weights.ptr<Weight>(y);
+                forEachKeptRun(skip ? skip->ptr<uchar>(y) : nullptr, rc.width, [&](int x0, int x1) {
+                    blendkernels::accumulateRow(src_row + 3 * x0, mask_row + 2 * x0, dst_row + 3 * x0,
+                                                weight_row + x0, x1 - x0);
+                });
             }
-        } else {
-            for (int y = 0; y < rc.height; ++y) {
-                const cv::Point3_<short>* src_row = _src_pyr_laplace.ptr<cv::Point3_<short>>(y);
-                cv::Point3_<short>* dst_row = _dst_pyr_laplace.ptr<cv::Point3_<short>>(y);
-                const short* weight_row = _weight_pyr_gauss.ptr<short>(y);
-                const short* blend_row = _blend_pyr_gauss.ptr<short>(y);
-                short* dst_weight_row = _dst_band_weights.ptr<short>(y);
-
-                for (int x = 0; x < rc.width; ++x) {
-                    // Blend pixels using blend_mask
-                    dst_row[x].x += short((src_row[x].x * blend_row[x]) >> 8);
-                    dst_row[x].y += short((src_row[x].y * blend_row[x]) >> 8);
-                    dst_row[x].z += short((src_row[x].z * blend_row[x]) >> 8);
-                    // Accumulate weights using weight_mask
-                    dst_weight_row[x] += weight_row[x];
-                }
+        };
+        if (weight_type_ == CV_32F)
+            accumulateRows(float(), float());
+        else if (_dst_band_weights.depth() == CV_32S)
+            accumulateRows(short(), int());
+        else
+            accumulateRows(short(), short());
+        accumulate_ms[i] += msSince(start);
+    }
+
+    if (!src.direct.empty()) {
+        const int64 start = cv::getTickCount();
+        src.direct.copyTo(dst_direct_(src.direct_rect), src.direct_mask);
+        dst_direct_mask_(src.direct_rect).setTo(255, src.direct_mask);
+        accumulate_ms[0] += msSince(start);
+    }
+
+    std::lock_guard<std::mutex> lock(timings_mutex_);
+    for (int i = 0; i <= num_bands_; ++i) {
+        const bool skipped = level_storage_[i] != LevelStorage::Device && i < static_cast<int>(src.skip.size());
+        markOccupied(i, src.windows[i], skipped ? &src.skip[i] : nullptr);
+        timings_.accumulate[i] += accumulate_ms[i];
+    }
+    timings_.lock_wait += lock_wait;
+    ++timings_.feeds;
+}
+
+void DualMaskMultiBandBlender::markOccupied(int level, const cv::Rect &rc, const cv::Mat *skip) {
+    cv::Mat &blocks = occupied_[level];
+    const int bx0 = rc.x / kOccupancyBlockSize, bx1 = (rc.br().x - 1) / kOccupancyBlockSize;
+    const int by0 = rc.y / kOccupancyBlockSize, by1 = (rc.br().y - 1) / kOccupancyBlockSize;
+    for (int by = by0; by <= by1; ++by) {
+        uchar *row = blocks.ptr<uchar>(by);
+        for (int bx = bx0; bx <= bx1; ++bx) {
+            if (row[bx])
+                continue;
+            // Blocks skipped over entirely are not written
+            if (skip) {
+                const cv::Rect block(bx * kOccupancyBlockSize, by * kOccupancyBlockSize, kOccupancyBlockSize, kOccupancyBlockSize);
+                const cv::Rect part = (block & rc) - rc.tl();
+                if (cv::countNonZero((*skip)(part)) == part.area())
+                    continue;
             }
+            row[bx] = 255;
         }
+    }
+}
+
+void DualMaskMultiBandBlender::normalizeLevel(int level) {
+    if (level_storage_[level] == LevelStorage::Device &&
+        blendkernels::normalizeOcl(dst_pyr_laplace_[level], dst_band_weights_[level], WEIGHT_EPS))
+        return;
+    // Blocks nothing reached have zero values and weights, and stay zero
+    forEachBlockRun(occupied_[level], kOccupancyBlockSize, dst_pyr_laplace_[level].size(), [&](const cv::Rect &run) {
+        normalizeUsingWeightMap(dst_band_weights_[level](run), dst_pyr_laplace_[level](run));
+    });
+}
 
-        x_tl /= 2; y_tl /= 2;
-        x_br /= 2; y_br /= 2;
+void DualMaskMultiBandBlender::restoreLevels() {
+    // Only level-0 pixels some source reached are output. Going up, each level
+    // is then needed over the coarse pixels the needed finer blocks expand from.
+    // Blocks skipped over entirely are not needed at level 0, but their copied
+    // pixels need directLevel() restored over the pixels they expand from.
+    const auto expand = [&](const cv::Mat &fine_blocks, int i) {
+        const cv::Size coarse_size = dst_pyr_laplace_[i].size();
+        cv::Mat blocks = cv::Mat::zeros(occupied_[i].size(), CV_8U);
+        forEachBlockRun(fine_blocks, kOccupancyBlockSize, dst_pyr_laplace_[i - 1].size(), [&](const cv::Rect &run) {
+            int c0, c1, d0, d1;
+            coarseRange(run.y, run.br().y, coarse_size.height, &c0, &c1);
+            coarseRange(run.x, run.br().x, coarse_size.width, &d0, &d1);
+            blocks(cv::Range(c0 / kOccupancyBlockSize, (c1 - 1) / kOccupancyBlockSize + 1),
+                   cv::Range(d0 / kOccupancyBlockSize, (d1 - 1) / kOccupancyBlockSize + 1)).setTo(255);
+        });
+        return blocks;
+    };
+    cv::Mat direct;
+    if (!dst_direct_mask_.empty()) {
+        direct = cv::Mat::zeros(occupied_[0].size(), CV_8U);
+        forEachBlockRun(occupied_[0] == 0, kOccupancyBlockSize, dst_direct_mask_.size(), [&](const cv::Rect &run) {
+            for (int x = run.x; x < run.br().x; x += kOccupancyBlockSize) {
+                const cv::Rect block = cv::Rect(x, run.y, kOccupancyBlockSize, run.height) & run;
+                if (cv::countNonZero(dst_direct_mask_(block)))
+                    direct.at<uchar>(block.y / kOccupancyBlockSize, block.x / kOccupancyBlockSize) = 255;
+            }
+        });
+    }
+    std::vector<cv::Mat> needed(num_bands_ + 1);
+    needed[0] = occupied_[0];
+    for (int i = 1; i <= num_bands_; ++i) {
+        needed[i] = expand(needed[i - 1], i);
+        if (!direct.empty() && i <= directLevel()) {
+            direct = expand(direct, i);
+            if (i == directLevel())
+                cv::bitwise_or(needed[i], direct, needed[i]);
+        }
+    }
+
+    // Upsample run by run: no temporary of the finer level's size, blocks
+    // nothing needs are never written, and mapped levels are swept in row order
+    cv::UMat up;
+    for (int i = num_bands_; i > 0; --i) {
+        const int64 start = cv::getTickCount();
+        const cv::UMat &coarse = dst_pyr_laplace_[i];
+        cv::UMat &fine = dst_pyr_laplace_[i - 1];
+        forEachBlockRun(needed[i - 1], kOccupancyBlockSize, fine.size(), [&](const cv::Rect &run) {
+            int c0, c1, d0, d1;
+            coarseRange(run.y, run.br().y, coarse.rows, &c0, &c1);
+            coarseRange(run.x, run.br().x, coarse.cols, &d0, &d1);
+            cv::pyrUp(coarse(cv::Range(c0, c1), cv::Range(d0, d1)), up, cv::Size(2 * (d1 - d0), 2 * (c1 - c0)));
+            cv::UMat pixels = fine(run);
+            cv::add(up(run - cv::Point(2 * d0, 2 * c0)), pixels, pixels);
+        });
+        timings_.restore[i - 1] += msSince(start);
     }
 }
 
 void DualMaskMultiBandBlender::blend(cv::OutputArray dst, cv::OutputArray dst_mask) {
     cv::Rect dst_rc(0, 0, dst_roi_final_.width, dst_roi_final_.height);
-    cv::UMat dst_band_weights_0;
 
-    for (int i = 0; i <= num_bands_; ++i)
-        normalizeUsingWeightMap(dst_band_weights_[i], dst_pyr_laplace_[i]);
+    std::lock_guard<std::mutex> lock(timings_mutex_);
+    for (int i = 0; i <= num_bands_; ++i) {
+        const int64 start = cv::getTickCount();
+        normalizeLevel(i);
+        timings_.normalize[i] += msSince(start);
+    }
 
-    restoreImageFromLaplacePyr(dst_pyr_laplace_);
+    restoreLevels();
 
     dst_ = dst_pyr_laplace_[0](dst_rc);
-    dst_band_weights_0 = dst_band_weights_[0];
+    cv::compare(dst_band_weights_[0](dst_rc), WEIGHT_EPS, dst_mask_, cv::CMP_GT);
+
+    // Owned pixels take their source detail plus the blended levels from
+    // directLevel() on, band by band to bound the temporaries
+    if (!dst_direct_.empty()) {
+        const int direct_level = directLevel();
+        const cv::Mat coarse = dst_pyr_laplace_[direct_level].getMat(cv::ACCESS_READ);
+        std::vector<cv::Rect> levels(direct_level + 1);
+        for (int i = 0; i <= direct_level; ++i)
+            levels[i] = cv::Rect(cv::Point(), dst_pyr_laplace_[i].size());
+        for (int y = 0; y < dst_rc.height; y += DIRECT_BAND_ROWS) {
+            const cv::Rect band(0, y, dst_rc.width, std::min(DIRECT_BAND_ROWS, dst_rc.height - y));
+            const cv::Mat mask = dst_direct_mask_(band);
+            if (cv::countNonZero(mask) == 0)
+                continue;
+            cv::Mat values = collapseRect([&](int i) { return i == direct_level ? coarse : cv::Mat(); }, levels, direct_level, band);
+            cv::add(values, dst_direct_(band), values);
+            cv::UMat dst_band = dst_(band);
+            values.copyTo(dst_band, mask);
+            cv::UMat mask_band = dst_mask_(band);
+            mask_band.setTo(cv::Scalar::all(255), mask);
+        }
+        dst_direct_.release();
+        dst_direct_mask_.release();
+    }
 
     dst_pyr_laplace_.clear();
     dst_band_weights_.clear();
 
-    cv::compare(dst_band_weights_0(dst_rc), WEIGHT_EPS, dst_mask_, cv::CMP_GT);
-
-    // Final blend
-    cv::UMat mask;
-    cv::compare(dst_mask_, 0, mask, cv::CMP_EQ);
-    dst_.setTo(cv::Scalar::all(0), mask);
+    // Final blend; outside the occupied blocks level 0 was never written and is zero
+    forEachBlockRun(occupied_[0], kOccupancyBlockSize, dst_rc.size(), [&](const cv::Rect &run) {
+        cv::UMat mask;
+        cv::compare(dst_mask_(run), 0, mask, cv::CMP_EQ);
+        cv::UMat pixels = dst_(run);
+        pixels.setTo(cv::Scalar::all(0), mask);
+    });
+    occupied_.clear();
     dst.assign(dst_);
     dst_mask.assign(dst_mask_);
     dst_.release();
@@ -1,7 +1,14 @@
 #ifndef DUALMASKBLENDER_H
 #define DUALMASKBLENDER_H
 
+#include "pyramidpool.h"
+#include "scratchmat.h"
+
 #include <opencv2/core.hpp>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
 /**
@@ -18,10 +25,68 @@
  */
 class DualMaskMultiBandBlender {
 public:
+    /**
+     * @brief Pyramids of one fed image, ready to be accumulated
+     */
+    struct SourcePyramids {
+        std::vector<cv::Rect> windows; // Per level, area covered in level destination coordinates (empty: nothing to add)
+        cv::Rect footprint;            // Level-0 rectangle covering the windows of every level
+        std::vector<cv::UMat> laplace; // Image Laplacian pyramid (CV_16SC3)
+        std::vector<cv::UMat> masks;   // Gaussian pyramid of the weight (channel 0) and blend (channel 1) masks
+        std::vector<cv::Mat> skip;     // Per level from 0, non-zero over windows where the level only reaches copied pixels
+        cv::Rect direct_rect;          // Level-0 destination rectangle of direct and direct_mask
+        cv::Mat direct;                // Collapse of the levels below the direct copy level (CV_16SC3)
+        cv::Mat direct_mask;           // Pixels of direct to copy (CV_8U)
+    };
+
+    /**
+     * @brief Where prepare() allocates a destination level
+     */
+    enum class LevelStorage {
+        Host,    // Anonymous host mapping, committed block by block as sources reach it
+        Device,  // UMat in OpenCL device memory
+        Scratch  // Memory-mapped scratch file (see setScratch())
+    };
+
+    /**
+     * @brief Footprint and placement of one destination level
+     */
+    struct LevelPlan {
+        cv::Size size;            // Padded level size
+        size_t laplace_bytes = 0; // Laplacian level (CV_16SC3)
+        size_t weight_bytes = 0;  // Accumulated weights
+        size_t direct_bytes = 0;  // Directly copied pixels and their mask (level 0, in host memory)
+        LevelStorage storage = LevelStorage::Host;
+    };
+
+    /**
+     * @brief Time spent in the blender, in milliseconds, summed over feeds and threads
+     *
+     * Per-level vectors have one entry per pyramid level. OpenCL levels are
+     * timed as they are enqueued, so most of their cost shows up wherever the
+     * host next waits for the device.
+     */
+    struct Timings {
+        std::vector<double> build;      // Source Laplacian and mask levels (level 0: bordered copy, fill and mask lookup)
+        std::vector<double> accumulate; // Adding source levels to the destination, lock waits excluded
+        std::vector<double> normalize;  // Dividing destination levels by their weights
+        std::vector<double> restore;    // Collapsing level i + 1 into level i (the coarsest level stays 0)
+        double lock_wait = 0;           // Waiting for destination block locks
+        int feeds = 0;                  // Sources accumulated
+
+        /**
+         * @brief Adds the timings of another blender, level by level
+         */
+        void add(const Timings &other);
+    };
+
     /**
      * @brief Constructor
      * @param num_bands Number of bands in the multi-band pyramid (default: 5)
      * @param weight_type Data type for weights: CV_32F or CV_16S (default: CV_32F)
+     *
+     * CV_16S weights are fixed point (256 = 1) and halve the mask and weight
+     * memory; levels from kWideWeightLevel down accumulate weights in CV_32S.
      */
     explicit DualMaskMultiBandBlender(int num_bands = 5, int weight_type = CV_32F);
 
@@ -31,14 +96,78 @@ public:
      */
     void prepare(cv::Rect dst_roi);
 
+    /**
+     * @brief Prepares the blender for a part of a larger canvas
+     * @param dst_roi Destination region of interest (part of canvas_roi)
+     * @param canvas_roi Full canvas; the band count is chosen for it, so that every
+     *        part of a canvas is blended with the same pyramid as the whole canvas.
+     *        The offset of dst_roi from canvas_roi must be a multiple of 2^bands.
+     *
+     * Host and scratch levels are mapped rather than filled, and levels are
+     * tracked in blocks of kOccupancyBlockSize level pixels: blocks no fed
+     * image reaches are never written, so canvas areas without tiles take no
+     * memory and are skipped by blend().
+     */
+    void prepare(cv::Rect dst_roi, cv::Rect canvas_roi);
+
     /**
      * @brief Feeds an image with two separate masks into the blender
      * @param img Input image (CV_16SC3 or CV_8UC3)
      * @param weight_mask Mask for computing weights (CV_8U, 0-255)
      * @param blend_mask Mask for blending pixels (CV_8U, 0-255)
      * @param tl Top-left corner of the image in canvas coordinates
+     * @param fill If set, colour of the pixels where blend_mask is zero (the image is not modified)
+     * @param owned With setDirectCopy(), pixels whose detail is copied to the output (CV_8U, img size)
+     *
+     * With fill, the image pyramid is built only around the non-zero
+     * blend_mask pixels, and image pixels where blend_mask is zero do not
+     * matter: they need not be decoded.
+     *
+     * Owned pixels are those where this image takes the whole blend, such as
+     * the interior of its Voronoi cell: the blend masks of the other images
+     * are zero around them, and img's masks are 255 within
+     * directCopyMargin() of them. Below the direct copy level (the lesser of
+     * the bands and kDirectCopyLevel) the blend would return img's own
+     * Laplacians there, so those levels are not accumulated where they only
+     * reach owned pixels; blend() adds the collapse of img's levels to the
+     * blended coarser ones instead. Where other images' weight masks overlap
+     * owned pixels (without blend mask), the copy keeps img's full detail
+     * while the blend would scale it by the summed weights.
+     */
+    void feed(cv::InputArray img, cv::InputArray weight_mask, cv::InputArray blend_mask, cv::Point tl,
+              const cv::Scalar *fill = nullptr, cv::InputArray owned = cv::noArray());
+
+    /**
+     * @brief First half of feed(): builds the pyramids of an image
+     *
+     * Does not touch the destination, so it can run for several images at once.
+     * Pyramids only cover the bounding box of the non-zero mask pixels plus the
+     * pyramid support. Parameters are the same as feed().
+     */
+    void buildSourcePyramids(cv::InputArray img, cv::InputArray weight_mask, cv::InputArray blend_mask,
+                             cv::Point tl, SourcePyramids *src, const cv::Scalar *fill = nullptr,
+                             cv::InputArray owned = cv::noArray()) const;
+
+    /**
+     * @brief Second half of feed(): adds the pyramids to the destination
+     *
+     * Thread-safe: locks the destination blocks covered by the source, so
+     * sources over disjoint regions accumulate concurrently.
      */
-    void feed(cv::InputArray img, cv::InputArray weight_mask, cv::InputArray blend_mask, cv::Point tl);
+    void accumulate(const SourcePyramids &src);
+
+    /**
+     * @brief Hands the matrices of accumulated pyramids back to the pool
+     */
+    void recycle(SourcePyramids *src) const;
+
+    /**
+     * @brief Shares a buffer pool with other blenders
+     *
+     * Each blender has its own pool by default; blenders created one after
+     * another (such as strips) can share one so buffers outlive each blender.
+     */
+    void setPool(std::shared_ptr<PyramidPool> pool);
 
     /**
      * @brief Blends all fed images and produces the final result
@@ -59,11 +188,102 @@ public:
      */
     int numBands() const { return actual_num_bands_; }
 
+    /**
+     * @brief Number of bands actually used for a canvas of the given size
+     * @param num_bands Requested number of bands
+     * @param size Canvas size
+     * @return num_bands, cropped so that the coarsest level is at least one pixel
+     */
+    static int bandsForSize(int num_bands, cv::Size size);
+
+    /**
+     * @brief Reach of the blend: pixels around a destination pixel whose sources can change it
+     * @param bands Number of bands actually used (see bandsForSize())
+     * @return 8 * 2^bands
+     *
+     * A level-i Laplacian pixel depends on the image about 6 * 2^i pixels
+     * away, including the reflection at window edges, and the collapse back
+     * to level 0 spreads it by up to 2 * 2^i more. A window blended over a
+     * region grown by this support, on the canvas pyramid grid and with every
+     * source within the support fed, is meant to reproduce the region of a
+     * whole-canvas blend. bench/pipeline_bench --check-partition compares the
+     * two; no passing run is recorded yet.
+     */
+    static int supportForBands(int bands);
+
+    /**
+     * @brief Distance owned pixels keep from the edges of their image's masks (see feed())
+     * @param bands Number of bands actually used (see bandsForSize())
+     * @return 4 * 2^min(bands, kDirectCopyLevel)
+     *
+     * The levels skipped around an owned pixel reach about 2 * 2^level
+     * pixels, through the mask Gaussians and the collapse.
+     */
+    static int directCopyMargin(int bands);
+
+    /**
+     * @brief Backs large destination levels with memory-mapped scratch files
+     * @param directory Directory for the scratch files (empty: keep every level in memory)
+     * @param min_level_bytes Levels of at least this size are mapped; coarser levels stay in memory
+     *
+     * Applies from the next prepare(). The image returned by blend() may then
+     * live in a scratch file, kept until the next prepare() or destruction.
+     */
+    void setScratch(const std::string &directory, size_t min_level_bytes);
+
+    /**
+     * @brief Allows destination levels in OpenCL device memory
+     * @param budget_bytes Device memory available to the destination pyramid (0: host only)
+     * @param max_alloc_bytes Largest single device allocation
+     *
+     * Applies from the next prepare(). Levels are placed on the device from
+     * the coarsest one up while they fit in the budget.
+     */
+    void setDeviceMemory(size_t budget_bytes, size_t max_alloc_bytes);
+
+    /**
+     * @brief Copies the fine levels of the owned pixels of feed() instead of blending them
+     *
+     * Adds a level-0 CV_16SC3 image and mask in host memory. Applies from the
+     * next prepare().
+     */
+    void setDirectCopy(bool enabled) { direct_copy_ = enabled; }
+
+    /**
+     * @brief Levels prepare() would allocate for the given regions, and their placement
+     */
+    std::vector<LevelPlan> planLevels(cv::Rect dst_roi, cv::Rect canvas_roi) const;
+
+    /**
+     * @brief Name of a storage in logs: "host", "device" or "scratch"
+     */
+    static const char *storageName(LevelStorage storage);
+
+    /**
+     * @brief Timings since the last prepare()
+     */
+    Timings timings() const;
+
 private:
+    int bandWeightType(int level) const;
+    void createLevel(cv::Size size, int type, LevelStorage storage, cv::UMat &level);
+    void markOccupied(int level, const cv::Rect &rc, const cv::Mat *skip);
+    void normalizeLevel(int level);
+    void restoreLevels();
+    int directLevel() const { return std::min(num_bands_, kDirectCopyLevel); }
+
     int actual_num_bands_;  // User-specified number of bands
     int num_bands_;         // Actual number of bands used (may be less due to image size)
     int weight_type_;       // CV_32F or CV_16S
     
+    std::string scratch_directory_;
+    size_t scratch_min_bytes_ = 0;
+    size_t device_budget_ = 0;
+    size_t device_max_alloc_ = 0;
+    bool direct_copy_ = false;
+    std::shared_ptr<PyramidPool> pool_;  // Source pyramid buffers, shared by the feed threads
+    std::vector<std::unique_ptr<ScratchMat>> scratch_; // Mapped levels; declared first so they outlive the headers below
+
     cv::Rect dst_roi_;      // Current ROI (padded to be divisible by 2^num_bands)
     cv::Rect dst_roi_final_;// Final ROI (user-requested)
     
@@ -72,6 +292,20 @@ private:
     
     std::vector<cv::UMat> dst_pyr_laplace_;    // Destination Laplacian pyramid
     std::vector<cv::UMat> dst_band_weights_;   // Accumulated weights for each band
+    std::vector<LevelStorage> level_storage_;  // Placement of each band, from the plan
+    std::vector<cv::Mat> occupied_;            // Per level, non-zero for the blocks some source accumulated into (CV_8U)
+    cv::Mat dst_direct_;       // Source detail of the owned pixels, with setDirectCopy() (CV_16SC3)
+    cv::Mat dst_direct_mask_;  // Where dst_direct_ replaces the levels below directLevel() (CV_8U)
+
+    static const int kLockBlockSize = 512;     // Level-0 size of a destination lock block
+    static const int kWideWeightLevel = 2;     // First level with CV_32S weights when weight_type_ is CV_16S
+    static const int kOccupancyBlockSize = 128; // Level-i size of an occupancy block
+    static constexpr int kDirectCopyLevel = 3; // First level blended over owned pixels (see feed())
+    int lock_cols_ = 0;
+    std::unique_ptr<std::mutex[]> block_locks_;
+
+    mutable std::mutex timings_mutex_;
+    mutable Timings timings_;  // Guarded by timings_mutex_; buildSourcePyramids() adds to it too
 };
 
 #endif // DUALMASKBLENDER_H
@@ -0,0 +1,78 @@
+#include "jobservice.h"
+
+#include <QFileInfo>
+
+#include <algorithm>
+
+#include <unistd.h>
+
+TileFolders::Folder &TileFolders::folder(const QString &path) {
+	const QString key = QFileInfo(path).absoluteFilePath();
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::shared_ptr<Folder> &entry = folders_[key];
+	if (!entry)
+		entry = std::make_shared<Folder>();
+	return *entry;
+}
+
+bool TileFolders::load(const QString &path, OrthoLoader *loader, QString *errorMessage) {
+	std::lock_guard<std::mutex> lock(folder(path).scan);
+	return loader->loadFromDirectory(path, errorMessage);
+}
+
+bool TileFolders::generateVoronoiMasks(const QString &path, double overlapMargin, OrthoLoader *loader, MaskLease *lease,
+                                       QString *errorMessage) {
+	std::shared_mutex &masks = folder(path).masks;
+	bool generated = false;
+	for (;;) {
+		MaskLease shared(masks);
+		if (loader->staleVoronoiMaskCount(overlapMargin) == 0) {
+			// Up to date, they are only read, alongside the other jobs
+			if (!generated && !loader->generateVoronoiMasks(overlapMargin, errorMessage))
+				return false;
+			*lease = std::move(shared);
+			return true;
+		}
+		shared.unlock();
+
+		// Another job may rewrite them again before the shared lock is back: check anew
+		std::unique_lock<std::shared_mutex> exclusive(masks);
+		if (!loader->generateVoronoiMasks(overlapMargin, errorMessage))
+			return false;
+		generated = true;
+	}
+}
+
+MemoryBudget::MemoryBudget(qint64 bytes) : total_(std::max<qint64>(0, bytes)) {}
+
+void MemoryBudget::acquire(qint64 bytes) {
+	std::unique_lock<std::mutex> lock(mutex_);
+	released_.wait(lock, [&] { return used_ == 0 || used_ + bytes <= total_; });
+	used_ += bytes;
+}
+
+void MemoryBudget::release(qint64 bytes) {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		used_ -= bytes;
+	}
+	released_.notify_all();
+}
+
+qint64 MemoryBudget::defaultBytes() {
+	const long pages = sysconf(_SC_PHYS_PAGES);
+	const long pageSize = sysconf(_SC_PAGESIZE);
+	if (pages <= 0 || pageSize <= 0)
+		return 0;
+	return static_cast<qint64>(pages) * pageSize / 2;
+}
+
+MemoryReservation::MemoryReservation(MemoryBudget *budget, qint64 bytes) : budget_(budget), bytes_(bytes) {
+	if (budget_)
+		budget_->acquire(bytes_);
+}
+
+MemoryReservation::~MemoryReservation() {
+	if (budget_)
+		budget_->release(bytes_);
+}
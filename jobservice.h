@@ -0,0 +1,89 @@
+#ifndef JOBSERVICE_H
+#define JOBSERVICE_H
+
+#include "ortholoader.h"
+#include "pyramidpool.h"
+
+#include <QHash>
+#include <QString>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+
+// Scans and Voronoi updates of the tile folders served. Nothing is cached in
+// memory: every job lists and stats its folder and rereads the metadata cache
+// and the Voronoi manifest, whose per-file stamps catch tiles, TFWs, PC_ masks
+// and MTDOrtho.xml rewritten in place. Jobs on different folders proceed in
+// parallel.
+class TileFolders {
+public:
+	using MaskLease = std::shared_lock<std::shared_mutex>;
+
+	// OrthoLoader::loadFromDirectory(), one job of the folder at a time, since
+	// a scan may rewrite the metadata cache
+	bool load(const QString &folder, OrthoLoader *loader, QString *errorMessage = nullptr);
+	// OrthoLoader::generateVoronoiMasks() on a loader from load(). On success
+	// lease holds the folder's masks shared: jobs read them until the lease is
+	// released, and a job that has to rewrite them (another overlap margin,
+	// changed inputs) waits for every lease on the folder to end.
+	bool generateVoronoiMasks(const QString &folder, double overlapMargin, OrthoLoader *loader, MaskLease *lease,
+	                          QString *errorMessage = nullptr);
+
+private:
+	struct Folder {
+		std::mutex scan;           // Held by load()
+		std::shared_mutex masks;   // Shared by the jobs reading the Voronoi masks, exclusive to rewrite them
+	};
+	Folder &folder(const QString &path);
+
+	std::mutex mutex_;  // Guards folders_ only
+	QHash<QString, std::shared_ptr<Folder>> folders_;  // By absolute path, kept for the service's lifetime
+};
+
+// Memory shared by concurrent jobs. A reservation waits until it fits in what
+// the running jobs left; one larger than the whole budget runs alone.
+class MemoryBudget {
+public:
+	explicit MemoryBudget(qint64 bytes);
+
+	void acquire(qint64 bytes);
+	void release(qint64 bytes);
+	qint64 total() const { return total_; }
+
+	// Half of the physical memory, or 0 when unknown
+	static qint64 defaultBytes();
+
+private:
+	const qint64 total_;
+	qint64 used_ = 0;
+	std::mutex mutex_;
+	std::condition_variable released_;
+};
+
+// Holds bytes of a budget for its lifetime; a null budget reserves nothing
+class MemoryReservation {
+public:
+	MemoryReservation(MemoryBudget *budget, qint64 bytes);
+	~MemoryReservation();
+
+	MemoryReservation(const MemoryReservation &) = delete;
+	MemoryReservation &operator=(const MemoryReservation &) = delete;
+
+private:
+	MemoryBudget *budget_;
+	qint64 bytes_;
+};
+
+// State shared by the jobs of a service run. OpenCV keeps its thread pool,
+// OpenCL context and compiled kernels for the life of the process.
+struct ServiceContext {
+	explicit ServiceContext(qint64 memoryBytes) : memory(memoryBytes) {}
+
+	TileFolders folders;
+	MemoryBudget memory;
+	std::shared_ptr<PyramidPool> pool = std::make_shared<PyramidPool>(); // Shared by every job's blender
+};
+
+#endif // JOBSERVICE_H
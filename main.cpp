@@ -1,5 +1,12 @@
 #include "ortholoader.h"
+#include "blockplan.h"
+#include "coveragemask.h"
 #include "dualmaskblender.h"
+#include "jobservice.h"
+#include "streamingblender.h"
+#include "runreport.h"
+#include "tileprefetcher.h"
+#include "tiffwriter.h"
 
 #include <opencv2/core.hpp>
 #include <opencv2/core/ocl.hpp>
@@ -7,42 +14,271 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/stitching/detail/blenders.hpp>
 
+#include <QDir>
+#include <QFile>
 #include <QFileInfo>
+#include <QMap>
+#include <QProcess>
+#include <QStringList>
 
+#include <algorithm>
 #include <iostream>
-#include <sys/resource.h>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 using namespace std;
 using namespace std::chrono;
 
-QImage bgrMatToQImage(const cv::Mat &bgr);
-cv::Mat qImageToBgrMat(const QImage &source);
-cv::Mat buildCoverageMask(const QImage &source, const QImage &loadedMask = QImage(), double featherRadius = 512.0, bool sharp = false);
+struct TileSettings {
+	double featherRadius;
+	bool useVoronoiMasks;
+	bool debugMode;
+	QString outputPath;
+	int directCopyMargin; // Distance owned pixels keep from the tile's mask edges with --direct-copy, 0 = off
+};
 
+// Decodes a tile and builds its weight and blend masks; safe to run for several tiles at once
+static void prepareTile(OrthoLoader *loader, OrthoLoader::Tile *tile, const TileSettings &settings, PreparedTile *prepared) {
+	auto start = high_resolution_clock::now();
+	const QFileInfo outputInfo(settings.outputPath);
+	const QString debugPrefix = outputInfo.absolutePath() + "/" + outputInfo.completeBaseName();
 
-int main(int argc, char *argv[]) {
-	if (argc < 3 || argc > 8) {
-		cerr << "Usage: " << argv[0] << " <input_folder> <output.png> [num_bands] [feather_radius] [overlap_margin]" << endl;
-		cerr << "  <input_folder>: Folder containing TIFF files" << endl;
-		cerr << "  <output.png>: Output PNG image path" << endl;
-		cerr << "  [num_bands]: Optional number of bands for MultiBandBlender (default: 14)" << endl;
-		cerr << "  [feather_radius]: Optional feathering radius in pixels (default: 512.0)" << endl;
-		cerr << "  [overlap_margin]: Optional Voronoi mask overlap margin in pixels (default: 20.0)" << endl;
-		cerr << "  [use_voronoi]: Optional use Voronoi masks for blending (true/false, default: true)" << endl;
-		cerr << "  [debug]: Optional debug mode to save masks next to output (debug/true/1, default: false)" << endl;
+	// Masks are read first: the blender fills the pixels outside the blend
+	// mask, so with a PC_ mask (no magenta detection) and a Voronoi mask only
+	// the image rows and tiles under the Voronoi mask have to be decoded
+	// PC_ masks on disk: black (0) = utile, white (255) = masqué
+	// Voronoi masks: white (255) = utile, black (0) = inutile
+	const bool hasPCMask = loader->loadPCMask(tile, nullptr);
+	if (hasPCMask)
+		prepared->bytesRead += QFileInfo(tile->maskPath).size();
+	cv::Mat voronoiMask;
+	if (settings.useVoronoiMasks && !tile->generatedMaskPath.isEmpty()) {
+		voronoiMask = cv::imread(QFile::encodeName(tile->generatedMaskPath).toStdString(),
+		                         cv::IMREAD_GRAYSCALE | cv::IMREAD_IGNORE_ORIENTATION);
+		if (!voronoiMask.empty())
+			prepared->bytesRead += QFileInfo(tile->generatedMaskPath).size();
+	}
+
+	// Load tile into memory
+	auto decodeStart = high_resolution_clock::now();
+	qint64 imageBytes = QFileInfo(tile->imagePath).size();
+	const bool loaded = hasPCMask && !voronoiMask.empty()
+	                        ? loader->loadTileRegion(tile, cv::boundingRect(voronoiMask), &imageBytes, &prepared->error)
+	                        : loader->loadTile(tile, &prepared->error);
+	if (!loaded) {
+		loader->unloadMask(tile);
+		return;
+	}
+	auto decoded = high_resolution_clock::now();
+	prepared->decodeMs = duration<double, milli>(decoded - decodeStart).count();
+	prepared->bytesRead += imageBytes;
+	cv::Mat bgr = tile->image;
+	if (bgr.empty()) {
+		loader->unloadMask(tile);
+		loader->unloadTile(tile);
+		prepared->error = QStringLiteral("empty BGR");
+		return;
+	}
+
+	// Build weight mask from PC_ mask (for weight calculation)
+	// buildCoverageMask will handle the inversion internally
+	cv::Mat weightMask = buildCoverageMask(bgr, tile->mask, settings.featherRadius, false);
+
+	// DEBUG: Save weight mask next to output file
+	if (settings.debugMode) {
+		QString weightMaskPath = debugPrefix + "_weight_" + tile->name.split('.').first() + ".png";
+		if (cv::imwrite(weightMaskPath.toStdString(), weightMask))
+			prepared->log << QStringLiteral("Saved weight mask: %1").arg(weightMaskPath);
+	}
+
+	// Build blend mask from Voronoi mask (for pixel blending)
+	cv::Mat blendMask;
+	if (!voronoiMask.empty()) {
+		// Use Voronoi mask for blending, no inversion needed
+		blendMask = buildCoverageMask(bgr, voronoiMask, settings.featherRadius, true);
+
+		// DEBUG: Save blend mask next to output file
+		if (settings.debugMode) {
+			QString blendMaskPath = debugPrefix + "_blend_" + tile->name.split('.').first() + ".png";
+			if (cv::imwrite(blendMaskPath.toStdString(), blendMask))
+				prepared->log << QStringLiteral("Saved blend mask: %1").arg(blendMaskPath);
+		}
+	}
+
+	// Fallback: if Voronoi disabled or no Voronoi mask, use weight mask for both
+	if (blendMask.empty()) {
+		blendMask = weightMask.clone();
+	}
+	prepared->maskMs = duration<double, milli>(high_resolution_clock::now() - start).count() - prepared->decodeMs;
+
+	// Unload mask and tile to free memory
+	loader->unloadMask(tile);
+	loader->unloadTile(tile);
+
+	if (weightMask.empty() || cv::countNonZero(weightMask) == 0) {
+		prepared->error = QStringLiteral("empty or zero weight mask");
+		return;
+	}
+	if (blendMask.empty() || cv::countNonZero(blendMask) == 0) {
+		prepared->error = QStringLiteral("empty or zero blend mask");
+		return;
+	}
+
+	// Pixels where blend mask is zero are filled with the average color inside
+	// it by the blender, while it builds the first pyramid level
+	prepared->fillColor = cv::mean(bgr, blendMask);
+	prepared->image = bgr;
+	prepared->weightMask = weightMask;
+	prepared->blendMask = blendMask;
+	prepared->tl = cv::Point(tile->x, tile->y);
+
+	// Inside its Voronoi cell the tile takes the whole blend: the other tiles'
+	// blend masks are zero there, so its fine levels are copied with the
+	// blended coarse levels added (see DualMaskMultiBandBlender::feed())
+	if (settings.directCopyMargin > 0 && !voronoiMask.empty()) {
+		const int margin = settings.directCopyMargin;
+		cv::Mat owned = (weightMask == 255) & (blendMask == 255);
+		// Zero outside the tile too: the distance is to the nearest pixel not owned
+		cv::Mat padded, distance;
+		cv::copyMakeBorder(owned, padded, 1, 1, 1, 1, cv::BORDER_CONSTANT, cv::Scalar::all(0));
+		cv::distanceTransform(padded, distance, cv::DIST_C, 3);
+		owned = distance(cv::Rect(1, 1, bgr.cols, bgr.rows)) > margin;
+		if (cv::countNonZero(owned) > 0)
+			prepared->owned = owned;
+	}
+	prepared->prepareMs = duration_cast<milliseconds>(high_resolution_clock::now() - start).count();
+}
+
+
+// Splits "--name[=value]" options from positional arguments; later options override earlier ones
+static void splitArguments(const QStringList &arguments, QStringList *args, QMap<QString, QString> *options) {
+	for (const QString &arg : arguments) {
+		if (arg.startsWith(QStringLiteral("--"))) {
+			const int eq = arg.indexOf(QLatin1Char('='));
+			options->insert(eq < 0 ? arg.mid(2) : arg.mid(2, eq - 2), eq < 0 ? QString() : arg.mid(eq + 1));
+		} else {
+			*args << arg;
+		}
+	}
+}
+
+// "X,Y,W,H" with X, Y >= 0 and W, H > 0
+static bool parseRect(const QString &value, cv::Rect *rect) {
+	const QStringList parts = value.split(QLatin1Char(','));
+	if (parts.size() != 4)
+		return false;
+	int values[4] = {0, 0, 0, 0};
+	for (int i = 0; i < 4; ++i) {
+		bool ok = false;
+		values[i] = parts[i].trimmed().toInt(&ok);
+		if (!ok)
+			return false;
+	}
+	if (values[0] < 0 || values[1] < 0 || values[2] <= 0 || values[3] <= 0)
+		return false;
+	*rect = cv::Rect(values[0], values[1], values[2], values[3]);
+	return true;
+}
+
+static void printUsage(const char *program) {
+	cerr << "Usage: " << program << " <input_folder> <output> [num_bands] [feather_radius] [overlap_margin] [use_voronoi] [debug] [options]" << endl;
+	cerr << "  <input_folder>: Folder containing TIFF files" << endl;
+	cerr << "  <output>: Output image path (.tif/.tiff: tiled TIFF with a .tfw; other formats through OpenCV)" << endl;
+	cerr << "  [num_bands]: Optional number of bands for MultiBandBlender (default: 14)" << endl;
+	cerr << "  [feather_radius]: Optional feathering radius in pixels (default: 512.0)" << endl;
+	cerr << "  [overlap_margin]: Optional Voronoi mask overlap margin in pixels (default: 20.0)" << endl;
+	cerr << "  [use_voronoi]: Optional use Voronoi masks for blending (true/false, default: true)" << endl;
+	cerr << "  [debug]: Optional debug mode to save masks next to output (debug/true/1, default: false)" << endl;
+	cerr << "Options:" << endl;
+	cerr << "  --threads=N: Number of worker threads (default: 0 = all cores)" << endl;
+	cerr << "  --compression=none|lzw|deflate: TIFF output compression (default: none)" << endl;
+	cerr << "  --overviews[=N]: Add N internal overviews to the TIFF output (no value: down to one tile)" << endl;
+	cerr << "  --prefetch-threads=N: Threads decoding tiles ahead of the blender (default: 2, 0 = serial)" << endl;
+	cerr << "  --prefetch-depth=N: Maximum number of tiles decoded ahead of the blender (default: 3)" << endl;
+	cerr << "  --feed-threads=N: Threads building tile pyramids concurrently in the blender (default: 0 = serial; above 0, accumulation order varies and the output may differ by one rounding step between runs)" << endl;
+	cerr << "  --strip-height=N: Blend the canvas in strips of N rows to bound memory (default: 0 = whole canvas)" << endl;
+	cerr << "  --precision=accurate|fast: Floating-point or fixed-point blend weights (default: accurate)" << endl;
+	cerr << "  --scratch-dir=DIR: Keep large pyramid levels in memory-mapped files in DIR (default: in memory)" << endl;
+	cerr << "  --scratch-min-mb=N: Smallest pyramid level moved to the scratch directory, in MB (default: 256)" << endl;
+	cerr << "  --direct-copy: Copy the fine detail inside each tile's Voronoi cell instead of blending it" << endl;
+	cerr << "                 (only with a small num_bands: pixels must be 4 * 2^num_bands from other tiles and the tile edge)" << endl;
+	cerr << "  --roi=X,Y,W,H: Only re-blend this canvas rectangle and patch it into the existing TIFF output" << endl;
+	cerr << "  --changed-tiles=NAME[,NAME...]: Only re-blend the area affected by these tiles, patching the existing TIFF output" << endl;
+	cerr << "  --partition=N: Split the canvas into blocks of about N pixels and write one job per block instead of blending" << endl;
+	cerr << "  --debug: Same as the debug positional argument" << endl;
+	cerr << "Distributed runs:" << endl;
+	cerr << "  " << program << " --job=FILE [options]: Blend one block of a partitioned canvas (options override the job's)" << endl;
+	cerr << "  " << program << " --merge=PLAN: Assemble the blended blocks of a partitioned canvas into its output" << endl;
+	cerr << "Service:" << endl;
+	cerr << "  " << program << " --serve[=N] [--memory-budget-mb=M] [--threads=T]: Run the command lines read from stdin, N at once (default: 1)," << endl;
+	cerr << "      keeping buffers between jobs; jobs wait while their pyramids exceed M MB (default: half of RAM)" << endl;
+}
+
+
+// One run of a command line. With a service, tile folders, buffers and memory are
+// shared with the jobs running concurrently.
+static int runBlend(const char *program, const QStringList &arguments, ServiceContext *service) {
+	QStringList args;
+	QMap<QString, QString> options;
+	splitArguments(arguments, &args, &options);
+
+	// Merge step of a partitioned run: needs nothing but the plan
+	if (options.contains(QStringLiteral("merge"))) {
+		QString errorMessage;
+		BlockPlan plan;
+		if (!readBlockPlan(options.value(QStringLiteral("merge")), &plan, &errorMessage) ||
+		    !mergeBlocks(plan, &errorMessage)) {
+			cerr << "Merge failed: " << qPrintable(errorMessage) << endl;
+			return 1;
+		}
+		cout << "Merged " << plan.blocks.size() << " blocks into " << qPrintable(plan.output) << endl;
+		return 0;
+	}
+
+	// Worker of a partitioned run: the job holds the command line, options given here override it,
+	// and the tiles the planner picked for the block, which are the only ones fed
+	const bool jobMode = options.contains(QStringLiteral("job"));
+	QStringList jobTiles;
+	if (jobMode) {
+		QString errorMessage;
+		QStringList jobArguments;
+		if (!readBlockJob(options.value(QStringLiteral("job")), &jobArguments, &jobTiles, &errorMessage)) {
+			cerr << "Invalid job: " << qPrintable(errorMessage) << endl;
+			return 1;
+		}
+		if (!args.isEmpty()) {
+			printUsage(program);
+			return 1;
+		}
+		options.remove(QStringLiteral("job"));
+		const QMap<QString, QString> overrides = options;
+		options.clear();
+		splitArguments(jobArguments, &args, &options);
+		for (auto it = overrides.begin(); it != overrides.end(); ++it)
+			options.insert(it.key(), it.value());
+	}
+
+	if (args.size() < 2 || args.size() > 7) {
+		printUsage(program);
 		return 1;
 	}
 
 	auto startTime = high_resolution_clock::now();
 
-	QString folder = QString::fromUtf8(argv[1]);
-	QString outputPath = QString::fromUtf8(argv[2]);
+	QString folder = args[0];
+	QString outputPath = args[1];
 	
 	int numBands = 14; // Default value
-	if (argc >= 4) {
+	if (args.size() >= 3) {
 		bool ok = false;
-		numBands = QString::fromUtf8(argv[3]).toInt(&ok);
+		numBands = args[2].toInt(&ok);
 		if (!ok || numBands < 0 || numBands > 50) {
 			cerr << "Invalid num_bands value. Must be between 0 and 50." << endl;
 			return 1;
@@ -50,9 +286,9 @@ int main(int argc, char *argv[]) {
 	}
 	
 	double featherRadius = 512.0; // Default value
-	if (argc >= 5) {
+	if (args.size() >= 4) {
 		bool ok = false;
-		featherRadius = QString::fromUtf8(argv[4]).toDouble(&ok);
+		featherRadius = args[3].toDouble(&ok);
 		if (!ok || featherRadius < 0.0) {
 			cerr << "Invalid feather_radius value. Must be >= 0." << endl;
 			return 1;
@@ -60,9 +296,9 @@ int main(int argc, char *argv[]) {
 	}
 	
 	double overlapMargin = 20.0; // Default value
-	if (argc >= 6) {
+	if (args.size() >= 5) {
 		bool ok = false;
-		overlapMargin = QString::fromUtf8(argv[5]).toDouble(&ok);
+		overlapMargin = args[4].toDouble(&ok);
 		if (!ok || overlapMargin < 0.0) {
 			cerr << "Invalid overlap_margin value. Must be >= 0." << endl;
 			return 1;
@@ -70,20 +306,163 @@ int main(int argc, char *argv[]) {
 	}
 	
 	bool useVoronoiMasks = true; // Default: use dual-mask blending
-	if (argc >= 7) {
-		QString voronoiArg = QString::fromUtf8(argv[6]).toLower();
+	if (args.size() >= 6) {
+		QString voronoiArg = args[5].toLower();
 		if (voronoiArg == "false" || voronoiArg == "0" || voronoiArg == "no") {
 			useVoronoiMasks = false;
 		}
 	}
 	
-	bool debugMode = false; // Default: no debug output
-	if (argc >= 8) {
-		QString debugArg = QString::fromUtf8(argv[7]).toLower();
-		if (debugArg == "debug" || debugArg == "--debug" || debugArg == "true" || debugArg == "1") {
+	bool debugMode = options.contains(QStringLiteral("debug")); // Default: no debug output
+	if (args.size() >= 7) {
+		QString debugArg = args[6].toLower();
+		if (debugArg == "debug" || debugArg == "true" || debugArg == "1") {
 			debugMode = true;
 		}
 	}
+
+	int numThreads = 0; // Default: let OpenCV use all cores
+	if (options.contains(QStringLiteral("threads"))) {
+		bool ok = false;
+		numThreads = options.value(QStringLiteral("threads")).toInt(&ok);
+		if (!ok || numThreads < 0) {
+			cerr << "Invalid --threads value. Must be >= 0." << endl;
+			return 1;
+		}
+	}
+	// The thread pool is the service's: its jobs share it
+	if (numThreads > 0 && !service)
+		cv::setNumThreads(numThreads);
+
+	TiledTiffWriter::Compression compression = TiledTiffWriter::Compression::None;
+	if (options.contains(QStringLiteral("compression")) &&
+	    !TiledTiffWriter::parseCompression(options.value(QStringLiteral("compression")), &compression)) {
+		cerr << "Invalid --compression value. Must be none, lzw or deflate." << endl;
+		return 1;
+	}
+
+	int overviewLevels = 0; // Default: full resolution only
+	if (options.contains(QStringLiteral("overviews"))) {
+		const QString value = options.value(QStringLiteral("overviews"));
+		bool ok = true;
+		overviewLevels = value.isEmpty() ? -1 : value.toInt(&ok);
+		if (!ok || (!value.isEmpty() && overviewLevels < 0)) {
+			cerr << "Invalid --overviews value. Must be >= 0." << endl;
+			return 1;
+		}
+	}
+
+	int prefetchThreads = 2;
+	if (options.contains(QStringLiteral("prefetch-threads"))) {
+		bool ok = false;
+		prefetchThreads = options.value(QStringLiteral("prefetch-threads")).toInt(&ok);
+		if (!ok || prefetchThreads < 0) {
+			cerr << "Invalid --prefetch-threads value. Must be >= 0." << endl;
+			return 1;
+		}
+	}
+
+	int prefetchDepth = 3;
+	if (options.contains(QStringLiteral("prefetch-depth"))) {
+		bool ok = false;
+		prefetchDepth = options.value(QStringLiteral("prefetch-depth")).toInt(&ok);
+		if (!ok || prefetchDepth < 1) {
+			cerr << "Invalid --prefetch-depth value. Must be >= 1." << endl;
+			return 1;
+		}
+	}
+
+	int feedThreads = 0;
+	if (options.contains(QStringLiteral("feed-threads"))) {
+		bool ok = false;
+		feedThreads = options.value(QStringLiteral("feed-threads")).toInt(&ok);
+		if (!ok || feedThreads < 0) {
+			cerr << "Invalid --feed-threads value. Must be >= 0." << endl;
+			return 1;
+		}
+	}
+
+	int stripHeight = 0; // Default: blend the whole canvas at once
+	if (options.contains(QStringLiteral("strip-height"))) {
+		bool ok = false;
+		stripHeight = options.value(QStringLiteral("strip-height")).toInt(&ok);
+		if (!ok || stripHeight < 0) {
+			cerr << "Invalid --strip-height value. Must be >= 0." << endl;
+			return 1;
+		}
+	}
+
+	int weightType = CV_32F; // Default: floating-point weights
+	if (options.contains(QStringLiteral("precision"))) {
+		const QString precision = options.value(QStringLiteral("precision")).toLower();
+		if (precision == QLatin1String("fast")) {
+			weightType = CV_16S;
+		} else if (precision != QLatin1String("accurate")) {
+			cerr << "Invalid --precision value. Must be accurate or fast." << endl;
+			return 1;
+		}
+	}
+
+	// Default: blend every pixel
+	const bool directCopy = options.contains(QStringLiteral("direct-copy"));
+
+	QString scratchDir; // Default: every pyramid level in memory
+	if (options.contains(QStringLiteral("scratch-dir"))) {
+		scratchDir = options.value(QStringLiteral("scratch-dir"));
+		if (!QFileInfo(scratchDir).isDir() || !QFileInfo(scratchDir).isWritable()) {
+			cerr << "Invalid --scratch-dir value. Must be a writable directory." << endl;
+			return 1;
+		}
+	}
+
+	long long scratchMinMb = 256;
+	if (options.contains(QStringLiteral("scratch-min-mb"))) {
+		bool ok = false;
+		scratchMinMb = options.value(QStringLiteral("scratch-min-mb")).toLongLong(&ok);
+		if (!ok || scratchMinMb < 0) {
+			cerr << "Invalid --scratch-min-mb value. Must be >= 0." << endl;
+			return 1;
+		}
+	}
+	
+	// ROI mode: re-blend a canvas rectangle and/or the area reached by changed tiles
+	cv::Rect roiRequest;
+	if (options.contains(QStringLiteral("roi")) && !parseRect(options.value(QStringLiteral("roi")), &roiRequest)) {
+		cerr << "Invalid --roi value. Must be X,Y,W,H with X, Y >= 0 and W, H > 0." << endl;
+		return 1;
+	}
+
+	QStringList changedTiles;
+	if (options.contains(QStringLiteral("changed-tiles"))) {
+		changedTiles = options.value(QStringLiteral("changed-tiles")).split(QLatin1Char(','), Qt::SkipEmptyParts);
+		if (changedTiles.isEmpty()) {
+			cerr << "Invalid --changed-tiles value. Must list at least one tile name." << endl;
+			return 1;
+		}
+	}
+	const bool roiMode = !roiRequest.empty() || !changedTiles.isEmpty();
+
+	// Distributed runs: the planner splits the canvas, each worker blends one block (set by its job)
+	int partitionSize = 0;
+	if (options.contains(QStringLiteral("partition"))) {
+		bool ok = false;
+		partitionSize = options.value(QStringLiteral("partition")).toInt(&ok);
+		if (!ok || partitionSize <= 0) {
+			cerr << "Invalid --partition value. Must be > 0." << endl;
+			return 1;
+		}
+	}
+
+	cv::Rect blockRect;
+	if (options.contains(QStringLiteral("block")) && !parseRect(options.value(QStringLiteral("block")), &blockRect)) {
+		cerr << "Invalid --block value. Must be X,Y,W,H with X, Y >= 0 and W, H > 0." << endl;
+		return 1;
+	}
+	const bool blockMode = !blockRect.empty();
+	if (int(roiMode) + int(partitionSize > 0) + int(blockMode) > 1) {
+		cerr << "--roi/--changed-tiles, --partition and --job cannot be combined." << endl;
+		return 1;
+	}
 	
 	cout << "=== ReTawny V2 ===" << endl;
 	cout << "Parameters:" << endl;
@@ -94,8 +473,30 @@ int main(int argc, char *argv[]) {
 	cout << "  Overlap margin: " << overlapMargin << " pixels" << endl;
 	cout << "  Use Voronoi masks: " << (useVoronoiMasks ? "Yes" : "No") << endl;
 	cout << "  Debug mode: " << (debugMode ? "Yes" : "No") << endl;
+	cout << "  Precision: " << (weightType == CV_16S ? "fast (fixed point)" : "accurate") << endl;
+	if (!scratchDir.isEmpty())
+		cout << "  Scratch directory: " << qPrintable(scratchDir) << " (levels >= " << scratchMinMb << " MB)" << endl;
+	if (!roiRequest.empty())
+		cout << "  ROI: " << roiRequest.x << "," << roiRequest.y << " " << roiRequest.width << "x" << roiRequest.height << endl;
+	if (!changedTiles.isEmpty())
+		cout << "  Changed tiles: " << qPrintable(changedTiles.join(QStringLiteral(", "))) << endl;
+	cout << "  Threads: " << cv::getNumThreads() << endl;
 	cout << endl;
 
+	RunReport report;
+	report.setParameter(QStringLiteral("input"), folder);
+	report.setParameter(QStringLiteral("output"), outputPath);
+	report.setParameter(QStringLiteral("num_bands"), numBands);
+	report.setParameter(QStringLiteral("feather_radius"), featherRadius);
+	report.setParameter(QStringLiteral("overlap_margin"), overlapMargin);
+	report.setParameter(QStringLiteral("voronoi_masks"), useVoronoiMasks);
+	report.setParameter(QStringLiteral("precision"), weightType == CV_16S ? QStringLiteral("fast") : QStringLiteral("accurate"));
+	report.setParameter(QStringLiteral("threads"), cv::getNumThreads());
+	report.setParameter(QStringLiteral("feed_threads"), feedThreads);
+	report.setParameter(QStringLiteral("prefetch_threads"), prefetchThreads);
+	report.setParameter(QStringLiteral("strip_height"), stripHeight);
+	report.setParameter(QStringLiteral("direct_copy"), directCopy);
+
 
 
 	cout << "[1/5] Loading tiles metadata..." << endl;
@@ -104,7 +505,7 @@ int main(int argc, char *argv[]) {
 	OrthoLoader loader;
 
 	QString errorMessage;
-	if(!loader.loadFromDirectory(folder, &errorMessage)) {
+	if (service ? !service->folders.load(folder, &loader, &errorMessage) : !loader.loadFromDirectory(folder, &errorMessage)) {
 		cerr << "Loading failed: " << qPrintable(errorMessage) << endl;
 		return 1;
 	}
@@ -117,21 +518,39 @@ int main(int argc, char *argv[]) {
 	
 	auto t2 = high_resolution_clock::now();
 	cout << "  Loaded " << tiles.size() << " tiles in " 
-	     << duration_cast<milliseconds>(t2 - t1).count() << " ms" << endl;
+	     << duration_cast<milliseconds>(t2 - t1).count() << " ms (" << loader.cachedTileCount() << " from metadata cache)" << endl;
 	cout << endl;
+	report.addStage(QStringLiteral("load_metadata"), duration<double, milli>(t2 - t1).count());
+	report.setParameter(QStringLiteral("tiles"), tiles.size());
 
+	// In a service, the folder's masks stay as this job read them until it returns
+	TileFolders::MaskLease masksLease;
 	if (useVoronoiMasks) {
 		cout << "[2/6] Generating Voronoi masks..." << endl;
 		auto t2a = high_resolution_clock::now();
 		
-		if (!loader.generateVoronoiMasks(overlapMargin, &errorMessage)) {
+		if (service ? !service->folders.generateVoronoiMasks(folder, overlapMargin, &loader, &masksLease, &errorMessage)
+		            : !loader.generateVoronoiMasks(overlapMargin, &errorMessage)) {
 			cerr << "Voronoi mask generation failed: " << qPrintable(errorMessage) << endl;
 			return 1;
 		}
 		
 		auto t2b = high_resolution_clock::now();
 		cout << "  Voronoi masks generated in " 
-		     << duration_cast<milliseconds>(t2b - t2a).count() << " ms" << endl;
+		     << duration_cast<milliseconds>(t2b - t2a).count() << " ms (" << loader.regeneratedMaskCount() << " regenerated, "
+		     << tiles.size() - loader.regeneratedMaskCount() << " reused)" << endl;
+		report.addStage(QStringLiteral("voronoi_masks"), duration<double, milli>(t2b - t2a).count());
+
+		// DEBUG: Save the canvas ownership map next to output file
+		if (debugMode) {
+			QFileInfo outputInfo(outputPath);
+			QString membershipPath = outputInfo.absolutePath() + "/" + outputInfo.completeBaseName() + "_membership.tif";
+			if (loader.saveMembershipMap(membershipPath, &errorMessage)) {
+				cout << "  Saved membership map: " << qPrintable(membershipPath) << endl;
+			} else {
+				cerr << "  Could not save membership map: " << qPrintable(errorMessage) << endl;
+			}
+		}
 		cout << endl;
 	} else {
 		cout << "[2/6] Skipping Voronoi masks (using PC_ masks only)..." << endl;
@@ -147,142 +566,318 @@ int main(int argc, char *argv[]) {
 		return 1;
 	}
 
-	// Check for large images and disable OpenCL to avoid VRAM exhaustion
-	const long long totalPixels = static_cast<long long>(canvasSize.width()) * canvasSize.height();
-	const long long estimatedMB = (totalPixels * 3) / (1024 * 1024); // 3 bytes per pixel for BGR
-	
-	// MultiBandBlender creates pyramids that consume much more memory
-	// Rough estimate: each band level ~= 1.33x original size, total ~= numBands * 1.5
-	const long long estimatedBlendingMB = estimatedMB * numBands * 2;
-	
-	cout << "  Canvas size: " << canvasSize.width() << "x" << canvasSize.height() 
-	     << " (~" << estimatedMB << " MB, ~" << estimatedBlendingMB << " MB with " << numBands << " bands)" << endl;
-	     
-	// Disable OpenCL if estimated VRAM usage > 4GB or if more than 5 bands
-	if (estimatedBlendingMB > 4096 || numBands > 5) {
-		cout << "  Disabling OpenCL to avoid VRAM exhaustion (using CPU)" << endl;
-		cv::ocl::setUseOpenCL(false);
-	} else {
-		cout << "  Using OpenCL if available" << endl;
+	cout << "  Canvas size: " << canvasSize.width() << "x" << canvasSize.height() << endl;
+
+	// Destination levels go to the OpenCL device from the coarsest one while
+	// they fit in half its memory; the rest is left to tile pyramids and the driver
+	size_t deviceBudget = 0;
+	size_t deviceMaxAlloc = 0;
+	if (cv::ocl::haveOpenCL() && cv::ocl::useOpenCL()) {
+		const cv::ocl::Device &device = cv::ocl::Device::getDefault();
+		if (device.available()) {
+			deviceBudget = device.globalMemSize() / 2;
+			deviceMaxAlloc = device.maxMemAllocSize();
+			cout << "  OpenCL device: " << device.name() << " (" << (device.globalMemSize() >> 20)
+			     << " MB, max allocation " << (deviceMaxAlloc >> 20) << " MB)" << endl;
+		}
 	}
+	if (deviceBudget == 0)
+		cout << "  OpenCL device: none (using CPU)" << endl;
 
+	// TIFF output is written tile band by tile band as strips finish; other
+	// formats are collected into one 8-bit image for cv::imwrite
 	const cv::Rect roi(0, 0, canvasSize.width(), canvasSize.height());
-	DualMaskMultiBandBlender blender(numBands);
-	blender.prepare(roi);
-	
-	auto t4 = high_resolution_clock::now();
-	cout << "  Blender ready in " << duration_cast<milliseconds>(t4 - t3).count() << " ms" << endl;
-	cout << endl;
+	const QString outputSuffix = QFileInfo(outputPath).suffix().toLower();
+	const bool tiledOutput = outputSuffix == QStringLiteral("tif") || outputSuffix == QStringLiteral("tiff");
 
-	cout << "[4/6] Processing and feeding tiles..." << endl;
-	auto t5 = high_resolution_clock::now();
-	
-	bool fedAny = false;
-	int tileIndex = 0;
-	for (OrthoLoader::Tile &tile : tiles) {
-		tileIndex++;
-		cout << "  Tile " << tileIndex << "/" << tiles.size() << ": " << qPrintable(tile.name) << "..." << flush;
-		auto tileStart = high_resolution_clock::now();
-		
-		// Load tile into memory
-		if (!loader.loadTile(&tile, &errorMessage)) {
-			cerr << " FAILED: " << qPrintable(errorMessage) << endl;
+	if (partitionSize > 0) {
+		// Planner of a distributed run: one job per block of whole output tiles,
+		// listing the tiles within the pyramid support (halo) of the block.
+		// Voronoi masks and tile metadata are already up to date for the workers.
+		if (!tiledOutput) {
+			cerr << "--partition needs a .tif/.tiff output." << endl;
 			return 1;
 		}
-		if (tile.image.isNull()){
-		   cerr << " FAILED: null image" << endl;
+		const QFileInfo outputInfo(outputPath);
+		const QString blocksDir = outputInfo.absolutePath() + "/" + outputInfo.completeBaseName() + "_blocks";
+		if (!QDir().mkpath(blocksDir)) {
+			cerr << "Failed to create " << qPrintable(blocksDir) << endl;
 			return 1;
 		}
-		cv::Mat bgr = qImageToBgrMat(tile.image);
 
-		if (bgr.empty()){
-			loader.unloadTile(&tile);
-			cerr << " FAILED: empty BGR" << endl;
+		BlockPlan plan;
+		plan.canvasSize = canvasSize;
+		plan.halo = DualMaskMultiBandBlender::supportForBands(DualMaskMultiBandBlender::bandsForSize(numBands, roi.size()));
+		plan.output = outputInfo.absoluteFilePath();
+		plan.compression = options.value(QStringLiteral("compression"), QStringLiteral("none"));
+		plan.overviewLevels = overviewLevels;
+
+		// Workers get the same parameters, minus the modes and debug output
+		QStringList workerOptions;
+		const QStringList notForwarded = {QStringLiteral("partition"), QStringLiteral("roi"), QStringLiteral("changed-tiles"),
+		                                  QStringLiteral("block"), QStringLiteral("debug"), QStringLiteral("overviews")};
+		for (auto it = options.begin(); it != options.end(); ++it) {
+			if (!notForwarded.contains(it.key()))
+				workerOptions << (it.value().isEmpty() ? "--" + it.key() : "--" + it.key() + "=" + it.value());
+		}
+
+		const QVector<cv::Rect> blocks = partitionCanvas(canvasSize, partitionSize, TiledTiffWriter::kDefaultTileSize);
+		for (int i = 0; i < blocks.size(); ++i) {
+			BlockJob job;
+			job.rect = blocks[i];
+			const QString name = QStringLiteral("block_%1").arg(i, 4, 10, QLatin1Char('0'));
+			job.output = blocksDir + "/" + name + ".tif";
+			job.jobPath = blocksDir + "/" + name + ".json";
+			for (const int tileIdx : loader.tilesNear(job.rect, plan.halo))
+				job.tiles << tiles[tileIdx].name;
+			job.arguments << QFileInfo(folder).absoluteFilePath() << job.output << QString::number(numBands)
+			              << QString::number(featherRadius, 'g', 17) << QString::number(overlapMargin, 'g', 17)
+			              << (useVoronoiMasks ? QStringLiteral("true") : QStringLiteral("false"))
+			              << QStringLiteral("--block=%1,%2,%3,%4").arg(job.rect.x).arg(job.rect.y).arg(job.rect.width).arg(job.rect.height)
+			              << workerOptions;
+			plan.blocks.push_back(job);
+		}
+
+		if (!writeBlockPlan(blocksDir, plan, &errorMessage) || !loader.writeWorldFile(outputPath, &errorMessage)) {
+			cerr << "Failed to write the block plan: " << qPrintable(errorMessage) << endl;
 			return 1;
 		}
+		cout << "  Partitioned into " << plan.blocks.size() << " blocks (halo " << plan.halo << " pixels)" << endl;
+		// The halo doubles with each band: once it spans the canvas, the workers
+		// of those blocks blend and feed the whole mosaic
+		const cv::Rect canvasRect(0, 0, canvasSize.width(), canvasSize.height());
+		const int spanning = static_cast<int>(std::count_if(plan.blocks.begin(), plan.blocks.end(), [&](const BlockJob &job) {
+			const cv::Rect window(job.rect.x - plan.halo, job.rect.y - plan.halo, job.rect.width + 2 * plan.halo,
+			                      job.rect.height + 2 * plan.halo);
+			return (window & canvasRect) == canvasRect;
+		}));
+		if (plan.blocks.size() > 1 && spanning > 0) {
+			int bands = DualMaskMultiBandBlender::bandsForSize(numBands, roi.size());
+			const int blockSide = std::min(plan.blocks.first().rect.width, plan.blocks.first().rect.height);
+			while (bands > 1 && 4 * DualMaskMultiBandBlender::supportForBands(bands) > blockSide)
+				--bands;
+			cout << "  Warning: the halo spans the whole canvas for " << spanning << " of " << plan.blocks.size()
+			     << " blocks, whose workers feed every tile; num_bands " << bands
+			     << " keeps it within a quarter of a block" << endl;
+		}
+		cout << "  Run each job: " << program << " --job=" << qPrintable(blocksDir) << "/block_NNNN.json" << endl;
+		cout << "  Then merge:   " << program << " --merge=" << qPrintable(blocksDir) << "/plan.json" << endl;
+		return 0;
+	}
 
-		// Build weight mask from PC_ mask (for weight calculation)
-		// PC_ masks on disk: black (0) = utile, white (255) = masqué
-		// After QImage loads: inverted to white (255) = utile, black (0) = masqué
-		// buildCoverageMask will handle the inversion internally
-		loader.loadPCMask(&tile, nullptr);
-		QImage pcMask = tile.mask;
-		cv::Mat weightMask = buildCoverageMask(tile.image, pcMask, featherRadius, false);
-		
-		// DEBUG: Save weight mask next to output file
-		if (debugMode) {
-			QFileInfo outputInfo(outputPath);
-			QString debugDir = outputInfo.absolutePath();
-			QString baseName = outputInfo.completeBaseName();
-			QString weightMaskPath = debugDir + "/" + baseName + "_weight_" + tile.name.split('.').first() + ".png";
-			if (cv::imwrite(weightMaskPath.toStdString(), weightMask)) {
-				cout << "    Saved weight mask: " << qPrintable(weightMaskPath) << endl;
-			}
+	TiledTiffWriter tiffWriter;
+	TiledTiffPatcher tiffPatcher;
+	cv::Mat blended8u;
+	QString outputError;
+	cv::Rect region = roi;
+	if (roiMode) {
+		// Only the edited area is blended and written over the previous output;
+		// a changed tile affects the blend up to the pyramid support around it
+		if (!tiledOutput) {
+			cerr << "ROI mode needs a .tif/.tiff output to patch." << endl;
+			return 1;
 		}
-		
-		// Build blend mask from Voronoi mask (for pixel blending)
-		// Voronoi masks: white (255) = utile, black (0) = inutile
-		cv::Mat blendMask;
-		if (useVoronoiMasks && !tile.generatedMaskPath.isEmpty()) {
-			// Use Voronoi mask for blending
-			QImage voronoiMask(tile.generatedMaskPath);
-			if (!voronoiMask.isNull()) {
-				// No inversion needed - QImage loads Voronoi correctly
-				blendMask = buildCoverageMask(tile.image, voronoiMask, featherRadius, true);
-				
-				// DEBUG: Save blend mask next to output file
-				if (debugMode) {
-					QFileInfo outputInfo(outputPath);
-					QString debugDir = outputInfo.absolutePath();
-					QString baseName = outputInfo.completeBaseName();
-					QString blendMaskPath = debugDir + "/" + baseName + "_blend_" + tile.name.split('.').first() + ".png";
-					if (cv::imwrite(blendMaskPath.toStdString(), blendMask)) {
-						cout << "    Saved blend mask: " << qPrintable(blendMaskPath) << endl;
-					}
-				}
+		if (!tiffPatcher.open(outputPath, canvasSize, &errorMessage)) {
+			cerr << "Failed to open output image for patching: " << qPrintable(errorMessage) << endl;
+			return 1;
+		}
+
+		const int support = DualMaskMultiBandBlender::supportForBands(DualMaskMultiBandBlender::bandsForSize(numBands, roi.size()));
+		region = roiRequest;
+		for (const QString &name : changedTiles) {
+			const auto it = std::find_if(tiles.begin(), tiles.end(), [&](const OrthoLoader::Tile &tile) { return tile.name == name; });
+			if (it == tiles.end()) {
+				cerr << "Unknown tile in --changed-tiles: " << qPrintable(name) << endl;
+				return 1;
 			}
+			region |= cv::Rect(it->x - support, it->y - support, it->width + 2 * support, it->height + 2 * support);
 		}
-		
-		// Fallback: if Voronoi disabled or no Voronoi mask, use weight mask for both
-		if (blendMask.empty()) {
-			blendMask = weightMask.clone();
+
+		// Whole output tiles, so none is merged with stale pixels at the region edges
+		const QSize grid = tiffPatcher.tileSize();
+		region &= roi;
+		if (region.empty()) {
+			cerr << "The ROI does not intersect the canvas." << endl;
+			return 1;
 		}
-		
-		// Unload mask and tile to free memory
-		loader.unloadMask(&tile);
-		loader.unloadTile(&tile);
-		
-		if (weightMask.empty() || cv::countNonZero(weightMask) == 0) {
-			cerr << " FAILED: empty or zero weight mask" << endl;
+		const int x0 = region.x / grid.width() * grid.width();
+		const int y0 = region.y / grid.height() * grid.height();
+		const int x1 = std::min(roi.br().x, (region.br().x + grid.width() - 1) / grid.width() * grid.width());
+		const int y1 = std::min(roi.br().y, (region.br().y + grid.height() - 1) / grid.height() * grid.height());
+		region = cv::Rect(x0, y0, x1 - x0, y1 - y0);
+		cout << "  Re-blending region: " << region.x << "," << region.y << " " << region.width << "x" << region.height << endl;
+		if (tiffPatcher.hasOverviews())
+			cout << "  Warning: the overviews of the output are not updated; re-run without ROI to rebuild them" << endl;
+	} else if (blockMode) {
+		// Worker of a distributed run: the block alone goes to its own TIFF, merged later
+		if (!tiledOutput || (blockRect & roi) != blockRect) {
+			cerr << "--block needs a .tif/.tiff output and a rectangle inside the canvas." << endl;
 			return 1;
 		}
-		if (blendMask.empty() || cv::countNonZero(blendMask) == 0) {
-			cerr << " FAILED: empty or zero blend mask" << endl;
+		region = blockRect;
+		if (!tiffWriter.open(outputPath, QSize(region.width, region.height), compression, &errorMessage)) {
+			cerr << "Failed to create block image: " << qPrintable(errorMessage) << endl;
 			return 1;
 		}
-		
-		// Use blend mask for filling masked areas with average color
-		cv::Scalar avgColor = cv::mean(bgr, blendMask);
+		cout << "  Block: " << region.x << "," << region.y << " " << region.width << "x" << region.height << endl;
+	} else if (tiledOutput) {
+		tiffWriter.setOverviewLevels(overviewLevels);
+		if (!tiffWriter.open(outputPath, canvasSize, compression, &errorMessage)) {
+			cerr << "Failed to create output image: " << qPrintable(errorMessage) << endl;
+			return 1;
+		}
+	} else {
+		blended8u.create(roi.size(), CV_8UC3);
+	}
+
+	StreamingBlender blender(numBands, stripHeight, feedThreads, weightType);
+	if (!scratchDir.isEmpty())
+		blender.setScratch(scratchDir.toStdString(), static_cast<size_t>(scratchMinMb) << 20);
+	blender.setDeviceMemory(deviceBudget, deviceMaxAlloc);
+	blender.setDirectCopy(directCopy);
+	if (service)
+		blender.setPool(service->pool);
+	blender.prepare(roi, region, [&](const cv::Mat &strip, const cv::Mat &, cv::Rect rect) {
+		if (!tiledOutput) {
+			cv::Mat rows = blended8u(rect);
+			strip.convertTo(rows, CV_8UC3);
+			return true;
+		}
+		cv::Mat rows;
+		strip.convertTo(rows, CV_8UC3);
+		if (roiMode)
+			return tiffPatcher.writeRegion(rows, rect.tl(), &outputError);
+		return tiffWriter.writeRows(rows, &outputError);
+	});
+	if (blender.stripCount() > 1) {
+		cout << "  Streaming " << blender.stripCount() << " strips of " << blender.stripHeight()
+		     << " rows (+" << blender.padding() << " rows padding)" << endl;
+	}
+
+	// Memory plan of one strip pyramid (the whole canvas without streaming)
+	size_t hostBytes = 0, deviceBytes = 0, scratchBytes = 0;
+	cout << "  Pyramid levels" << (blender.stripCount() > 1 ? " (per strip)" : "") << ":" << endl;
+	const std::vector<DualMaskMultiBandBlender::LevelPlan> plan = blender.levelPlan();
+	for (size_t i = 0; i < plan.size(); ++i) {
+		const DualMaskMultiBandBlender::LevelPlan &level = plan[i];
+		const size_t bytes = level.laplace_bytes + level.weight_bytes;
+		hostBytes += level.direct_bytes;
+		switch (level.storage) {
+		case DualMaskMultiBandBlender::LevelStorage::Host: hostBytes += bytes; break;
+		case DualMaskMultiBandBlender::LevelStorage::Device: deviceBytes += bytes; break;
+		case DualMaskMultiBandBlender::LevelStorage::Scratch: scratchBytes += bytes; break;
+		}
+		cout << "    " << i << ": " << level.size.width << "x" << level.size.height << ", "
+		     << (bytes >> 20) << " MB, " << DualMaskMultiBandBlender::storageName(level.storage) << endl;
+	}
+	cout << "  Pyramid memory: " << (hostBytes >> 20) << " MB host, " << (deviceBytes >> 20) << " MB device, "
+	     << (scratchBytes >> 20) << " MB scratch" << endl;
+
+	// Concurrent service jobs wait until their host pyramid fits in the budget
+	if (service && service->memory.total() > 0 && static_cast<qint64>(hostBytes) > service->memory.total())
+		cout << "  Pyramid exceeds the service memory budget: the job runs alone" << endl;
+	const MemoryReservation reservation(service ? &service->memory : nullptr, static_cast<qint64>(hostBytes));
+	
+	auto t4 = high_resolution_clock::now();
+	cout << "  Blender ready in " << duration_cast<milliseconds>(t4 - t3).count() << " ms" << endl;
+	cout << endl;
+	report.setParameter(QStringLiteral("canvas_width"), canvasSize.width());
+	report.setParameter(QStringLiteral("canvas_height"), canvasSize.height());
+	report.setParameter(QStringLiteral("region"), QStringLiteral("%1,%2,%3,%4").arg(region.x).arg(region.y).arg(region.width).arg(region.height));
+	report.setParameter(QStringLiteral("strips"), blender.stripCount());
+	report.addStage(QStringLiteral("prepare_blender"), duration<double, milli>(t4 - t3).count());
+
+	cout << "[4/6] Processing and feeding tiles..." << endl;
+	auto t5 = high_resolution_clock::now();
+	
+	// Strips are finished top to bottom: feed tiles by increasing y. In ROI and
+	// block modes only tiles within the pyramid support of the region contribute.
+	QVector<int> feedOrder;
+	if (jobMode) {
+		for (const QString &name : jobTiles) {
+			const auto it = std::find_if(tiles.begin(), tiles.end(), [&](const OrthoLoader::Tile &tile) { return tile.name == name; });
+			if (it == tiles.end()) {
+				cerr << "Tile of the job not found in the input folder: " << qPrintable(name) << endl;
+				return 1;
+			}
+			feedOrder << static_cast<int>(it - tiles.begin());
+		}
+		cout << "  Feeding the job's " << feedOrder.size() << " of " << tiles.size() << " tiles" << endl;
+	} else if (roiMode || blockMode) {
+		feedOrder = loader.tilesNear(region, blender.padding());
+		cout << "  Feeding " << feedOrder.size() << " of " << tiles.size() << " tiles" << endl;
+	} else {
+		feedOrder.resize(tiles.size());
+		for (int i = 0; i < tiles.size(); ++i)
+			feedOrder[i] = i;
+	}
+	std::stable_sort(feedOrder.begin(), feedOrder.end(), [&](int a, int b) { return tiles[a].y < tiles[b].y; });
+
+	// Tiles are decoded and their masks built on worker threads while the blender consumes them in order
+	// Ownership comes from the Voronoi cells: without them no pixel is owned
+	const int directCopyMargin = directCopy && useVoronoiMasks
+	                                 ? DualMaskMultiBandBlender::directCopyMargin(DualMaskMultiBandBlender::bandsForSize(numBands, roi.size()))
+	                                 : 0;
+	const TileSettings tileSettings{featherRadius, useVoronoiMasks, debugMode, outputPath, directCopyMargin};
+	if (directCopy && !useVoronoiMasks)
+		cout << "  Warning: --direct-copy has no effect without Voronoi masks" << endl;
+	TilePrefetcher prefetcher(feedOrder.size(), prefetchThreads, prefetchDepth, [&](int index, PreparedTile *prepared) {
+		prepareTile(&loader, &tiles[feedOrder[index]], tileSettings, prepared);
+	});
 
-		// Fill only pixels where blend mask is zero with average color
-		cv::Mat zeroMask = (blendMask == 0);
-		bgr.setTo(avgColor, zeroMask);
+	bool fedAny = false;
+	int ownedTiles = 0;
+	PreparedTile prepared;
+	for (;;) {
+		// Time the blender spends waiting on the prefetch threads
+		auto waitStart = high_resolution_clock::now();
+		if (!prefetcher.next(&prepared))
+			break;
+		const double waitMs = duration<double, milli>(high_resolution_clock::now() - waitStart).count();
+		const OrthoLoader::Tile &tile = tiles[feedOrder[prepared.index]];
+		cout << "  Tile " << prepared.index + 1 << "/" << feedOrder.size() << ": " << qPrintable(tile.name) << "..." << flush;
+		if (!prepared.error.isEmpty()) {
+			cerr << " FAILED: " << qPrintable(prepared.error) << endl;
+			return 1;
+		}
+		auto feedStart = high_resolution_clock::now();
 
-		cv::Mat img16s;
-		bgr.convertTo(img16s, CV_16SC3);
 		// FIX: weight_mask (PC_ feathered) for accumulation, blend_mask (Voronoi sharp) for pixel blending
-		blender.feed(img16s, weightMask, blendMask, cv::Point(tile.x, tile.y));
+		if (!blender.feed(prepared.image, prepared.weightMask, prepared.blendMask, prepared.tl, &prepared.fillColor,
+		                   prepared.owned)) {
+			cerr << " FAILED: " << qPrintable(outputError) << endl;
+			return 1;
+		}
 		fedAny = true;
+		if (!prepared.owned.empty())
+			++ownedTiles;
 		
-		auto tileEnd = high_resolution_clock::now();
-		cout << " OK (" << duration_cast<milliseconds>(tileEnd - tileStart).count() << " ms)" << endl;
+		auto feedEnd = high_resolution_clock::now();
+		cout << " OK (prepare " << prepared.prepareMs << " ms, feed "
+		     << duration_cast<milliseconds>(feedEnd - feedStart).count() << " ms)" << endl;
+		RunReport::Tile tileReport;
+		tileReport.name = tile.name;
+		tileReport.decodeMs = prepared.decodeMs;
+		tileReport.maskMs = prepared.maskMs;
+		tileReport.prepareMs = prepared.prepareMs;
+		tileReport.waitMs = waitMs;
+		tileReport.feedMs = duration<double, milli>(feedEnd - feedStart).count();
+		tileReport.bytesRead = prepared.bytesRead;
+		report.addTile(tileReport);
+		for (const QString &line : prepared.log)
+			cout << "    " << qPrintable(line) << endl;
+		prepared = PreparedTile();
 	}
 	
 	auto t6 = high_resolution_clock::now();
 	cout << "  All tiles processed in " << duration_cast<seconds>(t6 - t5).count() << " seconds" << endl;
+	if (directCopy)
+		cout << "  Direct copy: " << ownedTiles << " of " << feedOrder.size() << " tiles had pixels copied" << endl;
 	cout << endl;
+	report.addStage(QStringLiteral("feed_tiles"), duration<double, milli>(t6 - t5).count());
 
-	if (!fedAny) {
+	// A block away from every tile is legitimately empty: it is written black
+	if (!fedAny && !blockMode) {
 		cerr << "Blending failed: No valid pixels were submitted to the blender." << endl;
 		return 1;
 	}
@@ -290,152 +885,183 @@ int main(int argc, char *argv[]) {
 	cout << "[5/6] Blending..." << endl;
 	auto t7 = high_resolution_clock::now();
 	
-	cv::Mat blended, blendedMask;
-	blender.blend(blended, blendedMask);
-	if (blended.empty()) {
-		cerr << "Blending failed: OpenCV returned an empty result." << endl;
+	if (!blender.finish()) {
+		cerr << "Blending failed: " << qPrintable(outputError) << endl;
 		return 1;
 	}
 
 	auto t8 = high_resolution_clock::now();
 	cout << "  Blending completed in " << duration_cast<seconds>(t8 - t7).count() << " seconds" << endl;
 	cout << endl;
+	report.addStage(QStringLiteral("blend"), duration<double, milli>(t8 - t7).count());
+	report.setBlenderTimings(blender.timings());
 
 	cout << "[6/6] Saving output..." << endl;
 	auto t9 = high_resolution_clock::now();
 	
-	cv::Mat blended8u;
-	blended.convertTo(blended8u, CV_8UC3);
-	QImage blendedImage = bgrMatToQImage(blended8u);
-	if (blendedImage.isNull()) {
-		cerr << "Blending failed: Could not convert the blended image for display." << endl;
-		return 1;
-	}
-
 	// Save the output image
-	if (!blendedImage.save(outputPath)) {
+	if (roiMode) {
+		if (!tiffPatcher.close(&errorMessage)) {
+			cerr << "Failed to save output image: " << qPrintable(errorMessage) << endl;
+			return 1;
+		}
+		// Patched tiles are rewritten in place: count the region, uncompressed
+		report.addBytesWritten(static_cast<qint64>(region.area()) * 3);
+	} else if (tiledOutput) {
+		if (!tiffWriter.close(&errorMessage)) {
+			cerr << "Failed to save output image: " << qPrintable(errorMessage) << endl;
+			return 1;
+		}
+		if (!blockMode && !loader.writeWorldFile(outputPath, &errorMessage)) {
+			cerr << "Failed to save world file: " << qPrintable(errorMessage) << endl;
+			return 1;
+		}
+		report.addBytesWritten(QFileInfo(outputPath).size());
+	} else if (!cv::imwrite(outputPath.toStdString(), blended8u)) {
 		cerr << "Failed to save output image to: " << qPrintable(outputPath) << endl;
 		return 1;
+	} else {
+		report.addBytesWritten(QFileInfo(outputPath).size());
 	}
 	
 	auto t10 = high_resolution_clock::now();
 	cout << "  Output saved in " << duration_cast<milliseconds>(t10 - t9).count() << " ms" << endl;
 	cout << endl;
+	report.addStage(QStringLiteral("save_output"), duration<double, milli>(t10 - t9).count());
 	
 	// Report statistics
 	auto endTime = high_resolution_clock::now();
 	auto totalSeconds = duration_cast<seconds>(endTime - startTime).count();
 	
-	struct rusage usage;
 	cout << "=== Statistics ===" << endl;
 	cout << "Total time: " << totalSeconds << " seconds (" 
 	     << totalSeconds / 60 << "m " << totalSeconds % 60 << "s)" << endl;
-	if (getrusage(RUSAGE_SELF, &usage) == 0) {
-		const long peakMB = usage.ru_maxrss / (1024 * 1024);
-		cout << "Peak memory usage: " << peakMB << " MB" << endl;
-	}
+	cout << "Peak memory usage: " << (RunReport::peakRssBytes() >> 20) << " MB"
+	     << (service ? " (whole service so far)" : "") << endl;
+
+	// Machine-readable run report next to the output; a failure only warns
+	const QFileInfo outputInfo(outputPath);
+	const QString reportPath = outputInfo.absolutePath() + "/" + outputInfo.completeBaseName() + "_report.json";
+	if (report.save(reportPath, &errorMessage))
+		cout << "Run report: " << qPrintable(reportPath) << endl;
+	else
+		cerr << "Could not save run report: " << qPrintable(errorMessage) << endl;
 	cout << endl;
 	
 	return 0;
 }
 
-
-
-cv::Mat qImageToBgrMat(const QImage &source) {
-	if (source.isNull())
-		return cv::Mat();
-
-	QImage converted = source.convertToFormat(QImage::Format_ARGB32);
-	cv::Mat wrapper(converted.height(), converted.width(), CV_8UC4, const_cast<uchar *>(converted.bits()), converted.bytesPerLine());
-	cv::Mat bgr;
-	cv::cvtColor(wrapper, bgr, cv::COLOR_BGRA2BGR);
-	return bgr.clone();
-}
-
-
-QImage bgrMatToQImage(const cv::Mat &bgr) {
-	if (bgr.empty() || bgr.type() != CV_8UC3)
-		return QImage();
-
-	cv::Mat rgb;
-	cv::cvtColor(bgr, rgb, cv::COLOR_BGR2RGB);
-	QImage image(rgb.data, rgb.cols, rgb.rows, rgb.step, QImage::Format_RGB888);
-	return image.copy();
-}
-
-cv::Mat buildCoverageMask(const QImage &source, const QImage &loadedMask, double featherRadius, bool sharp) {
-	if (source.isNull())
-		return cv::Mat();
-
-	cv::Mat mask;
-	
-	// Use loaded mask if available
-	// PC_ masks (sharp=false): black (0) = utile, white (255) = inutile
-	// Voronoi masks (sharp=true): white (255) = utile, black (0) = inutile
-	if (!loadedMask.isNull()) {
-		QImage maskConverted = loadedMask.convertToFormat(QImage::Format_ARGB32);
-		mask = cv::Mat(maskConverted.height(), maskConverted.width(), CV_8UC1, cv::Scalar(0));
-		for (int y = 0; y < maskConverted.height(); ++y) {
-			const QRgb *scan = reinterpret_cast<const QRgb *>(maskConverted.constScanLine(y));
-			uchar *maskRow = mask.ptr<uchar>(y);
-			for (int x = 0; x < maskConverted.width(); ++x) {
-				const QRgb pixel = scan[x];
-				int gray = qGray(pixel);
-				// PC_ on disk: black (0) = utile, white (255) = masqué
-				// QImage loads it as-is (NO automatic inversion)
-				// Voronoi: white (255) = utile, black (0) = masqué
-				if (sharp) {
-					// Voronoi: preserve gradient (already 255=utile from generation)
-					maskRow[x] = gray;
-				} else {
-					// PC_: invert and binarize (black/0=utile → 255, white/255=masqué → 0)
-					maskRow[x] = (gray < 128) ? 255 : 0;
-				}
-			}
+// Runs the command lines read from stdin, one per line, until end of input.
+// Empty lines and lines starting with # are skipped.
+static int runService(const char *program, const QMap<QString, QString> &options) {
+	int concurrency = 1;
+	if (!options.value(QStringLiteral("serve")).isEmpty()) {
+		bool ok = false;
+		concurrency = options.value(QStringLiteral("serve")).toInt(&ok);
+		if (!ok || concurrency <= 0) {
+			cerr << "Invalid --serve value. Must be > 0." << endl;
+			return 1;
 		}
-	} else {
-		// Fallback: detect magenta pixels in source image
-		QImage converted = source.convertToFormat(QImage::Format_ARGB32);
-		mask = cv::Mat(converted.height(), converted.width(), CV_8UC1, cv::Scalar(0));
-		for (int y = 0; y < converted.height(); ++y) {
-			const QRgb *scan = reinterpret_cast<const QRgb *>(converted.constScanLine(y));
-			uchar *maskRow = mask.ptr<uchar>(y);
-			for (int x = 0; x < converted.width(); ++x) {
-				const QRgb pixel = scan[x];
-				maskRow[x] = (qRed(pixel) == 255 && qGreen(pixel) == 0 && qBlue(pixel) == 255) ? 0 : 255;
-			}
+	}
+	qint64 memoryBytes = MemoryBudget::defaultBytes(); // Default: half of the physical memory
+	if (options.contains(QStringLiteral("memory-budget-mb"))) {
+		bool ok = false;
+		memoryBytes = options.value(QStringLiteral("memory-budget-mb")).toLongLong(&ok) << 20;
+		if (!ok || memoryBytes <= 0) {
+			cerr << "Invalid --memory-budget-mb value. Must be > 0." << endl;
+			return 1;
 		}
 	}
+	if (options.contains(QStringLiteral("threads"))) {
+		bool ok = false;
+		const int numThreads = options.value(QStringLiteral("threads")).toInt(&ok);
+		if (!ok || numThreads < 0) {
+			cerr << "Invalid --threads value. Must be >= 0." << endl;
+			return 1;
+		}
+		if (numThreads > 0)
+			cv::setNumThreads(numThreads);
+	}
 
-	if (sharp || featherRadius <= 1.0)
-		return mask;
-
-	// Distance transform from masked regions (magenta pixels)
-	cv::Mat distanceFromMask;
-	cv::distanceTransform(mask, distanceFromMask, cv::DIST_L2, 3);
-
-	// Distance transform from image borders
-	cv::Mat borderMask(mask.rows, mask.cols, CV_8UC1, cv::Scalar(255));
-	// Set border pixels to 0
-	borderMask.row(0).setTo(0);
-	borderMask.row(borderMask.rows - 1).setTo(0);
-	borderMask.col(0).setTo(0);
-	borderMask.col(borderMask.cols - 1).setTo(0);
-
-	cv::Mat distanceFromBorder;
-	cv::distanceTransform(borderMask, distanceFromBorder, cv::DIST_L2, 3);
+	ServiceContext service(memoryBytes);
+	cout << "Serving jobs from stdin: " << concurrency << " at once, memory budget " << (memoryBytes >> 20)
+	     << " MB, " << cv::getNumThreads() << " threads" << endl;
 
-	// Combine: minimum distance to either masked region or border
-	cv::Mat combinedDistance;
-	cv::min(distanceFromMask, distanceFromBorder, combinedDistance);
+	// Jobs report on stdout as "job N: ..." lines; their own logs may interleave
+	std::mutex mutex;
+	std::condition_variable queued;
+	std::deque<std::pair<int, QStringList>> queue;
+	bool inputDone = false;
+	int failed = 0;
+	std::vector<std::thread> workers;
+	for (int i = 0; i < concurrency; ++i) {
+		workers.emplace_back([&] {
+			for (;;) {
+				std::pair<int, QStringList> job;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					queued.wait(lock, [&] { return inputDone || !queue.empty(); });
+					if (queue.empty())
+						return;
+					job = std::move(queue.front());
+					queue.pop_front();
+				}
+				// A job that throws (cv::Exception, std::bad_alloc...) fails alone; the service goes on
+				int status = 1;
+				QString exception;
+				try {
+					status = runBlend(program, job.second, &service);
+				} catch (const std::exception &e) {
+					exception = QString::fromLocal8Bit(e.what()).trimmed();
+				} catch (...) {
+					exception = QStringLiteral("unknown exception");
+				}
+				std::lock_guard<std::mutex> lock(mutex);
+				if (status != 0)
+					++failed;
+				cout << "job " << job.first << ": " << (status == 0 ? "done" : "failed");
+				if (!exception.isEmpty())
+					cout << " (" << qPrintable(exception) << ")";
+				cout << endl;
+			}
+		});
+	}
 
-	// Normalize by feather radius
-	combinedDistance /= featherRadius;
-	cv::min(combinedDistance, 1.0, combinedDistance);
+	std::string line;
+	int nextId = 1;
+	while (std::getline(cin, line)) {
+		const QString command = QString::fromStdString(line).trimmed();
+		if (command.isEmpty() || command.startsWith(QLatin1Char('#')))
+			continue;
+		std::lock_guard<std::mutex> lock(mutex);
+		cout << "job " << nextId << ": queued" << endl;
+		queue.emplace_back(nextId++, QProcess::splitCommand(command));
+		queued.notify_one();
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		inputDone = true;
+	}
+	queued.notify_all();
+	for (std::thread &worker : workers)
+		worker.join();
+	return failed == 0 ? 0 : 1;
+}
 
-	// Convert to 8-bit mask
-	cv::Mat feathered;
-	combinedDistance.convertTo(feathered, CV_8UC1, 255.0);
+int main(int argc, char *argv[]) {
+	QStringList arguments;
+	for (int i = 1; i < argc; ++i)
+		arguments << QString::fromUtf8(argv[i]);
 
-	return feathered;
+	QStringList args;
+	QMap<QString, QString> options;
+	splitArguments(arguments, &args, &options);
+	if (options.contains(QStringLiteral("serve"))) {
+		if (!args.isEmpty()) {
+			printUsage(argv[0]);
+			return 1;
+		}
+		return runService(argv[0], options);
+	}
+	return runBlend(argv[0], arguments, nullptr);
 }
@@ -1,8 +1,16 @@
 #include "ortholoader.h"
 
+#include <QCryptographicHash>
+#include <QDateTime>
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRect>
+#include <QSaveFile>
 #include <QTextStream>
 #include <QStringList>
 #include <QXmlStreamReader>
@@ -10,11 +18,23 @@
 #include <QImageReader>
 
 #include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
 #include <opencv2/imgcodecs.hpp>
 
+#include <tiffio.h>
+
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <deque>
 #include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace {
 QStringList imageExtensions() {
@@ -22,20 +42,570 @@ QStringList imageExtensions() {
 	        QStringLiteral("TIF"), QStringLiteral("TIFF")};
 }
 
+// Decodes an image straight into a cv::Mat (libtiff for TIFF), in stored orientation
+cv::Mat readImage(const QString &path, int flags) {
+	return cv::imread(QFile::encodeName(path).toStdString(), flags | cv::IMREAD_IGNORE_ORIENTATION);
+}
+
+// Decodes only the strips or tiles of an 8-bit RGB(A) TIFF that cross region,
+// into a BGR image of the full size that is black elsewhere. Returns an empty
+// image for other layouts (palette, YCbCr, planar, 16-bit...); the caller then
+// decodes the whole image. bytesRead receives the compressed bytes read.
+cv::Mat readTiffRegion(const QString &path, const cv::Rect &region, qint64 *bytesRead) {
+	TIFF *tif = TIFFOpen(QFile::encodeName(path).constData(), "r");
+	if (!tif)
+		return cv::Mat();
+	std::unique_ptr<TIFF, void (*)(TIFF *)> closer(tif, TIFFClose);
+
+	uint32_t width = 0, height = 0;
+	uint16_t samples = 0, bits = 0, planar = 0, photometric = 0;
+	if (!TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width) || !TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &height) ||
+	    !TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &photometric))
+		return cv::Mat();
+	TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &samples);
+	TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &bits);
+	TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planar);
+	if (bits != 8 || (samples != 3 && samples != 4) || planar != PLANARCONFIG_CONTIG || photometric != PHOTOMETRIC_RGB)
+		return cv::Mat();
+
+	const cv::Rect image(0, 0, static_cast<int>(width), static_cast<int>(height));
+	const cv::Rect wanted = region & image;
+	cv::Mat bgr(image.size(), CV_8UC3, cv::Scalar::all(0));
+	const int fromTo[] = {0, 2, 1, 1, 2, 0};
+	qint64 bytes = 0;
+
+	// Blocks are the tiles of a tiled TIFF or full-width strips
+	uint32_t blockWidth = width, blockHeight = 0;
+	const bool tiled = TIFFIsTiled(tif);
+	if (tiled) {
+		TIFFGetField(tif, TIFFTAG_TILEWIDTH, &blockWidth);
+		TIFFGetField(tif, TIFFTAG_TILELENGTH, &blockHeight);
+	} else {
+		TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &blockHeight);
+		blockHeight = std::min(blockHeight, height);
+	}
+	if (blockWidth == 0 || blockHeight == 0)
+		return cv::Mat();
+	const tmsize_t blockSize = tiled ? TIFFTileSize(tif) : TIFFStripSize(tif);
+	if (blockSize <= 0)
+		return cv::Mat();
+	std::vector<uint8_t> buffer(static_cast<size_t>(blockSize));
+	uint64_t *byteCounts = nullptr;
+	TIFFGetField(tif, tiled ? TIFFTAG_TILEBYTECOUNTS : TIFFTAG_STRIPBYTECOUNTS, &byteCounts);
+
+	for (int y = wanted.y / int(blockHeight) * int(blockHeight); y < wanted.br().y; y += int(blockHeight)) {
+		for (int x = wanted.x / int(blockWidth) * int(blockWidth); x < wanted.br().x; x += int(blockWidth)) {
+			const uint32_t block = tiled ? TIFFComputeTile(tif, uint32_t(x), uint32_t(y), 0, 0)
+			                             : TIFFComputeStrip(tif, uint32_t(y), 0);
+			if ((tiled ? TIFFReadEncodedTile(tif, block, buffer.data(), blockSize)
+			           : TIFFReadEncodedStrip(tif, block, buffer.data(), blockSize)) < 0)
+				return cv::Mat();
+			if (byteCounts)
+				bytes += static_cast<qint64>(byteCounts[block]);
+
+			// Copy the part of the block inside the image (tiles may overhang it)
+			const cv::Rect blockRect = cv::Rect(x, y, int(blockWidth), int(blockHeight)) & image;
+			const cv::Mat rgb(int(blockHeight), int(blockWidth), CV_8UC(samples), buffer.data());
+			cv::Mat dst = bgr(blockRect);
+			cv::mixChannels(std::vector<cv::Mat>{rgb(cv::Rect(cv::Point(), blockRect.size()))}, std::vector<cv::Mat>{dst},
+			                fromTo, 3);
+		}
+	}
+	if (bytesRead)
+		*bytesRead = bytes;
+	return bgr;
+}
+
 constexpr double kRotationTolerance = 0;
 constexpr double kResolutionTolerance = 0;
 
 bool nearlyZero(double value, double tolerance) {
 	return std::abs(value) <= tolerance;
 }
+
+// Uniform grid of row bands over tile footprints. Each band lists, in tile
+// order, the tiles whose rectangle overlaps it, so a canvas row only has to
+// test the tiles that can actually cover it.
+class TileGrid {
+public:
+	explicit TileGrid(const QVector<OrthoLoader::Tile> &tiles) {
+		int minX = std::numeric_limits<int>::max();
+		int minY = std::numeric_limits<int>::max();
+		int maxX = std::numeric_limits<int>::min();
+		int maxY = std::numeric_limits<int>::min();
+		int minSide = std::numeric_limits<int>::max();
+		for (const OrthoLoader::Tile &tile : tiles) {
+			minX = std::min(minX, tile.x);
+			minY = std::min(minY, tile.y);
+			maxX = std::max(maxX, tile.x + tile.width);
+			maxY = std::max(maxY, tile.y + tile.height);
+			minSide = std::min(minSide, std::min(tile.width, tile.height));
+		}
+
+		// A few bands per tile side keeps the candidate lists close to the real overlap depth
+		bounds_ = cv::Rect(minX, minY, maxX - minX, maxY - minY);
+		originY_ = minY;
+		bandSize_ = std::max(32, minSide / 8);
+		bands_.resize((maxY - minY + bandSize_ - 1) / bandSize_);
+
+		for (int i = 0; i < tiles.size(); ++i) {
+			const OrthoLoader::Tile &tile = tiles[i];
+			const int r0 = (tile.y - originY_) / bandSize_;
+			const int r1 = (tile.y + tile.height - 1 - originY_) / bandSize_;
+			for (int r = r0; r <= r1; ++r)
+				bands_[r].push_back(i);
+		}
+	}
+
+	// Tiles overlapping the band that contains canvas row canvasY, in tile order
+	const std::vector<int> &row(int canvasY) const {
+		return bands_[(canvasY - originY_) / bandSize_];
+	}
+
+	// Canvas rectangle covered by the grid (union of all tile footprints)
+	cv::Rect bounds() const { return bounds_; }
+
+private:
+	int originY_ = 0;
+	int bandSize_ = 1;
+	cv::Rect bounds_;
+	std::vector<std::vector<int>> bands_;
+};
+
+// Background writer so cv::imwrite of finished masks overlaps with compute.
+// push() blocks while too many masks are queued, which caps memory when the
+// disk is slower than the workers.
+class AsyncMaskWriter {
+public:
+	explicit AsyncMaskWriter(size_t maxQueued = 8)
+	    : maxQueued_(maxQueued), thread_(&AsyncMaskWriter::run, this) {}
+
+	~AsyncMaskWriter() { finish(); }
+
+	void push(const std::string &path, const cv::Mat &mask) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		spaceAvailable_.wait(lock, [this] { return queue_.size() < maxQueued_; });
+		queue_.emplace_back(path, mask);
+		workAvailable_.notify_one();
+	}
+
+	// Waits for all queued writes; returns the first path that failed (empty on success)
+	std::string finish() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			done_ = true;
+			workAvailable_.notify_one();
+		}
+		if (thread_.joinable())
+			thread_.join();
+		return failedPath_;
+	}
+
+private:
+	void run() {
+		for (;;) {
+			std::pair<std::string, cv::Mat> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				workAvailable_.wait(lock, [this] { return done_ || !queue_.empty(); });
+				if (queue_.empty())
+					return;
+				job = std::move(queue_.front());
+				queue_.pop_front();
+				spaceAvailable_.notify_one();
+			}
+			if (!cv::imwrite(job.first, job.second) && failedPath_.empty())
+				failedPath_ = job.first;
+		}
+	}
+
+	const size_t maxQueued_;
+	std::mutex mutex_;
+	std::condition_variable workAvailable_;
+	std::condition_variable spaceAvailable_;
+	std::deque<std::pair<std::string, cv::Mat>> queue_;
+	bool done_ = false;
+	std::string failedPath_;
+	std::thread thread_;
+};
+
+// Canvas rows solved per membership block; bounds memory to a few rows of the canvas
+constexpr int kMembershipBlockRows = 256;
+
+QString voronoiMaskPath(const QString &imagePath) {
+	QFileInfo imageInfo(imagePath);
+	const QString maskFileName = imageInfo.completeBaseName() + QStringLiteral("_voronoi_mask.tif");
+	return imageInfo.absolutePath() + QDir::separator() + maskFileName;
+}
+
+// Manifest of the inputs each generated mask was built from, next to the tiles
+const QString kVoronoiManifestName = QStringLiteral("voronoi_masks.json");
+
+// Bump when the mask generation output changes, to invalidate existing masks
+constexpr int kVoronoiMaskVersion = 1;
+
+// Per TFW file name, the parsed record and image size of the last scan, next to the tiles
+const QString kTileMetadataName = QStringLiteral("tile_metadata.json");
+
+// Bump when the cached fields change
+constexpr int kTileMetadataVersion = 1;
+
+// Size and mtime identify an unchanged file without reading it
+QJsonObject fileStamp(const QFileInfo &info) {
+	QJsonObject stamp;
+	stamp.insert(QStringLiteral("name"), info.fileName());
+	stamp.insert(QStringLiteral("size"), QString::number(info.size()));
+	stamp.insert(QStringLiteral("mtime"), QString::number(info.lastModified().toMSecsSinceEpoch()));
+	return stamp;
+}
+
+// Hash of everything the Voronoi mask of tiles[tileIdx] depends on: the
+// margin, and the geometry and PC_ file of every tile overlapping it (itself
+// included), in tile order since ties go to the first tile
+QString voronoiMaskKey(const QVector<OrthoLoader::Tile> &tiles, int tileIdx, double overlapMargin) {
+	const OrthoLoader::Tile &tile = tiles.at(tileIdx);
+	const QRect footprint(tile.x, tile.y, tile.width, tile.height);
+
+	QString key = QStringLiteral("v%1 margin=%2\n").arg(kVoronoiMaskVersion).arg(overlapMargin, 0, 'g', 17);
+	for (const OrthoLoader::Tile &other : tiles) {
+		if (!footprint.intersects(QRect(other.x, other.y, other.width, other.height)))
+			continue;
+
+		// Offsets relative to the tile, so moving the canvas origin keeps the masks valid
+		key += QStringLiteral("%1 %2 %3 %4 %5").arg(other.name).arg(other.x - tile.x).arg(other.y - tile.y)
+		                                       .arg(other.width).arg(other.height);
+		const QFileInfo pcInfo(other.maskPath);
+		if (!other.maskPath.isEmpty() && pcInfo.exists())
+			key += QStringLiteral(" pc=%1 %2 %3").arg(pcInfo.fileName()).arg(pcInfo.size())
+			                                     .arg(pcInfo.lastModified().toMSecsSinceEpoch());
+		key += QLatin1Char('\n');
+	}
+	return QString::fromLatin1(QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex());
+}
+
+// Per tile name entries of a manifest (empty if unreadable or of another version)
+QJsonObject loadManifest(const QString &path, int version) {
+	QFile file(path);
+	if (!file.open(QIODevice::ReadOnly))
+		return QJsonObject();
+	const QJsonObject root = QJsonDocument::fromJson(file.readAll()).object();
+	if (root.value(QStringLiteral("version")).toInt() != version)
+		return QJsonObject();
+	return root.value(QStringLiteral("tiles")).toObject();
+}
+
+bool saveManifest(const QString &path, int version, const QJsonObject &tiles) {
+	QJsonObject root;
+	root.insert(QStringLiteral("version"), version);
+	root.insert(QStringLiteral("tiles"), tiles);
+
+	QSaveFile file(path);
+	if (!file.open(QIODevice::WriteOnly))
+		return false;
+	file.write(QJsonDocument(root).toJson());
+	return file.commit();
+}
+
+struct TileCenter {
+	double x;
+	double y;
+};
+
+// Valid (black, <= 128) pixels of a PC_ mask stored as runs of columns per row.
+// Masks are mostly large uniform areas, so this is far smaller than the image
+// and gives the exact columns where a tile starts or stops being a candidate.
+class ValidityRuns {
+public:
+	ValidityRuns() = default;
+
+	// An empty mask means the whole tile is valid
+	ValidityRuns(const cv::Mat &pcMask, int width, int height) {
+		if (pcMask.empty())
+			return;
+
+		rowOffsets_.reserve(height + 1);
+		for (int y = 0; y < height; ++y) {
+			rowOffsets_.push_back(static_cast<int>(runs_.size()));
+			const uchar *row = pcMask.ptr<uchar>(y);
+			int x = 0;
+			while (x < width) {
+				while (x < width && row[x] > 128)
+					++x;
+				const int begin = x;
+				while (x < width && row[x] <= 128)
+					++x;
+				if (x > begin)
+					runs_.emplace_back(begin, x);
+			}
+		}
+		rowOffsets_.push_back(static_cast<int>(runs_.size()));
+	}
+
+	// Valid runs [begin, end) of local row y
+	const cv::Vec2i *begin(int y) const {
+		return rowOffsets_.empty() ? &full_ : runs_.data() + rowOffsets_[y];
+	}
+	const cv::Vec2i *end(int y) const {
+		return rowOffsets_.empty() ? &full_ + 1 : runs_.data() + rowOffsets_[y + 1];
+	}
+
+	bool isValid(int x, int y) const {
+		const cv::Vec2i *first = begin(y);
+		const cv::Vec2i *last = end(y);
+		// First run starting after x; x is valid if the previous run contains it
+		const cv::Vec2i *next = std::upper_bound(first, last, x, [](int value, const cv::Vec2i &run) {
+			return value < run[0];
+		});
+		return next != first && x < (next - 1)->val[1];
+	}
+
+private:
+	cv::Vec2i full_{0, std::numeric_limits<int>::max()};
+	std::vector<int> rowOffsets_;
+	std::vector<cv::Vec2i> runs_;
+};
+
+// Nearest and second-nearest valid tile center for canvas pixels. State is
+// read-only once built, so rows can be solved concurrently.
+//
+// Along a row, the set of valid candidates only changes at tile edges and at
+// PC_ run boundaries, so rows are cut into intervals with a constant set.
+// Inside an interval, the distance to the frontier (d2 - d1) / 2 is
+// 1-Lipschitz: once it exceeds the saturation distance by k pixels, the next
+// k pixels keep the same owner and stay saturated, and are filled without
+// being evaluated. Intervals with a single candidate are filled outright.
+class MembershipSolver {
+public:
+	// Distances beyond saturationDistance are reported as std::numeric_limits<double>::max()
+	MembershipSolver(const QVector<OrthoLoader::Tile> &tiles, std::vector<ValidityRuns> validity,
+	                 double saturationDistance)
+	    : tiles_(tiles), grid_(tiles), saturation_(saturationDistance), validity_(std::move(validity)) {
+		centers_.reserve(tiles.size());
+		for (const OrthoLoader::Tile &tile : tiles)
+			centers_.push_back({tile.x + tile.width / 2.0, tile.y + tile.height / 2.0});
+	}
+
+	cv::Rect bounds() const { return grid_.bounds(); }
+	const ValidityRuns &validity(int tileIdx) const { return validity_[tileIdx]; }
+
+	// Solves canvas row canvasY over [region.x, region.x + region.width)
+	void solveRow(const cv::Rect &region, int canvasY, int *ownerRow, double *distanceRow) const {
+		const int regionEnd = region.x + region.width;
+		std::fill(ownerRow, ownerRow + region.width, -1);
+		std::fill(distanceRow, distanceRow + region.width, 0.0);
+
+		const cv::Rect bounds = grid_.bounds();
+		if (canvasY < bounds.y || canvasY >= bounds.y + bounds.height)
+			return;
+
+		// Tiles whose footprint crosses this row inside the region, in tile order
+		std::vector<int> rowTiles;
+		for (const int tileIdx : grid_.row(canvasY)) {
+			const OrthoLoader::Tile &tile = tiles_.at(tileIdx);
+			if (canvasY >= tile.y && canvasY < tile.y + tile.height &&
+			    tile.x < regionEnd && tile.x + tile.width > region.x)
+				rowTiles.push_back(tileIdx);
+		}
+		if (rowTiles.empty())
+			return;
+
+		// Columns where the set of valid candidates can change
+		std::vector<int> breaks = {region.x, regionEnd};
+		const auto addBreak = [&](int x) {
+			if (x > region.x && x < regionEnd)
+				breaks.push_back(x);
+		};
+		for (const int tileIdx : rowTiles) {
+			const OrthoLoader::Tile &tile = tiles_.at(tileIdx);
+			addBreak(tile.x);
+			addBreak(tile.x + tile.width);
+			const ValidityRuns &runs = validity_[tileIdx];
+			const int localY = canvasY - tile.y;
+			for (const cv::Vec2i *run = runs.begin(localY); run != runs.end(localY); ++run) {
+				addBreak(tile.x + run->val[0]);
+				addBreak(tile.x + std::min(run->val[1], tile.width));
+			}
+		}
+		std::sort(breaks.begin(), breaks.end());
+		breaks.erase(std::unique(breaks.begin(), breaks.end()), breaks.end());
+
+		std::vector<int> candidates;
+		for (size_t b = 0; b + 1 < breaks.size(); ++b) {
+			const int intervalBegin = breaks[b];
+			const int intervalEnd = breaks[b + 1];
+
+			// Valid candidates are constant over [intervalBegin, intervalEnd)
+			candidates.clear();
+			for (const int tileIdx : rowTiles) {
+				const OrthoLoader::Tile &tile = tiles_.at(tileIdx);
+				if (intervalBegin >= tile.x && intervalBegin < tile.x + tile.width &&
+				    validity_[tileIdx].isValid(intervalBegin - tile.x, canvasY - tile.y))
+					candidates.push_back(tileIdx);
+			}
+
+			if (candidates.empty())
+				continue;
+
+			if (candidates.size() == 1) {
+				// Single valid tile: full ownership, no frontier in range
+				std::fill(ownerRow + intervalBegin - region.x, ownerRow + intervalEnd - region.x, candidates.front());
+				std::fill(distanceRow + intervalBegin - region.x, distanceRow + intervalEnd - region.x,
+				          std::numeric_limits<double>::max());
+				continue;
+			}
+
+			int canvasX = intervalBegin;
+			while (canvasX < intervalEnd) {
+				// Find squared distances to the candidate tile centers (sqrt is only taken for the two winners)
+				double minDistSq = std::numeric_limits<double>::max();
+				double secondMinDistSq = std::numeric_limits<double>::max();
+				int closestIdx = -1;
+
+				for (const int candidate : candidates) {
+					const TileCenter &center = centers_[candidate];
+					const double dx = canvasX - center.x;
+					const double dy = canvasY - center.y;
+					const double distSq = dx * dx + dy * dy;
+
+					if (distSq < minDistSq) {
+						secondMinDistSq = minDistSq;
+						minDistSq = distSq;
+						closestIdx = candidate;
+					} else if (distSq < secondMinDistSq) {
+						secondMinDistSq = distSq;
+					}
+				}
+
+				// Distance from frontier: positive = towards our center, negative = towards other center
+				const double distToFrontier = (std::sqrt(secondMinDistSq) - std::sqrt(minDistSq)) / 2.0;
+				ownerRow[canvasX - region.x] = closestIdx;
+				distanceRow[canvasX - region.x] = distToFrontier;
+				++canvasX;
+
+				// Pixels at offset j < distToFrontier - saturation stay above the saturation distance
+				const double headroom = distToFrontier - saturation_;
+				if (headroom > 0.0) {
+					const double skip = std::min(static_cast<double>(intervalEnd - canvasX), std::floor(headroom - 1e-9));
+					const int skipEnd = canvasX + std::max(0, static_cast<int>(skip));
+					std::fill(ownerRow + canvasX - region.x, ownerRow + skipEnd - region.x, closestIdx);
+					std::fill(distanceRow + canvasX - region.x, distanceRow + skipEnd - region.x,
+					          std::numeric_limits<double>::max());
+					canvasX = skipEnd;
+				}
+			}
+		}
+	}
+
+private:
+	const QVector<OrthoLoader::Tile> &tiles_;
+	const TileGrid grid_;
+	const double saturation_;
+	const std::vector<ValidityRuns> validity_;
+	std::vector<TileCenter> centers_;
+};
+
+// Loads the PC_ mask of every tile, or of the needed ones only (in parallel), and
+// keeps only its valid runs. Tiles left out read as fully valid.
+bool loadValidityRuns(const QVector<OrthoLoader::Tile> &tiles, std::vector<ValidityRuns> *validity,
+                      QString *errorMessage, const std::vector<uchar> *needed = nullptr) {
+	validity->assign(tiles.size(), ValidityRuns());
+	std::vector<uchar> failed(tiles.size(), 0);
+
+	cv::parallel_for_(cv::Range(0, tiles.size()), [&](const cv::Range &range) {
+		for (int i = range.start; i < range.end; ++i) {
+			const OrthoLoader::Tile &tile = tiles.at(i);
+			if (needed && !(*needed)[i])
+				continue;
+
+			// No PC_ mask: all pixels are valid (all black = usable)
+			if (tile.maskPath.isEmpty() || !QFileInfo::exists(tile.maskPath))
+				continue;
+
+			const cv::Mat pcMask = cv::imread(tile.maskPath.toStdString(), cv::IMREAD_GRAYSCALE);
+			if (pcMask.empty() || pcMask.cols != tile.width || pcMask.rows != tile.height) {
+				failed[i] = 1;
+				continue;
+			}
+			(*validity)[i] = ValidityRuns(pcMask, tile.width, tile.height);
+		}
+	});
+
+	for (int i = 0; i < tiles.size(); ++i) {
+		if (failed[i]) {
+			if (errorMessage)
+				*errorMessage = QStringLiteral("Failed to load or invalid PC_ mask: %1").arg(tiles.at(i).maskPath);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Sweeps region in blocks of kMembershipBlockRows canvas rows, solving rows in parallel
+bool sweepMembership(const MembershipSolver &solver, const cv::Rect &region,
+                     const OrthoLoader::MembershipVisitor &visitor, QString *errorMessage) {
+	OrthoLoader::MembershipBlock block;
+	for (int blockY = region.y; blockY < region.y + region.height; blockY += kMembershipBlockRows) {
+		block.region = cv::Rect(region.x, blockY, region.width,
+		                        std::min(kMembershipBlockRows, region.y + region.height - blockY));
+		block.owner.create(block.region.height, block.region.width, CV_32SC1);
+		block.distance.create(block.region.height, block.region.width, CV_64FC1);
+
+		cv::parallel_for_(cv::Range(0, block.region.height), [&](const cv::Range &rows) {
+			for (int row = rows.start; row < rows.end; ++row)
+				solver.solveRow(block.region, block.region.y + row,
+				                block.owner.ptr<int>(row), block.distance.ptr<double>(row));
+		});
+
+		if (!visitor(block, errorMessage))
+			return false;
+	}
+	return true;
+}
+
+// Voronoi mask value of a pixel valid in the tile
+uchar voronoiMaskValue(bool weAreClosest, double distToFrontier, double overlapMargin) {
+	// Include pixels up to overlapMargin BEYOND the Voronoi frontier
+	// This means accepting pixels even when we're NOT the closest, if we're close enough
+
+	// Calculate how far we are from the frontier
+	// If we're closest: distToFrontier is positive (good)
+	// If we're not closest: we want to check if secondMinDist - ourDist < 2*overlapMargin
+	double distanceFromFrontier;
+	if (weAreClosest) {
+		distanceFromFrontier = distToFrontier;
+	} else {
+		// We're not closest, but we might still be within overlap range
+		distanceFromFrontier = -distToFrontier; // Invert
+	}
+
+	// Accept if within overlapMargin of frontier
+	if (distanceFromFrontier >= -overlapMargin) {
+		if (distanceFromFrontier >= overlapMargin) {
+			// Far from frontier: full ownership
+			return 255;
+		}
+		// Near frontier: gradient
+		// At frontier (dist=0): 255
+		// At -overlapMargin: 0
+		// At +overlapMargin: 255
+		const double ratio = (distanceFromFrontier + overlapMargin) / (2.0 * overlapMargin);
+		return static_cast<uchar>(ratio * 255.0);
+	}
+	// else: pixel too far, leave at 0
+	return 0;
+}
 }
 
 bool OrthoLoader::loadFromDirectory(const QString &directoryPath, QString *errorMessage) {
 	tiles_.clear();
+	directoryPath_.clear();
+	originX_ = 0.0;
+	originY_ = 0.0;
 	canvasSize_ = QSize();
 	pixelWidth_ = 0.0;
 	pixelHeight_ = 0.0;
 	hasReference_ = false;
+	cachedTileCount_ = 0;
 
 	if (directoryPath.isEmpty()) {
 		if (errorMessage)
@@ -66,61 +636,148 @@ bool OrthoLoader::loadFromDirectory(const QString &directoryPath, QString *error
 		pixelHeight_ = std::abs(referenceTfw_.scaleY);
 	}
 
-	const QStringList tfwFiles = dir.entryList({QStringLiteral("*.tfw"), QStringLiteral("*.TFW")}, QDir::Files | QDir::Readable);
+	// One listing of the directory: image and PC_ paths are resolved from it
+	// instead of probing candidate names one stat at a time, and the file
+	// stamps come from the size and mtime it already holds
+	const QFileInfoList entries = dir.entryInfoList(QDir::Files | QDir::Readable);
+	QSet<QString> fileNames;
+	QHash<QString, QJsonObject> fileStamps;
+	QStringList tfwFiles;
+	for (const QFileInfo &info : entries) {
+		const QString entry = info.fileName();
+		fileNames.insert(entry);
+		fileStamps.insert(entry, fileStamp(info));
+		// Skip the reference file
+		if (entry.endsWith(QStringLiteral(".tfw"), Qt::CaseInsensitive) && entry != QStringLiteral("Orthophotomosaic.tfw"))
+			tfwFiles.push_back(entry);
+	}
 	if (tfwFiles.isEmpty()) {
 		if (errorMessage)
 			*errorMessage = QStringLiteral("No TFW files found in %1").arg(directoryPath);
 		return false;
 	}
 
-	for (const QString &tfwFileName : tfwFiles) {
-		// Skip the reference file
-		if (tfwFileName == QStringLiteral("Orthophotomosaic.tfw"))
-			continue;
-		const QString tfwPath = dir.absoluteFilePath(tfwFileName);
+	struct ScannedTfw {
+		bool parsed = false;
 		TfwRecord record;
-		if (!parseTfw(tfwPath, &record, errorMessage))
+		QString imagePath;
+		QString maskPath;
+		QSize size;
+		QString error;      // parse error if !parsed, else image error
+		QJsonObject entry;  // metadata cache entry
+		bool cached = false;
+	};
+	std::vector<ScannedTfw> scanned(tfwFiles.size());
+
+	const QString metadataPath = dir.absoluteFilePath(kTileMetadataName);
+	const QJsonObject previous = loadManifest(metadataPath, kTileMetadataVersion);
+
+	// TFW parsing and image headers are independent per tile, so they are read in
+	// parallel; tiles whose TFW and image are unchanged skip both
+	cv::parallel_for_(cv::Range(0, tfwFiles.size()), [&](const cv::Range &range) {
+		for (int i = range.start; i < range.end; ++i) {
+			const QString &tfwFileName = tfwFiles.at(i);
+			ScannedTfw &scan = scanned[i];
+			scan.imagePath = resolveImagePath(dir, fileNames, tfwFileName);
+			if (!scan.imagePath.isEmpty())
+				scan.maskPath = resolveMaskPath(dir, fileNames, QFileInfo(scan.imagePath).fileName());
+
+			const QJsonObject tfwStamp = fileStamps.value(tfwFileName);
+			const QJsonObject imageStamp =
+			    scan.imagePath.isEmpty() ? QJsonObject() : fileStamps.value(QFileInfo(scan.imagePath).fileName());
+			const QJsonObject cachedEntry = previous.value(tfwFileName).toObject();
+			const QJsonArray cachedRecord = cachedEntry.value(QStringLiteral("record")).toArray();
+			if (cachedEntry.value(QStringLiteral("tfw")).toObject() == tfwStamp &&
+			    cachedEntry.value(QStringLiteral("image")).toObject() == imageStamp && cachedRecord.size() == 6 &&
+			    cachedEntry.value(QStringLiteral("width")).toInt() > 0 && cachedEntry.value(QStringLiteral("height")).toInt() > 0) {
+				scan.parsed = true;
+				scan.record.scaleX = cachedRecord.at(0).toDouble();
+				scan.record.rotationY = cachedRecord.at(1).toDouble();
+				scan.record.rotationX = cachedRecord.at(2).toDouble();
+				scan.record.scaleY = cachedRecord.at(3).toDouble();
+				scan.record.translateX = cachedRecord.at(4).toDouble();
+				scan.record.translateY = cachedRecord.at(5).toDouble();
+				scan.size = QSize(cachedEntry.value(QStringLiteral("width")).toInt(),
+				                  cachedEntry.value(QStringLiteral("height")).toInt());
+				scan.entry = cachedEntry;
+				scan.cached = true;
+				continue;
+			}
+
+			scan.parsed = parseTfw(dir.absoluteFilePath(tfwFileName), &scan.record, &scan.error);
+			if (!scan.parsed || scan.imagePath.isEmpty())
+				continue;
+
+			// Load image dimensions without loading full image
+			QImageReader reader(scan.imagePath);
+			if (!reader.canRead()) {
+				scan.error = QStringLiteral("Cannot read image dimensions from %1").arg(scan.imagePath);
+				continue;
+			}
+			scan.size = reader.size();
+			if (!scan.size.isValid() || scan.size.isEmpty()) {
+				scan.error = QStringLiteral("Invalid image dimensions in %1").arg(scan.imagePath);
+				continue;
+			}
+
+			scan.entry.insert(QStringLiteral("tfw"), tfwStamp);
+			scan.entry.insert(QStringLiteral("image"), imageStamp);
+			scan.entry.insert(QStringLiteral("record"), QJsonArray{scan.record.scaleX, scan.record.rotationY,
+			                                                      scan.record.rotationX, scan.record.scaleY,
+			                                                      scan.record.translateX, scan.record.translateY});
+			scan.entry.insert(QStringLiteral("width"), scan.size.width());
+			scan.entry.insert(QStringLiteral("height"), scan.size.height());
+		}
+	});
+
+	// Checks that depend on earlier tiles run in listing order, as a serial scan would
+	QJsonObject metadata;
+	for (int i = 0; i < tfwFiles.size(); ++i) {
+		const QString &tfwFileName = tfwFiles.at(i);
+		const ScannedTfw &scan = scanned[i];
+		if (!scan.parsed) {
+			if (errorMessage)
+				*errorMessage = scan.error;
 			return false;
+		}
 
-		if (!ensureRotationIsZero(record, tfwFileName, errorMessage))
+		if (!ensureRotationIsZero(scan.record, tfwFileName, errorMessage))
 			return false;
 
-		if (!ensureResolutionConsistency(record, tfwFileName, errorMessage))
+		if (!ensureResolutionConsistency(scan.record, tfwFileName, errorMessage))
 			return false;
 
-		const QString imagePath = resolveImagePath(dir, tfwFileName);
-		if (imagePath.isEmpty()) {
+		if (scan.imagePath.isEmpty()) {
 			// Skip TFW files without matching images (like Orthophotomosaic.tfw)
 			continue;
 		}
 
-		Tile tile;
-		tile.name = QFileInfo(imagePath).fileName();
-		tile.imagePath = imagePath;
-		tile.maskPath = resolveMaskPath(imagePath);
-		
-		// Load image dimensions without loading full image
-		QImageReader reader(imagePath);
-		if (!reader.canRead()) {
+		if (!scan.error.isEmpty()) {
 			if (errorMessage)
-				*errorMessage = QStringLiteral("Cannot read image dimensions from %1").arg(imagePath);
+				*errorMessage = scan.error;
 			return false;
 		}
-		QSize size = reader.size();
-		if (!size.isValid() || size.isEmpty()) {
-			if (errorMessage)
-				*errorMessage = QStringLiteral("Invalid image dimensions in %1").arg(imagePath);
-			return false;
-		}
-		tile.width = size.width();
-		tile.height = size.height();
-		
-		if (!computeTileOffset(record, &tile, tfwFileName, errorMessage))
+
+		Tile tile;
+		tile.name = QFileInfo(scan.imagePath).fileName();
+		tile.imagePath = scan.imagePath;
+		tile.maskPath = scan.maskPath;
+		tile.width = scan.size.width();
+		tile.height = scan.size.height();
+
+		if (!computeTileOffset(scan.record, &tile, tfwFileName, errorMessage))
 			return false;
 
 		tiles_.push_back(tile);
+		metadata.insert(tfwFileName, scan.entry);
+		if (scan.cached)
+			++cachedTileCount_;
 	}
 
+	// Best effort: a read-only tile directory just rescans next time
+	if (metadata != previous)
+		saveManifest(metadataPath, kTileMetadataVersion, metadata);
+
 	if (!finalizeTiles(errorMessage))
 		return false;
 
@@ -129,6 +786,8 @@ bool OrthoLoader::loadFromDirectory(const QString &directoryPath, QString *error
 		unloadTile(&tile);
 	}
 
+	directoryPath_ = dir.absolutePath();
+
 	return true;
 }
 
@@ -234,31 +893,26 @@ bool OrthoLoader::computeTileOffset(const TfwRecord &record, Tile *tile, const Q
 	return true;
 }
 
-QString OrthoLoader::resolveImagePath(const QDir &directory, const QString &tfwFile) const {
+QString OrthoLoader::resolveImagePath(const QDir &directory, const QSet<QString> &fileNames, const QString &tfwFile) const {
 	const QFileInfo tfwInfo(tfwFile);
 	const QString baseName = tfwInfo.completeBaseName();
 
 	for (const QString &extension : imageExtensions()) {
-		const QString candidate = directory.absoluteFilePath(baseName + QLatin1Char('.') + extension);
-		if (QFileInfo::exists(candidate))
-			return candidate;
+		const QString candidate = baseName + QLatin1Char('.') + extension;
+		if (fileNames.contains(candidate))
+			return directory.absoluteFilePath(candidate);
 	}
 
 	return QString();
 }
 
-QString OrthoLoader::resolveMaskPath(const QString &imagePath) const {
-	const QFileInfo imageInfo(imagePath);
-	const QString fileName = imageInfo.fileName();
-	const QString dirPath = imageInfo.absolutePath();
-	
+QString OrthoLoader::resolveMaskPath(const QDir &directory, const QSet<QString> &fileNames, const QString &imageFile) const {
 	// Try to find mask by replacing Ort_ with PC_
-	if (fileName.startsWith(QStringLiteral("Ort_"), Qt::CaseInsensitive)) {
-		QString maskFileName = fileName;
+	if (imageFile.startsWith(QStringLiteral("Ort_"), Qt::CaseInsensitive)) {
+		QString maskFileName = imageFile;
 		maskFileName.replace(0, 4, QStringLiteral("PC_"));
-		const QString maskPath = QDir(dirPath).absoluteFilePath(maskFileName);
-		if (QFileInfo::exists(maskPath))
-			return maskPath;
+		if (fileNames.contains(maskFileName))
+			return directory.absoluteFilePath(maskFileName);
 	}
 	
 	// No mask found - will use magenta detection fallback
@@ -278,23 +932,42 @@ bool OrthoLoader::loadTile(Tile *tile, QString *errorMessage) {
 		return false;
 	}
 
-	// Load image
-	QImage image(tile->imagePath);
-	if (image.isNull()) {
+	// Decode straight to 8-bit BGR; alpha is dropped and EXIF orientation ignored, as with QImage
+	tile->image = readImage(tile->imagePath, cv::IMREAD_COLOR);
+	if (tile->image.empty()) {
 		if (errorMessage)
 			*errorMessage = QStringLiteral("Failed to load image %1").arg(tile->imagePath);
 		return false;
 	}
-	tile->image = image.convertToFormat(QImage::Format_ARGB32);
 
 	return true;
 }
 
+bool OrthoLoader::loadTileRegion(Tile *tile, const cv::Rect &region, qint64 *bytesRead, QString *errorMessage) {
+	if (!tile) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Invalid tile pointer");
+		return false;
+	}
+
+	const QString suffix = QFileInfo(tile->imagePath).suffix().toLower();
+	if (suffix == QStringLiteral("tif") || suffix == QStringLiteral("tiff")) {
+		tile->image = readTiffRegion(tile->imagePath, region, bytesRead);
+		if (!tile->image.empty())
+			return true;
+	}
+
+	// Unsupported layout: decode everything
+	if (bytesRead)
+		*bytesRead = QFileInfo(tile->imagePath).size();
+	return loadTile(tile, errorMessage);
+}
+
 void OrthoLoader::unloadTile(Tile *tile) {
 	if (!tile)
 		return;
 	
-	tile->image = QImage();
+	tile->image.release();
 }
 
 bool OrthoLoader::loadMask(Tile *tile, QString *errorMessage) {
@@ -306,20 +979,16 @@ bool OrthoLoader::loadMask(Tile *tile, QString *errorMessage) {
 
 	// Try to load generated Voronoi mask first
 	if (!tile->generatedMaskPath.isEmpty() && QFileInfo::exists(tile->generatedMaskPath)) {
-		QImage mask(tile->generatedMaskPath);
-		if (!mask.isNull()) {
-			tile->mask = mask.convertToFormat(QImage::Format_ARGB32);
+		tile->mask = readImage(tile->generatedMaskPath, cv::IMREAD_GRAYSCALE);
+		if (!tile->mask.empty())
 			return true;
-		}
 	}
 
 	// Fallback: load PC_ mask if available
 	if (!tile->maskPath.isEmpty() && QFileInfo::exists(tile->maskPath)) {
-		QImage mask(tile->maskPath);
-		if (!mask.isNull()) {
-			tile->mask = mask.convertToFormat(QImage::Format_ARGB32);
+		tile->mask = readImage(tile->maskPath, cv::IMREAD_GRAYSCALE);
+		if (!tile->mask.empty())
 			return true;
-		}
 	}
 
 	// No mask available
@@ -335,11 +1004,9 @@ bool OrthoLoader::loadPCMask(Tile *tile, QString *errorMessage) {
 
 	// Load only PC_ mask (ignore Voronoi)
 	if (!tile->maskPath.isEmpty() && QFileInfo::exists(tile->maskPath)) {
-		QImage mask(tile->maskPath);
-		if (!mask.isNull()) {
-			tile->mask = mask.convertToFormat(QImage::Format_ARGB32);
+		tile->mask = readImage(tile->maskPath, cv::IMREAD_GRAYSCALE);
+		if (!tile->mask.empty())
 			return true;
-		}
 	}
 
 	// No PC_ mask available
@@ -350,7 +1017,7 @@ void OrthoLoader::unloadMask(Tile *tile) {
 	if (!tile)
 		return;
 	
-	tile->mask = QImage();
+	tile->mask.release();
 }
 
 bool OrthoLoader::parseMTDOrtho(const QString &filePath, QSize *canvasSize, QString *errorMessage) const {
@@ -399,175 +1066,239 @@ bool OrthoLoader::parseMTDOrtho(const QString &filePath, QSize *canvasSize, QStr
 	return false;
 }
 
-bool OrthoLoader::generateVoronoiMasks(double overlapMargin, QString *errorMessage) {
+bool OrthoLoader::computeMembership(const cv::Rect &region, double saturationDistance,
+                                    const MembershipVisitor &visitor, QString *errorMessage) {
 	if (tiles_.isEmpty()) {
 		if (errorMessage)
 			*errorMessage = QStringLiteral("No tiles loaded.");
 		return false;
 	}
 
-	if (overlapMargin < 0.0) {
+	std::vector<ValidityRuns> validity;
+	if (!loadValidityRuns(tiles_, &validity, errorMessage))
+		return false;
+
+	const MembershipSolver solver(tiles_, std::move(validity), saturationDistance);
+	return sweepMembership(solver, region, visitor, errorMessage);
+}
+
+bool OrthoLoader::saveMembershipMap(const QString &path, QString *errorMessage) {
+	if (tiles_.size() >= std::numeric_limits<ushort>::max()) {
 		if (errorMessage)
-			*errorMessage = QStringLiteral("Invalid overlap margin: must be >= 0.");
+			*errorMessage = QStringLiteral("Too many tiles for a 16-bit membership map.");
 		return false;
 	}
 
-	// Load PC_ masks for all tiles
-	QVector<cv::Mat> pcMasks;
-	pcMasks.reserve(tiles_.size());
-	
-	for (int i = 0; i < tiles_.size(); ++i) {
-		Tile &tile = tiles_[i];
-		cv::Mat pcMask;
-		
-		// Load PC_ mask if available
-		if (!tile.maskPath.isEmpty() && QFileInfo::exists(tile.maskPath)) {
-			pcMask = cv::imread(tile.maskPath.toStdString(), cv::IMREAD_GRAYSCALE);
-			if (pcMask.empty() || pcMask.cols != tile.width || pcMask.rows != tile.height) {
-				if (errorMessage)
-					*errorMessage = QStringLiteral("Failed to load or invalid PC_ mask: %1").arg(tile.maskPath);
-				return false;
-			}
-		} else {
-			// No PC_ mask: all pixels are valid (all black = usable)
-			pcMask = cv::Mat(tile.height, tile.width, CV_8UC1, cv::Scalar(0));
-		}
-		
-		pcMasks.push_back(pcMask);
-	}
+	// Label = tile index + 1, 0 where no tile has a valid pixel
+	cv::Mat labels(canvasSize_.height(), canvasSize_.width(), CV_16UC1, cv::Scalar(0));
+	const cv::Rect canvas(0, 0, canvasSize_.width(), canvasSize_.height());
+	// Only owners are needed: saturate every distance
+	const bool ok = computeMembership(canvas, 0.0, [&](const MembershipBlock &block, QString *) {
+		cv::Mat rows = labels(cv::Rect(0, block.region.y, block.region.width, block.region.height));
+		block.owner.convertTo(rows, CV_16U, 1.0, 1.0);
+		return true;
+	}, errorMessage);
+	if (!ok)
+		return false;
 
-	// Precompute tile centers in canvas coordinates
-	struct TileCenter {
-		double x;
-		double y;
-		int index;
-	};
-	QVector<TileCenter> centers;
-	centers.reserve(tiles_.size());
-	
-	for (int i = 0; i < tiles_.size(); ++i) {
-		const Tile &tile = tiles_[i];
-		TileCenter center;
-		center.x = tile.x + tile.width / 2.0;
-		center.y = tile.y + tile.height / 2.0;
-		center.index = i;
-		centers.push_back(center);
+	if (!cv::imwrite(path.toStdString(), labels)) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Failed to save membership map: %1").arg(path);
+		return false;
 	}
+	return true;
+}
 
-	// Generate mask for each tile
+int OrthoLoader::staleVoronoiMaskCount(double overlapMargin) const {
+	QJsonObject manifest;
+	return static_cast<int>(staleVoronoiMasks(overlapMargin, &manifest).size());
+}
+
+// Tiles whose mask is missing or was written for other inputs; manifest gets the current keys
+std::vector<int> OrthoLoader::staleVoronoiMasks(double overlapMargin, QJsonObject *manifest) const {
+	const QJsonObject previous = loadManifest(QDir(directoryPath_).absoluteFilePath(kVoronoiManifestName), kVoronoiMaskVersion);
+	std::vector<int> dirty;
 	for (int tileIdx = 0; tileIdx < tiles_.size(); ++tileIdx) {
-		Tile &tile = tiles_[tileIdx];
-		const cv::Mat &currentPcMask = pcMasks[tileIdx];
+		const Tile &tile = tiles_[tileIdx];
+		const QString key = voronoiMaskKey(tiles_, tileIdx, overlapMargin);
+		manifest->insert(tile.name, key);
+		if (previous.value(tile.name).toString() != key || !QFileInfo::exists(voronoiMaskPath(tile.imagePath)))
+			dirty.push_back(tileIdx);
+	}
+	return dirty;
+}
 
-		// Create mask with same size as tile
-		cv::Mat voronoiMask(tile.height, tile.width, CV_8UC1, cv::Scalar(0));
+bool OrthoLoader::generateVoronoiMasks(double overlapMargin, QString *errorMessage) {
+	if (tiles_.isEmpty()) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("No tiles loaded.");
+		return false;
+	}
 
-		// For each pixel in the tile
-		for (int localY = 0; localY < tile.height; ++localY) {
-			uchar *maskRow = voronoiMask.ptr<uchar>(localY);
-			const uchar *pcMaskRow = currentPcMask.ptr<uchar>(localY);
-			
-			for (int localX = 0; localX < tile.width; ++localX) {
-				// Check if pixel is valid in PC_ mask (black = valid, white = masked)
-				if (pcMaskRow[localX] > 128) {
-					// Pixel is masked in PC_ (white), skip it
-					maskRow[localX] = 0;
-					continue;
-				}
-				
-				// Canvas coordinates
-				const double canvasX = tile.x + localX;
-				const double canvasY = tile.y + localY;
-
-				// Find distances to all tile centers, considering only valid pixels in their PC_ masks
-				double minDist = std::numeric_limits<double>::max();
-				double secondMinDist = std::numeric_limits<double>::max();
-				int closestIdx = -1;
+	if (overlapMargin < 0.0) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Invalid overlap margin: must be >= 0.");
+		return false;
+	}
 
-				for (const TileCenter &center : centers) {
-					// Check if this canvas pixel falls within the other tile's bounds
-					const Tile &otherTile = tiles_[center.index];
-					const int otherLocalX = static_cast<int>(canvasX - otherTile.x);
-					const int otherLocalY = static_cast<int>(canvasY - otherTile.y);
-					
-					// Skip if pixel is outside other tile's bounds
-					if (otherLocalX < 0 || otherLocalX >= otherTile.width ||
-					    otherLocalY < 0 || otherLocalY >= otherTile.height) {
-						continue;
-					}
-					
-					// Check if pixel is valid in other tile's PC_ mask
-					const cv::Mat &otherPcMask = pcMasks[center.index];
-					if (otherPcMask.at<uchar>(otherLocalY, otherLocalX) > 128) {
-						// Pixel is masked (white) in other tile, skip this tile
-						continue;
-					}
-					
-					// Calculate distance to center
-					const double dx = canvasX - center.x;
-					const double dy = canvasY - center.y;
-					const double dist = std::sqrt(dx * dx + dy * dy);
-
-					if (dist < minDist) {
-						secondMinDist = minDist;
-						minDist = dist;
-						closestIdx = center.index;
-					} else if (dist < secondMinDist) {
-						secondMinDist = dist;
-					}
+	// Only tiles whose inputs changed since their mask was written are regenerated
+	const QString manifestPath = QDir(directoryPath_).absoluteFilePath(kVoronoiManifestName);
+	QJsonObject manifest;
+	const std::vector<int> dirty = staleVoronoiMasks(overlapMargin, &manifest);
+	regeneratedMaskCount_ = static_cast<int>(dirty.size());
+
+	if (!dirty.empty()) {
+		// Sweeps over a few stale footprints only reach the tiles overlapping
+		// them: the PC_ masks of the others are left undecoded
+		std::vector<uchar> needed;
+		if (dirty.size() != static_cast<size_t>(tiles_.size())) {
+			needed.assign(tiles_.size(), 0);
+			for (const int tileIdx : dirty) {
+				const Tile &tile = tiles_[tileIdx];
+				const cv::Rect footprint(tile.x, tile.y, tile.width, tile.height);
+				for (int other = 0; other < tiles_.size(); ++other) {
+					const Tile &neighbour = tiles_[other];
+					if (!(cv::Rect(neighbour.x, neighbour.y, neighbour.width, neighbour.height) & footprint).empty())
+						needed[other] = 1;
 				}
+			}
+		}
+		std::vector<ValidityRuns> validity;
+		if (!loadValidityRuns(tiles_, &validity, errorMessage, needed.empty() ? nullptr : &needed))
+			return false;
 
-				// Distance from frontier: positive = towards our center, negative = towards other center
-				const double distToFrontier = (secondMinDist - minDist) / 2.0;
-				
-				// Include pixels up to overlapMargin BEYOND the Voronoi frontier
-				// This means accepting pixels even when we're NOT the closest, if we're close enough
-				const bool weAreClosest = (closestIdx == tileIdx);
-				
-				// Calculate how far we are from the frontier
-				// If we're closest: distToFrontier is positive (good)
-				// If we're not closest: we want to check if secondMinDist - ourDist < 2*overlapMargin
-				double distanceFromFrontier;
-				if (weAreClosest) {
-					distanceFromFrontier = distToFrontier;
-				} else {
-					// We're not closest, but we might still be within overlap range
-					distanceFromFrontier = -distToFrontier; // Invert
+		// Membership is solved once per canvas pixel over the union of the tiles,
+		// then every tile slices its mask out of the shared blocks. Distances only
+		// matter within overlapMargin of a frontier.
+		const MembershipSolver solver(tiles_, std::move(validity), overlapMargin);
+
+		// A few stale tiles are solved over their own footprint only
+		std::vector<std::pair<cv::Rect, std::vector<int>>> sweeps;
+		if (dirty.size() == static_cast<size_t>(tiles_.size())) {
+			sweeps.emplace_back(solver.bounds(), dirty);
+		} else {
+			for (const int tileIdx : dirty) {
+				const Tile &tile = tiles_[tileIdx];
+				sweeps.emplace_back(cv::Rect(tile.x, tile.y, tile.width, tile.height), std::vector<int>{tileIdx});
+			}
+		}
+
+		std::vector<cv::Mat> voronoiMasks(tiles_.size());
+		AsyncMaskWriter writer;
+
+		bool ok = true;
+		for (const auto &sweep : sweeps) {
+			const std::vector<int> &targets = sweep.second;
+			ok = sweepMembership(solver, sweep.first, [&](const MembershipBlock &block, QString *) {
+				const int blockTop = block.region.y;
+				const int blockBottom = block.region.y + block.region.height;
+
+				std::vector<int> crossing;
+				for (const int tileIdx : targets) {
+					const Tile &tile = tiles_[tileIdx];
+					if (tile.y < blockBottom && tile.y + tile.height > blockTop)
+						crossing.push_back(tileIdx);
 				}
-				
-				// Accept if within overlapMargin of frontier
-				if (distanceFromFrontier >= -overlapMargin) {
-					if (distanceFromFrontier >= overlapMargin) {
-						// Far from frontier: full ownership
-						maskRow[localX] = 255;
-					} else {
-						// Near frontier: gradient
-						// At frontier (dist=0): 255
-						// At -overlapMargin: 0
-						// At +overlapMargin: 255
-						const double ratio = (distanceFromFrontier + overlapMargin) / (2.0 * overlapMargin);
-						maskRow[localX] = static_cast<uchar>(ratio * 255.0);
+
+				cv::parallel_for_(cv::Range(0, static_cast<int>(crossing.size())), [&](const cv::Range &range) {
+					for (int k = range.start; k < range.end; ++k) {
+						const int tileIdx = crossing[k];
+						const Tile &tile = tiles_.at(tileIdx);
+
+						// Create mask with same size as tile
+						cv::Mat &voronoiMask = voronoiMasks[tileIdx];
+						if (voronoiMask.empty())
+							voronoiMask = cv::Mat(tile.height, tile.width, CV_8UC1, cv::Scalar(0));
+
+						const int canvasBegin = std::max(tile.y, blockTop);
+						const int canvasEnd = std::min(tile.y + tile.height, blockBottom);
+						const ValidityRuns &runs = solver.validity(tileIdx);
+						for (int canvasY = canvasBegin; canvasY < canvasEnd; ++canvasY) {
+							const int localY = canvasY - tile.y;
+							uchar *maskRow = voronoiMask.ptr<uchar>(localY);
+							const int *ownerRow = block.owner.ptr<int>(canvasY - blockTop) + (tile.x - block.region.x);
+							const double *distanceRow = block.distance.ptr<double>(canvasY - blockTop) + (tile.x - block.region.x);
+
+							// Pixels masked in PC_ (white) stay at 0: only the valid runs are filled
+							for (const cv::Vec2i *run = runs.begin(localY); run != runs.end(localY); ++run) {
+								const int runEnd = std::min(run->val[1], tile.width);
+								for (int localX = run->val[0]; localX < runEnd; ++localX)
+									maskRow[localX] = voronoiMaskValue(ownerRow[localX] == tileIdx, distanceRow[localX], overlapMargin);
+							}
+						}
+
+						// Tile fully covered: queue the mask for saving and release our copy
+						if (tile.y + tile.height <= blockBottom) {
+							writer.push(voronoiMaskPath(tile.imagePath).toStdString(), voronoiMask);
+							voronoiMask.release();
+						}
 					}
-				}
-				// else: pixel too far, leave at 0
-			}
+				});
+				return true;
+			}, errorMessage);
+			if (!ok)
+				break;
 		}
 
-		// Save the mask
-		QFileInfo imageInfo(tile.imagePath);
-		const QString baseName = imageInfo.completeBaseName();
-		const QString maskFileName = baseName + QStringLiteral("_voronoi_mask.tif");
-		const QString maskPath = imageInfo.absolutePath() + QDir::separator() + maskFileName;
+		const std::string failedPath = writer.finish();
+		if (!ok)
+			return false;
+		if (!failedPath.empty()) {
+			if (errorMessage)
+				*errorMessage = QStringLiteral("Failed to save Voronoi mask: %1").arg(QString::fromStdString(failedPath));
+			return false;
+		}
 
-		if (!cv::imwrite(maskPath.toStdString(), voronoiMask)) {
+		if (!saveManifest(manifestPath, kVoronoiMaskVersion, manifest)) {
 			if (errorMessage)
-				*errorMessage = QStringLiteral("Failed to save Voronoi mask: %1").arg(maskPath);
+				*errorMessage = QStringLiteral("Failed to save Voronoi mask manifest: %1").arg(manifestPath);
 			return false;
 		}
+	}
+
+	for (Tile &tile : tiles_)
+		tile.generatedMaskPath = voronoiMaskPath(tile.imagePath);
+
+	return true;
+}
+
+QVector<int> OrthoLoader::tilesNear(const cv::Rect &region, int margin) const {
+	QVector<int> indices;
+	for (int i = 0; i < tiles_.size(); ++i) {
+		const Tile &tile = tiles_.at(i);
+		const cv::Rect grown(tile.x - margin, tile.y - margin, tile.width + 2 * margin, tile.height + 2 * margin);
+		if (!(grown & region).empty())
+			indices.push_back(i);
+	}
+	return indices;
+}
+
+bool OrthoLoader::writeWorldFile(const QString &imagePath, QString *errorMessage) const {
+	const QFileInfo imageInfo(imagePath);
+	const QString tfwPath = imageInfo.absolutePath() + QDir::separator() + imageInfo.completeBaseName() + QStringLiteral(".tfw");
 
-		tile.generatedMaskPath = maskPath;
+	QFile file(tfwPath);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate)) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Unable to write %1").arg(tfwPath);
+		return false;
 	}
 
+	QTextStream stream(&file);
+	stream.setRealNumberPrecision(15);
+	stream << pixelWidth_ << '\n'
+	       << 0.0 << '\n'
+	       << 0.0 << '\n'
+	       << -pixelHeight_ << '\n'
+	       << originX_ << '\n'
+	       << originY_ << '\n';
+	stream.flush();
+
+	if (stream.status() != QTextStream::Ok) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Unable to write %1").arg(tfwPath);
+		return false;
+	}
 	return true;
 }
 
@@ -597,6 +1328,8 @@ bool OrthoLoader::finalizeTiles(QString *errorMessage) {
 			tile.x -= refX;
 			tile.y -= refY;
 		}
+		originX_ = referenceTfw_.translateX;
+		originY_ = referenceTfw_.translateY;
 
 		// Use full canvas size from MTDOrtho.xml for correct georeferencing
 		if (referenceCanvasSize_.isValid() && !referenceCanvasSize_.isEmpty()) {
@@ -620,6 +1353,8 @@ bool OrthoLoader::finalizeTiles(QString *errorMessage) {
 				tile.x -= minX;
 				tile.y -= minY;
 			}
+			originX_ += minX * pixelWidth_;
+			originY_ -= minY * pixelHeight_;
 
 			canvasSize_ = QSize(maxX - minX, maxY - minY);
 		}
@@ -632,6 +1367,9 @@ bool OrthoLoader::finalizeTiles(QString *errorMessage) {
 			minY = std::min(minY, tile.y);
 		}
 
+		originX_ = minX * pixelWidth_;
+		originY_ = -minY * pixelHeight_;
+
 		int canvasWidth = 0;
 		int canvasHeight = 0;
 		for (Tile &tile : tiles_) {
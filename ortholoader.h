@@ -1,13 +1,19 @@
 #ifndef ORTHOLOADER_H
 #define ORTHOLOADER_H
 
-#include <QImage>
+#include <QSet>
 #include <QSize>
 #include <QVector>
 
 #include <QString>
 
+#include <opencv2/core.hpp>
+
+#include <functional>
+#include <vector>
+
 class QDir;
+class QJsonObject;
 
 class OrthoLoader {
 public:
@@ -16,18 +22,43 @@ public:
 		QString imagePath;  // Path to the image file
 		QString maskPath;   // Path to the mask file (if exists)
 		QString generatedMaskPath; // Path to generated Voronoi mask (if exists)
-		QImage image;       // Loaded image (empty when unloaded)
-		QImage mask;        // Loaded mask (empty when unloaded)
+		cv::Mat image;      // Loaded image, BGR CV_8UC3 (empty when unloaded)
+		cv::Mat mask;       // Loaded mask, CV_8UC1 gray (empty when unloaded)
 		int x = 0; // offset in pixels from composite origin along X
 		int y = 0; // offset in pixels from composite origin along Y
 		int width = 0;  // width in pixels
 		int height = 0; // height in pixels
 	};
 
+	// Canvas-wide Voronoi membership over a horizontal block of canvas rows
+	struct MembershipBlock {
+		cv::Rect region;   // canvas rectangle covered by the block
+		cv::Mat owner;     // CV_32S index into tiles(), -1 where no tile has a valid pixel
+		cv::Mat distance;  // CV_64F distance to the Voronoi frontier (max() when saturated or a single tile is valid)
+	};
+	using MembershipVisitor = std::function<bool(const MembershipBlock &block, QString *errorMessage)>;
+
+	// TFWs and image sizes are scanned in parallel; unchanged tiles come from tile_metadata.json
 	bool loadFromDirectory(const QString &directoryPath, QString *errorMessage = nullptr);
+	// Number of tiles the last loadFromDirectory() call took from the metadata cache
+	int cachedTileCount() const { return cachedTileCount_; }
+	// Masks whose inputs are unchanged since the last run (see voronoi_masks.json) are reused
 	bool generateVoronoiMasks(double overlapMargin = 20.0, QString *errorMessage = nullptr);
+	// Number of masks rewritten by the last generateVoronoiMasks() call
+	int regeneratedMaskCount() const { return regeneratedMaskCount_; }
+	// Number of masks generateVoronoiMasks() would rewrite; reads the manifest only
+	int staleVoronoiMaskCount(double overlapMargin) const;
+	// Solves membership once per canvas pixel of region, block by block, and hands each block to visitor.
+	// Distances beyond saturationDistance are not evaluated and reported as std::numeric_limits<double>::max().
+	bool computeMembership(const cv::Rect &region, double saturationDistance, const MembershipVisitor &visitor,
+	                       QString *errorMessage = nullptr);
+	// Saves the canvas ownership as a 16-bit label image (tile index + 1, 0 = no owner)
+	bool saveMembershipMap(const QString &path, QString *errorMessage = nullptr);
 	
 	bool loadTile(Tile *tile, QString *errorMessage = nullptr);
+	// Decodes only the pixels of region (tile coordinates) when the TIFF layout allows it,
+	// leaving the others black; otherwise decodes the whole image like loadTile()
+	bool loadTileRegion(Tile *tile, const cv::Rect &region, qint64 *bytesRead, QString *errorMessage = nullptr);
 	void unloadTile(Tile *tile);
 	bool loadMask(Tile *tile, QString *errorMessage = nullptr);
 	bool loadPCMask(Tile *tile, QString *errorMessage = nullptr);
@@ -39,6 +70,11 @@ public:
 	QSize canvasSize() const { return canvasSize_; }
 	double pixelWidth() const { return pixelWidth_; }
 	double pixelHeight() const { return pixelHeight_; }
+	// Indices of the tiles whose footprint grown by margin pixels intersects region (canvas pixels)
+	QVector<int> tilesNear(const cv::Rect &region, int margin) const;
+
+	// Writes <imagePath base>.tfw georeferencing an image of the whole canvas
+	bool writeWorldFile(const QString &imagePath, QString *errorMessage = nullptr) const;
 
 
 private:
@@ -56,12 +92,18 @@ private:
 	bool ensureRotationIsZero(const TfwRecord &record, const QString &tfwFile, QString *errorMessage) const;
 	bool ensureResolutionConsistency(const TfwRecord &record, const QString &tfwFile, QString *errorMessage);
 	bool computeTileOffset(const TfwRecord &record, Tile *tile, const QString &tfwFile, QString *errorMessage) const;
-	QString resolveImagePath(const QDir &directory, const QString &tfwFile) const;
-	QString resolveMaskPath(const QString &imagePath) const;
+	QString resolveImagePath(const QDir &directory, const QSet<QString> &fileNames, const QString &tfwFile) const;
+	QString resolveMaskPath(const QDir &directory, const QSet<QString> &fileNames, const QString &imageFile) const;
 	bool finalizeTiles(QString *errorMessage);
+	std::vector<int> staleVoronoiMasks(double overlapMargin, QJsonObject *manifest) const;
 
 	QVector<Tile> tiles_;
+	QString directoryPath_;
+	int regeneratedMaskCount_ = 0;
+	int cachedTileCount_ = 0;
 	QSize canvasSize_;
+	double originX_ = 0.0; // world coordinates of the canvas origin, as in a TFW
+	double originY_ = 0.0;
 	double pixelWidth_ = 0.0;
 	double pixelHeight_ = 0.0;
 	TfwRecord referenceTfw_;
@@ -0,0 +1,54 @@
+#include "pyramidpool.h"
+
+#include <iterator>
+
+PyramidPool::PyramidPool(size_t max_bytes)
+    : max_bytes_(max_bytes) {
+}
+
+cv::UMat PyramidPool::take(cv::Size size, int type) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Most recently returned first: the likeliest to still be in cache
+        for (auto it = free_.rbegin(); it != free_.rend(); ++it) {
+            if (it->size() == size && it->type() == type) {
+                cv::UMat mat = *it;
+                free_bytes_ -= mat.total() * mat.elemSize();
+                free_.erase(std::next(it).base());
+                return mat;
+            }
+        }
+    }
+    return cv::UMat(size, type);
+}
+
+void PyramidPool::give(cv::UMat &mat) {
+    // urefcount counts UMat headers, refcount mapped Mat headers
+    const bool reusable = !mat.empty() && !mat.isSubmatrix() && mat.u &&
+                          mat.u->urefcount == 1 && mat.u->refcount == 0;
+    if (!reusable) {
+        mat.release();
+        return;
+    }
+
+    const size_t bytes = mat.total() * mat.elemSize();
+    if (bytes > max_bytes_) {
+        mat.release();
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(mat);
+    free_bytes_ += bytes;
+    mat.release();
+    while (free_bytes_ > max_bytes_) {
+        free_bytes_ -= free_.front().total() * free_.front().elemSize();
+        free_.pop_front();
+    }
+}
+
+void PyramidPool::give(std::vector<cv::UMat> &mats) {
+    for (cv::UMat &mat : mats)
+        give(mat);
+    mats.clear();
+}
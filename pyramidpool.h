@@ -0,0 +1,50 @@
+#ifndef PYRAMIDPOOL_H
+#define PYRAMIDPOOL_H
+
+#include <opencv2/core.hpp>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief Thread-safe pool of matrices recycled by size and type
+ *
+ * Tiles of a block mostly have the same size, so their source pyramids need
+ * the same matrices at every level. Taking them from the pool replaces one
+ * allocation (and its page faults) per matrix per tile with a lookup.
+ */
+class PyramidPool {
+public:
+    /**
+     * @brief Constructor
+     * @param max_bytes Free matrices kept at most; the oldest are dropped first
+     */
+    explicit PyramidPool(size_t max_bytes = kDefaultMaxBytes);
+
+    /**
+     * @brief A matrix of the given size and type, with undefined contents
+     */
+    cv::UMat take(cv::Size size, int type);
+
+    /**
+     * @brief Returns a matrix to the pool and releases it
+     *
+     * Only whole matrices no one else refers to are kept; others are just released.
+     */
+    void give(cv::UMat &mat);
+
+    /**
+     * @brief Returns every matrix of a pyramid and clears it
+     */
+    void give(std::vector<cv::UMat> &mats);
+
+    static const size_t kDefaultMaxBytes = size_t(1) << 30;
+
+private:
+    size_t max_bytes_;
+    size_t free_bytes_ = 0;
+    std::mutex mutex_;
+    std::deque<cv::UMat> free_;  // Oldest first
+};
+
+#endif // PYRAMIDPOOL_H
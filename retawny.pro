@@ -4,7 +4,7 @@ greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 CONFIG += c++17 link_pkgconfig
 
-PKGCONFIG += opencv4
+PKGCONFIG += opencv4 libtiff-4
 
 # You can make your code fail to compile if it uses deprecated APIs.
 # In order to do so, uncomment the following line.
@@ -13,11 +13,31 @@ PKGCONFIG += opencv4
 SOURCES += \
     main.cpp \
     ortholoader.cpp \
-    dualmaskblender.cpp
+    blockplan.cpp \
+    coveragemask.cpp \
+    dualmaskblender.cpp \
+    pyramidpool.cpp \
+    blendkernels.cpp \
+    streamingblender.cpp \
+    tiffwriter.cpp \
+    tileprefetcher.cpp \
+    runreport.cpp \
+    jobservice.cpp \
+    scratchmat.cpp
 
 HEADERS += \
     ortholoader.h \
-    dualmaskblender.h
+    blockplan.h \
+    coveragemask.h \
+    dualmaskblender.h \
+    pyramidpool.h \
+    blendkernels.h \
+    streamingblender.h \
+    tiffwriter.h \
+    tileprefetcher.h \
+    runreport.h \
+    jobservice.h \
+    scratchmat.h
 
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
@@ -0,0 +1,109 @@
+#include "runreport.h"
+
+#include <QJsonDocument>
+#include <QSaveFile>
+
+#include <sys/resource.h>
+
+namespace {
+// Bump when fields are renamed or removed
+constexpr int kRunReportVersion = 1;
+}
+
+void RunReport::setParameter(const QString &name, const QJsonValue &value) {
+	parameters_.insert(name, value);
+}
+
+void RunReport::addStage(const QString &name, double ms) {
+	QJsonObject stage;
+	stage.insert(QStringLiteral("name"), name);
+	stage.insert(QStringLiteral("ms"), ms);
+	stages_.push_back(stage);
+	stagesMs_ += ms;
+}
+
+void RunReport::addTile(const Tile &tile) {
+	QJsonObject entry;
+	entry.insert(QStringLiteral("name"), tile.name);
+	entry.insert(QStringLiteral("decode_ms"), tile.decodeMs);
+	entry.insert(QStringLiteral("mask_ms"), tile.maskMs);
+	entry.insert(QStringLiteral("prepare_ms"), tile.prepareMs);
+	entry.insert(QStringLiteral("wait_ms"), tile.waitMs);
+	entry.insert(QStringLiteral("feed_ms"), tile.feedMs);
+	entry.insert(QStringLiteral("bytes_read"), static_cast<double>(tile.bytesRead));
+	tiles_.push_back(entry);
+
+	decodeMs_ += tile.decodeMs;
+	maskMs_ += tile.maskMs;
+	waitMs_ += tile.waitMs;
+	feedMs_ += tile.feedMs;
+	bytesRead_ += tile.bytesRead;
+}
+
+void RunReport::setBlenderTimings(const DualMaskMultiBandBlender::Timings &timings) {
+	QJsonArray levels;
+	for (size_t i = 0; i < timings.build.size(); ++i) {
+		QJsonObject level;
+		level.insert(QStringLiteral("level"), static_cast<int>(i));
+		level.insert(QStringLiteral("build_ms"), timings.build[i]);
+		level.insert(QStringLiteral("accumulate_ms"), i < timings.accumulate.size() ? timings.accumulate[i] : 0.0);
+		level.insert(QStringLiteral("normalize_ms"), i < timings.normalize.size() ? timings.normalize[i] : 0.0);
+		level.insert(QStringLiteral("restore_ms"), i < timings.restore.size() ? timings.restore[i] : 0.0);
+		levels.push_back(level);
+	}
+
+	blender_ = QJsonObject();
+	blender_.insert(QStringLiteral("feeds"), timings.feeds);
+	blender_.insert(QStringLiteral("lock_wait_ms"), timings.lock_wait);
+	blender_.insert(QStringLiteral("levels"), levels);
+}
+
+qint64 RunReport::peakRssBytes() {
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	// Bytes on macOS
+	return static_cast<qint64>(usage.ru_maxrss);
+#else
+	// Kilobytes on Linux
+	return static_cast<qint64>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+bool RunReport::save(const QString &path, QString *errorMessage) const {
+	QJsonObject totals;
+	totals.insert(QStringLiteral("decode_ms"), decodeMs_);
+	totals.insert(QStringLiteral("mask_ms"), maskMs_);
+	totals.insert(QStringLiteral("wait_ms"), waitMs_);
+	totals.insert(QStringLiteral("feed_ms"), feedMs_);
+
+	QJsonObject io;
+	io.insert(QStringLiteral("bytes_read"), static_cast<double>(bytesRead_));
+	io.insert(QStringLiteral("bytes_written"), static_cast<double>(bytesWritten_));
+
+	QJsonObject root;
+	root.insert(QStringLiteral("version"), kRunReportVersion);
+	root.insert(QStringLiteral("parameters"), parameters_);
+	root.insert(QStringLiteral("stages"), stages_);
+	root.insert(QStringLiteral("total_ms"), stagesMs_);
+	root.insert(QStringLiteral("tiles"), tiles_);
+	root.insert(QStringLiteral("tile_totals"), totals);
+	root.insert(QStringLiteral("blender"), blender_);
+	root.insert(QStringLiteral("io"), io);
+	root.insert(QStringLiteral("peak_rss_bytes"), static_cast<double>(peakRssBytes()));
+
+	QSaveFile file(path);
+	if (!file.open(QIODevice::WriteOnly)) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Unable to write %1").arg(path);
+		return false;
+	}
+	file.write(QJsonDocument(root).toJson());
+	if (!file.commit()) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Unable to write %1").arg(path);
+		return false;
+	}
+	return true;
+}
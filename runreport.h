@@ -0,0 +1,51 @@
+#ifndef RUNREPORT_H
+#define RUNREPORT_H
+
+#include "dualmaskblender.h"
+
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QString>
+
+// Machine-readable record of one run: parameters, stage and per-tile timings,
+// blender timings per pyramid level, I/O volume and peak memory, saved as JSON
+// to track performance across releases and size jobs
+class RunReport {
+public:
+	struct Tile {
+		QString name;
+		double decodeMs = 0.0;   // image decode
+		double maskMs = 0.0;     // weight and blend masks, Voronoi mask read included
+		double prepareMs = 0.0;  // whole preparation on the prefetch thread
+		double waitMs = 0.0;     // blender waiting for the tile to be prepared
+		double feedMs = 0.0;     // blender feed: pyramids and accumulation, or queueing with feed threads
+		qint64 bytesRead = 0;    // image and mask files
+	};
+
+	void setParameter(const QString &name, const QJsonValue &value);
+	// Stages are kept in the order they are added
+	void addStage(const QString &name, double ms);
+	void addTile(const Tile &tile);
+	void setBlenderTimings(const DualMaskMultiBandBlender::Timings &timings);
+	void addBytesWritten(qint64 bytes) { bytesWritten_ += bytes; }
+
+	bool save(const QString &path, QString *errorMessage = nullptr) const;
+
+	// Peak resident set size of the process so far, in bytes
+	static qint64 peakRssBytes();
+
+private:
+	QJsonObject parameters_;
+	QJsonArray stages_;
+	QJsonArray tiles_;
+	QJsonObject blender_;
+	double stagesMs_ = 0.0;
+	double decodeMs_ = 0.0;
+	double maskMs_ = 0.0;
+	double waitMs_ = 0.0;
+	double feedMs_ = 0.0;
+	qint64 bytesRead_ = 0;
+	qint64 bytesWritten_ = 0;
+};
+
+#endif // RUNREPORT_H
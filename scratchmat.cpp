@@ -0,0 +1,58 @@
+#include "scratchmat.h"
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+ScratchMat::ScratchMat(const std::string &directory, cv::Size size, int type) {
+    CV_Assert(size.width > 0 && size.height > 0);
+    bytes_ = static_cast<size_t>(size.width) * size.height * CV_ELEM_SIZE(type);
+
+    // Anonymous pages read as zero until written, and are not reserved up front
+    if (directory.empty()) {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+        flags |= MAP_NORESERVE;
+#endif
+        data_ = mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (data_ == MAP_FAILED) {
+            data_ = nullptr;
+            CV_Error(cv::Error::StsNoMem, std::string("Cannot map pyramid level: ") + std::strerror(errno));
+        }
+        mat_ = cv::Mat(size, type, data_);
+        return;
+    }
+
+    std::string path = directory + "/retawny-scratch-XXXXXX";
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+    const int fd = mkstemp(name.data());
+    if (fd < 0)
+        CV_Error(cv::Error::StsError, "Cannot create scratch file in " + directory + ": " + std::strerror(errno));
+    unlink(name.data());
+
+    // Sparse file: pages read as zero until written
+    if (ftruncate(fd, static_cast<off_t>(bytes_)) != 0) {
+        const int error = errno;
+        close(fd);
+        CV_Error(cv::Error::StsError, "Cannot size scratch file in " + directory + ": " + std::strerror(error));
+    }
+    data_ = mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int error = errno;
+    close(fd);
+    if (data_ == MAP_FAILED) {
+        data_ = nullptr;
+        CV_Error(cv::Error::StsError, "Cannot map scratch file in " + directory + ": " + std::strerror(error));
+    }
+
+    mat_ = cv::Mat(size, type, data_);
+}
+
+ScratchMat::~ScratchMat() {
+    if (data_)
+        munmap(data_, bytes_);
+}
@@ -0,0 +1,45 @@
+#ifndef SCRATCHMAT_H
+#define SCRATCHMAT_H
+
+#include <opencv2/core.hpp>
+#include <string>
+
+/**
+ * @brief Zero-filled matrix backed by a memory-mapped scratch file
+ *
+ * The file is created in the scratch directory and unlinked right away, so it
+ * never outlives the mapping. Dirty pages are written back to the file under
+ * memory pressure instead of exhausting RAM; sweeping the matrix in row order
+ * keeps that I/O sequential.
+ *
+ * Without a directory the mapping is anonymous. Either way pages only take
+ * memory once written: areas never written cost nothing.
+ */
+class ScratchMat {
+public:
+    /**
+     * @brief Maps a new scratch file
+     * @param directory Directory holding the scratch file (empty: anonymous memory)
+     * @param size Matrix size
+     * @param type Matrix type
+     *
+     * Throws cv::Exception if the file cannot be created or mapped.
+     */
+    ScratchMat(const std::string &directory, cv::Size size, int type);
+    ~ScratchMat();
+
+    ScratchMat(const ScratchMat &) = delete;
+    ScratchMat &operator=(const ScratchMat &) = delete;
+
+    /**
+     * @brief Header over the mapping, valid for the lifetime of this object
+     */
+    const cv::Mat &mat() const { return mat_; }
+
+private:
+    void *data_ = nullptr;
+    size_t bytes_ = 0;
+    cv::Mat mat_;
+};
+
+#endif // SCRATCHMAT_H
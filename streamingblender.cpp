@@ -0,0 +1,230 @@
+#include "streamingblender.h"
+
+#include <algorithm>
+#include <exception>
+#include <limits>
+#include <utility>
+
+StreamingBlender::StreamingBlender(int num_bands, int strip_height, int feed_threads, int weight_type)
+    : num_bands_(num_bands), requested_strip_height_(strip_height), weight_type_(weight_type) {
+    CV_Assert(strip_height >= 0 && feed_threads >= 0);
+    max_queued_ = 2 * static_cast<size_t>(feed_threads);
+    for (int i = 0; i < feed_threads; ++i)
+        workers_.emplace_back(&StreamingBlender::run, this);
+}
+
+StreamingBlender::~StreamingBlender() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        work_done_.wait(lock, [this] { return in_flight_ == 0; });
+        stopping_ = true;
+    }
+    work_available_.notify_all();
+    for (std::thread &worker : workers_)
+        worker.join();
+}
+
+void StreamingBlender::run() {
+    for (;;) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_available_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+            if (queue_.empty())
+                return;
+            job = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        job();
+    }
+}
+
+void StreamingBlender::queueFeed(Strip &strip, const cv::Mat &img, const cv::Mat &weight_mask,
+                                 const cv::Mat &blend_mask, cv::Point tl, const cv::Scalar *fill,
+                                 const cv::Mat &owned) {
+    // Mat headers share the pixels, which stay alive until the job ran
+    DualMaskMultiBandBlender *blender = strip.blender.get();
+    const bool has_fill = fill != nullptr;
+    const cv::Scalar fill_color = has_fill ? *fill : cv::Scalar();
+    std::unique_lock<std::mutex> lock(mutex_);
+    work_done_.wait(lock, [this] { return in_flight_ < max_queued_; });
+    ++strip.pending;
+    ++in_flight_;
+    queue_.emplace_back([this, &strip, blender, img, weight_mask, blend_mask, tl, has_fill, fill_color, owned] {
+        // Thrown on the calling thread by the next feed() or finish()
+        std::exception_ptr error;
+        try {
+            blender->feed(img, weight_mask, blend_mask, tl, has_fill ? &fill_color : nullptr, owned);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        {
+            std::lock_guard<std::mutex> done_lock(mutex_);
+            if (error && !feed_error_)
+                feed_error_ = error;
+            --strip.pending;
+            --in_flight_;
+        }
+        work_done_.notify_all();
+    });
+    work_available_.notify_one();
+}
+
+void StreamingBlender::rethrowFeedError() {
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::swap(error, feed_error_);
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void StreamingBlender::prepare(cv::Rect dst_roi, StripSink sink) {
+    prepare(dst_roi, dst_roi, std::move(sink));
+}
+
+void StreamingBlender::prepare(cv::Rect dst_roi, cv::Rect region, StripSink sink) {
+    CV_Assert((region & dst_roi) == region && !region.empty());
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        work_done_.wait(lock, [this] { return in_flight_ == 0; });
+        feed_error_ = nullptr;
+    }
+
+    dst_roi_ = dst_roi;
+    sink_ = std::move(sink);
+    strips_.clear();
+    next_strip_ = 0;
+    timings_ = DualMaskMultiBandBlender::Timings();
+    last_tl_y_ = std::numeric_limits<int>::min();
+
+    // Same band count and padding as a blend of the whole canvas
+    const int bands = DualMaskMultiBandBlender::bandsForSize(num_bands_, dst_roi.size());
+    const int align = 1 << bands;
+    padding_ = DualMaskMultiBandBlender::supportForBands(bands);
+
+    // Strips are multiples of 2^bands rows, and windows start on the 2^bands
+    // grid of the canvas so every pyramid level lines up
+    strip_height_ = requested_strip_height_ > 0 ? requested_strip_height_ : region.height;
+    strip_height_ = std::min(strip_height_, region.height);
+    strip_height_ += (align - strip_height_ % align) % align;
+
+    const int left = std::max(dst_roi.x, dst_roi.x + (region.x - padding_ - dst_roi.x) / align * align);
+    const int right = std::min(dst_roi.br().x, region.br().x + padding_);
+    for (int y = region.y; y < region.br().y; y += strip_height_) {
+        Strip strip;
+        strip.rect = cv::Rect(region.x, y, region.width, std::min(strip_height_, region.br().y - y));
+        const int top = std::max(dst_roi.y, dst_roi.y + (y - padding_ - dst_roi.y) / align * align);
+        const int bottom = std::min(dst_roi.br().y, strip.rect.br().y + padding_);
+        strip.window = cv::Rect(left, top, right - left, bottom - top);
+        strips_.push_back(std::move(strip));
+    }
+}
+
+bool StreamingBlender::feed(const cv::Mat &img, const cv::Mat &weight_mask, const cv::Mat &blend_mask, cv::Point tl,
+                            const cv::Scalar *fill, const cv::Mat &owned) {
+    CV_Assert(tl.y >= last_tl_y_);
+    last_tl_y_ = tl.y;
+    rethrowFeedError();
+
+    // No later tile can reach strips whose window ends above this one
+    while (next_strip_ < strips_.size() && strips_[next_strip_].window.br().y <= tl.y) {
+        if (!finishStrip(strips_[next_strip_]))
+            return false;
+        ++next_strip_;
+    }
+
+    const int bottom = tl.y + img.rows;
+    for (size_t i = next_strip_; i < strips_.size() && strips_[i].window.y < bottom; ++i) {
+        Strip &strip = strips_[i];
+        if (tl.x >= strip.window.br().x || tl.x + img.cols <= strip.window.x)
+            continue;
+        const int r0 = std::max(tl.y, strip.window.y) - tl.y;
+        const int r1 = std::min(bottom, strip.window.br().y) - tl.y;
+        if (r1 <= r0)
+            continue;
+
+        // Rows with neither weight nor blend coverage add nothing to the strip
+        if (cv::countNonZero(weight_mask.rowRange(r0, r1)) == 0 && cv::countNonZero(blend_mask.rowRange(r0, r1)) == 0)
+            continue;
+
+        if (!strip.blender) {
+            strip.blender = createStripBlender();
+            strip.blender->prepare(strip.window, dst_roi_);
+        }
+        // The whole tile, not its rows: the strip blender cuts it to the window
+        // itself, so its source windows are those of a full-canvas blend
+        if (workers_.empty())
+            strip.blender->feed(img, weight_mask, blend_mask, tl, fill, owned);
+        else
+            queueFeed(strip, img, weight_mask, blend_mask, tl, fill, owned);
+    }
+    return true;
+}
+
+bool StreamingBlender::finish() {
+    for (; next_strip_ < strips_.size(); ++next_strip_) {
+        if (!finishStrip(strips_[next_strip_]))
+            return false;
+    }
+    return true;
+}
+
+void StreamingBlender::setScratch(const std::string &directory, size_t min_level_bytes) {
+    scratch_directory_ = directory;
+    scratch_min_bytes_ = min_level_bytes;
+}
+
+void StreamingBlender::setDeviceMemory(size_t budget_bytes, size_t max_alloc_bytes) {
+    device_budget_ = budget_bytes;
+    device_max_alloc_ = max_alloc_bytes;
+}
+
+void StreamingBlender::setPool(std::shared_ptr<PyramidPool> pool) {
+    CV_Assert(pool);
+    pool_ = std::move(pool);
+}
+
+std::vector<DualMaskMultiBandBlender::LevelPlan> StreamingBlender::levelPlan() const {
+    if (strips_.empty())
+        return {};
+    return createStripBlender()->planLevels(strips_.front().window, dst_roi_);
+}
+
+std::unique_ptr<DualMaskMultiBandBlender> StreamingBlender::createStripBlender() const {
+    std::unique_ptr<DualMaskMultiBandBlender> blender(new DualMaskMultiBandBlender(num_bands_, weight_type_));
+    blender->setScratch(scratch_directory_, scratch_min_bytes_);
+    blender->setPool(pool_);
+    blender->setDirectCopy(direct_copy_);
+    // A single strip has the whole budget; otherwise two are alive around each strip boundary
+    blender->setDeviceMemory(strips_.size() > 1 ? device_budget_ / 2 : device_budget_, device_max_alloc_);
+    return blender;
+}
+
+bool StreamingBlender::finishStrip(Strip &strip) {
+    const cv::Rect rows(strip.rect.tl() - strip.window.tl(), strip.rect.size());
+
+    if (!strip.blender) {
+        // Nothing was fed: the strip is empty
+        return sink_(cv::Mat(strip.rect.size(), CV_16SC3, cv::Scalar::all(0)),
+                     cv::Mat(strip.rect.size(), CV_8U, cv::Scalar::all(0)), strip.rect);
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        work_done_.wait(lock, [&strip] { return strip.pending == 0; });
+    }
+    rethrowFeedError();
+
+    // UMat outputs share the blender's memory, which may be a scratch file:
+    // the blender is only released once the sink is done with the strip
+    cv::UMat blended, blended_mask;
+    strip.blender->blend(blended, blended_mask);
+    const bool ok = sink_(blended.getMat(cv::ACCESS_READ)(rows), blended_mask.getMat(cv::ACCESS_READ)(rows), strip.rect);
+    blended.release();
+    blended_mask.release();
+    timings_.add(strip.blender->timings());
+    strip.blender.reset();
+    return ok;
+}
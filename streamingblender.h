@@ -0,0 +1,199 @@
+#ifndef STREAMINGBLENDER_H
+#define STREAMINGBLENDER_H
+
+#include "dualmaskblender.h"
+
+#include <opencv2/core.hpp>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Blends a canvas as a sequence of horizontal strips
+ *
+ * The canvas is split into strips of strip_height rows. Each strip is blended
+ * by its own DualMaskMultiBandBlender over the strip plus a padding of
+ * DualMaskMultiBandBlender::supportForBands() rows above and below, with the
+ * band count of the whole canvas, so strips approximate a full-canvas blend:
+ * cutting the sources at the window changes the image pyramids near its
+ * edges, and the padding keeps that away from the strip rows
+ * (bench/pipeline_bench --check-partition measures what is left).
+ *
+ * Tiles must be fed in increasing top-left y. A strip is blended and handed to
+ * the sink as soon as the next tile starts below its padded window, so only
+ * the strips crossed by the current tile are ever allocated.
+ *
+ * With feed threads, feed() only queues the work: source pyramids of several
+ * tiles are built concurrently and accumulated under the strip blender's
+ * region locks. A strip waits for its queued tiles before it is blended. An
+ * exception thrown by a queued feed is rethrown by the next feed() or
+ * finish() on the calling thread.
+ */
+class StreamingBlender {
+public:
+    /**
+     * @brief Receives each finished strip, in canvas order
+     * @param strip Blended strip (CV_16SC3)
+     * @param strip_mask Valid pixels of the strip (CV_8U)
+     * @param rect Canvas rectangle covered by the strip
+     * @return false to abort blending
+     */
+    using StripSink = std::function<bool(const cv::Mat &strip, const cv::Mat &strip_mask, cv::Rect rect)>;
+
+    /**
+     * @brief Constructor
+     * @param num_bands Number of bands in the multi-band pyramid
+     * @param strip_height Rows per strip, rounded up to a multiple of 2^bands (0 = whole canvas)
+     * @param feed_threads Threads feeding tiles into the strips (0 = feed on the calling thread)
+     * @param weight_type Data type for weights: CV_32F or CV_16S (default: CV_32F)
+     */
+    StreamingBlender(int num_bands, int strip_height, int feed_threads = 0, int weight_type = CV_32F);
+    ~StreamingBlender();
+
+    /**
+     * @brief Prepares the strips of the given canvas
+     * @param dst_roi Destination region of interest (full canvas size)
+     * @param sink Receives the finished strips
+     */
+    void prepare(cv::Rect dst_roi, StripSink sink);
+
+    /**
+     * @brief Prepares the strips of a region of the given canvas only
+     * @param dst_roi Destination region of interest (full canvas size)
+     * @param region Canvas rectangle to blend, inside dst_roi
+     * @param sink Receives the finished strips, which span the columns of region
+     *
+     * Windows are padded on all sides and aligned on the 2^bands grid of
+     * dst_roi, so the region approximates a blend of the whole canvas as
+     * closely as the strips do, as long as every tile within padding() of it
+     * is fed.
+     */
+    void prepare(cv::Rect dst_roi, cv::Rect region, StripSink sink);
+
+    /**
+     * @brief Feeds an image into every strip it crosses, finishing the strips above it
+     * @param img Input image (CV_16SC3 or CV_8UC3)
+     * @param weight_mask Mask for computing weights (CV_8U, 0-255)
+     * @param blend_mask Mask for blending pixels (CV_8U, 0-255)
+     * @param tl Top-left corner of the image in canvas coordinates (tl.y not decreasing)
+     * @param fill If set, colour of the pixels where blend_mask is zero (see DualMaskMultiBandBlender::feed())
+     * @param owned With setDirectCopy(), pixels whose detail is copied to the output (see DualMaskMultiBandBlender::feed())
+     * @return false if the sink failed
+     */
+    bool feed(const cv::Mat &img, const cv::Mat &weight_mask, const cv::Mat &blend_mask, cv::Point tl,
+              const cv::Scalar *fill = nullptr, const cv::Mat &owned = cv::Mat());
+
+    /**
+     * @brief Finishes all remaining strips
+     * @return false if the sink failed
+     */
+    bool finish();
+
+    /**
+     * @brief Backs the large levels of every strip pyramid with scratch files
+     *
+     * See DualMaskMultiBandBlender::setScratch(). Call before prepare().
+     */
+    void setScratch(const std::string &directory, size_t min_level_bytes);
+
+    /**
+     * @brief Device memory for the strip pyramids
+     *
+     * See DualMaskMultiBandBlender::setDeviceMemory(). The budget is split
+     * between the two strips alive at once around a strip boundary. Call
+     * before prepare().
+     */
+    void setDeviceMemory(size_t budget_bytes, size_t max_alloc_bytes);
+
+    /**
+     * @brief Shares the source buffer pool of the strip blenders with other blenders
+     *
+     * See DualMaskMultiBandBlender::setPool(). Call before prepare().
+     */
+    void setPool(std::shared_ptr<PyramidPool> pool);
+
+    /**
+     * @brief Copies the fine levels of owned pixels instead of blending them
+     *
+     * See DualMaskMultiBandBlender::setDirectCopy(). Call before prepare().
+     */
+    void setDirectCopy(bool enabled) { direct_copy_ = enabled; }
+
+    /**
+     * @brief Level placement of the first (largest) strip pyramid, valid after prepare()
+     */
+    std::vector<DualMaskMultiBandBlender::LevelPlan> levelPlan() const;
+
+    /**
+     * @brief Timings of every strip blender, summed level by level; complete after finish()
+     */
+    const DualMaskMultiBandBlender::Timings &timings() const { return timings_; }
+
+    /**
+     * @brief Number of strips the canvas is split into
+     */
+    int stripCount() const { return static_cast<int>(strips_.size()); }
+
+    /**
+     * @brief Rows per strip (after rounding)
+     */
+    int stripHeight() const { return strip_height_; }
+
+    /**
+     * @brief Pixels added around each strip for the pyramid support
+     */
+    int padding() const { return padding_; }
+
+private:
+    struct Strip {
+        cv::Rect rect;    // Canvas pixels produced by the strip
+        cv::Rect window;  // rect plus padding, aligned and clipped to the canvas
+        std::unique_ptr<DualMaskMultiBandBlender> blender; // Allocated by the first tile crossing the window
+        int pending = 0;  // Queued feeds not done yet (guarded by mutex_)
+    };
+
+    std::unique_ptr<DualMaskMultiBandBlender> createStripBlender() const;
+    bool finishStrip(Strip &strip);
+    void queueFeed(Strip &strip, const cv::Mat &img, const cv::Mat &weight_mask, const cv::Mat &blend_mask, cv::Point tl,
+                   const cv::Scalar *fill, const cv::Mat &owned);
+    void rethrowFeedError();
+    void run();
+
+    int num_bands_;
+    int requested_strip_height_;
+    int weight_type_;
+    int strip_height_ = 0;
+    int padding_ = 0;
+    int last_tl_y_ = 0;
+    std::string scratch_directory_;
+    size_t scratch_min_bytes_ = 0;
+    size_t device_budget_ = 0;
+    size_t device_max_alloc_ = 0;
+    bool direct_copy_ = false;
+    std::shared_ptr<PyramidPool> pool_ = std::make_shared<PyramidPool>(); // Shared by every strip blender
+    DualMaskMultiBandBlender::Timings timings_; // Of the strips finished so far
+
+    cv::Rect dst_roi_;
+    StripSink sink_;
+    std::vector<Strip> strips_;
+    size_t next_strip_ = 0; // First strip not handed to the sink yet
+
+    // Feed workers; the queue is bounded so queued tiles cannot pile up in memory
+    size_t max_queued_ = 0;
+    std::mutex mutex_;
+    std::condition_variable work_available_;
+    std::condition_variable work_done_;
+    std::deque<std::function<void()>> queue_;
+    size_t in_flight_ = 0;  // Queued or running feeds
+    bool stopping_ = false;
+    std::exception_ptr feed_error_;  // First exception of a queued feed not rethrown yet
+    std::vector<std::thread> workers_;
+};
+
+#endif // STREAMINGBLENDER_H
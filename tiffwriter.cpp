@@ -0,0 +1,479 @@
+#include "tiffwriter.h"
+
+#include <QFile>
+
+#include <opencv2/imgproc.hpp>
+
+#include <tiffio.h>
+
+#include <algorithm>
+
+namespace {
+// Classic TIFF offsets are 32-bit: switch to BigTIFF well before raw data reaches 4 GB
+constexpr qint64 kBigTiffThreshold = 3LL * 1024 * 1024 * 1024;
+
+// Image and tile sizes of an open TIFF, if it is tiled 8-bit contiguous RGB as written by TiledTiffWriter
+bool readTiledRgbLayout(tiff *tif, QSize *size, QSize *tileSize) {
+	uint32_t width = 0, height = 0, tileWidth = 0, tileHeight = 0;
+	uint16_t samples = 0, bits = 0, planar = 0, photometric = 0;
+	TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
+	TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &height);
+	TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tileWidth);
+	TIFFGetField(tif, TIFFTAG_TILELENGTH, &tileHeight);
+	TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &samples);
+	TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &bits);
+	TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planar);
+	TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &photometric);
+	if (!TIFFIsTiled(tif) || samples != 3 || bits != 8 || planar != PLANARCONFIG_CONTIG ||
+	    photometric != PHOTOMETRIC_RGB || width == 0 || height == 0 || tileWidth == 0 || tileHeight == 0)
+		return false;
+
+	*size = QSize(static_cast<int>(width), static_cast<int>(height));
+	*tileSize = QSize(static_cast<int>(tileWidth), static_cast<int>(tileHeight));
+	return true;
+}
+}
+
+TiledTiffWriter::TiledTiffWriter(int tileSize) : tileSize_(tileSize) {
+	CV_Assert(tileSize > 0 && tileSize % 16 == 0);
+}
+
+TiledTiffWriter::~TiledTiffWriter() {
+	if (tiff_) {
+		TIFFClose(tiff_);
+		// An overview left unfinished is of no use
+		if (depth_ > 0)
+			QFile::remove(path_);
+	}
+}
+
+bool TiledTiffWriter::parseCompression(const QString &name, Compression *compression) {
+	const QString value = name.toLower();
+	if (value == QStringLiteral("none"))
+		*compression = Compression::None;
+	else if (value == QStringLiteral("lzw"))
+		*compression = Compression::Lzw;
+	else if (value == QStringLiteral("deflate") || value == QStringLiteral("zip"))
+		*compression = Compression::Deflate;
+	else
+		return false;
+	return true;
+}
+
+void TiledTiffWriter::setOverviewLevels(int levels) {
+	CV_Assert(!tiff_ && levels >= -1);
+	overviewLevels_ = levels;
+}
+
+bool TiledTiffWriter::open(const QString &path, const QSize &size, Compression compression, QString *errorMessage) {
+	if (tiff_) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("TIFF writer already open.");
+		return false;
+	}
+	if (!size.isValid() || size.isEmpty()) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Invalid TIFF size.");
+		return false;
+	}
+
+	// Halve until the image fits one tile, unless a count was requested
+	int levels = overviewLevels_;
+	if (levels < 0) {
+		levels = 0;
+		for (QSize s = size; s.width() > tileSize_ || s.height() > tileSize_; s = QSize((s.width() + 1) / 2, (s.height() + 1) / 2))
+			++levels;
+	}
+
+	// Overviews add up to a third of the full-resolution data
+	qint64 rawBytes = static_cast<qint64>(size.width()) * size.height() * 3;
+	if (levels > 0)
+		rawBytes += rawBytes / 3;
+	const char *mode = rawBytes > kBigTiffThreshold ? "w8" : "w";
+	tiff_ = TIFFOpen(QFile::encodeName(path).constData(), mode);
+	if (!tiff_) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Unable to create %1").arg(path);
+		return false;
+	}
+
+	path_ = path;
+	size_ = size;
+	compression_ = compression;
+	nextRow_ = 0;
+	bandRows_ = 0;
+	pendingRow_.release();
+	writeTags(size, false);
+	const int tilesAcross = (size.width() + tileSize_ - 1) / tileSize_;
+	band_ = cv::Mat(tileSize_, tilesAcross * tileSize_, CV_8UC3, cv::Scalar::all(0));
+	tileBuffer_.resize(static_cast<size_t>(tileSize_) * tileSize_ * 3);
+
+	// The next level is written by its own writer into a temporary file next
+	// to the output; close() appends it as a reduced-resolution directory
+	overview_.reset();
+	if (levels > 0) {
+		overview_.reset(new TiledTiffWriter(tileSize_));
+		overview_->depth_ = depth_ + 1;
+		overview_->rootPath_ = depth_ == 0 ? path : rootPath_;
+		overview_->setOverviewLevels(levels - 1);
+		const QString overviewPath = QStringLiteral("%1.ovr%2.tmp").arg(overview_->rootPath_).arg(overview_->depth_);
+		const QSize overviewSize((size.width() + 1) / 2, (size.height() + 1) / 2);
+		if (!overview_->open(overviewPath, overviewSize, compression, errorMessage)) {
+			overview_.reset();
+			TIFFClose(tiff_);
+			tiff_ = nullptr;
+			return false;
+		}
+	}
+	return true;
+}
+
+void TiledTiffWriter::writeTags(const QSize &size, bool reduced) {
+	if (reduced)
+		TIFFSetField(tiff_, TIFFTAG_SUBFILETYPE, FILETYPE_REDUCEDIMAGE);
+	TIFFSetField(tiff_, TIFFTAG_IMAGEWIDTH, static_cast<uint32_t>(size.width()));
+	TIFFSetField(tiff_, TIFFTAG_IMAGELENGTH, static_cast<uint32_t>(size.height()));
+	TIFFSetField(tiff_, TIFFTAG_SAMPLESPERPIXEL, 3);
+	TIFFSetField(tiff_, TIFFTAG_BITSPERSAMPLE, 8);
+	TIFFSetField(tiff_, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
+	TIFFSetField(tiff_, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+	TIFFSetField(tiff_, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+	TIFFSetField(tiff_, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+	TIFFSetField(tiff_, TIFFTAG_TILEWIDTH, static_cast<uint32_t>(tileSize_));
+	TIFFSetField(tiff_, TIFFTAG_TILELENGTH, static_cast<uint32_t>(tileSize_));
+
+	switch (compression_) {
+	case Compression::None:
+		TIFFSetField(tiff_, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
+		break;
+	case Compression::Lzw:
+		TIFFSetField(tiff_, TIFFTAG_COMPRESSION, COMPRESSION_LZW);
+		TIFFSetField(tiff_, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL);
+		break;
+	case Compression::Deflate:
+		TIFFSetField(tiff_, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
+		TIFFSetField(tiff_, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL);
+		break;
+	}
+}
+
+bool TiledTiffWriter::writeRows(const cv::Mat &rows, QString *errorMessage) {
+	CV_Assert(rows.type() == CV_8UC3);
+	if (!tiff_ || rows.cols != size_.width() || nextRow_ + rows.rows > size_.height()) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Rows do not fit the TIFF being written: %1").arg(path_);
+		return false;
+	}
+
+	int consumed = 0;
+	while (consumed < rows.rows) {
+		const int count = std::min(rows.rows - consumed, tileSize_ - bandRows_);
+		cv::Mat dst = band_(cv::Rect(0, bandRows_, size_.width(), count));
+		cv::cvtColor(rows.rowRange(consumed, consumed + count), dst, cv::COLOR_BGR2RGB);
+		consumed += count;
+		bandRows_ += count;
+		nextRow_ += count;
+
+		if (bandRows_ == tileSize_ || nextRow_ == size_.height()) {
+			if (!flushBand(errorMessage))
+				return false;
+		}
+	}
+	return !overview_ || writeOverviewRows(rows, errorMessage);
+}
+
+bool TiledTiffWriter::writeOverviewRows(const cv::Mat &rows, QString *errorMessage) {
+	// Each 2x2 block of pixels is averaged into the next level (the last
+	// column and row are repeated for odd sizes). An odd row waits for the
+	// first row of the next call.
+	int first = 0;
+	if (!pendingRow_.empty() && rows.rows > 0) {
+		cv::Mat pair;
+		cv::vconcat(pendingRow_, rows.row(0), pair);
+		pendingRow_.release();
+		if (!writeHalved(pair, errorMessage))
+			return false;
+		first = 1;
+	}
+
+	const int pairs = (rows.rows - first) / 2;
+	if (pairs > 0 && !writeHalved(rows.rowRange(first, first + 2 * pairs), errorMessage))
+		return false;
+	if ((rows.rows - first) % 2)
+		pendingRow_ = rows.row(rows.rows - 1).clone();
+	return true;
+}
+
+bool TiledTiffWriter::writeHalved(const cv::Mat &rows, QString *errorMessage) {
+	cv::Mat even = rows;
+	if (even.cols % 2)
+		cv::copyMakeBorder(rows, even, 0, 0, 0, 1, cv::BORDER_REPLICATE);
+	cv::Mat halved;
+	cv::resize(even, halved, cv::Size(even.cols / 2, even.rows / 2), 0, 0, cv::INTER_AREA);
+	return overview_->writeRows(halved, errorMessage);
+}
+
+bool TiledTiffWriter::flushBand(QString *errorMessage) {
+	// Rows below the image in the last band are left black
+	if (bandRows_ < tileSize_)
+		band_.rowRange(bandRows_, tileSize_).setTo(cv::Scalar::all(0));
+
+	const uint32_t y = static_cast<uint32_t>(nextRow_ - bandRows_);
+	cv::Mat tile(tileSize_, tileSize_, CV_8UC3, tileBuffer_.data());
+	for (int x = 0; x < band_.cols; x += tileSize_) {
+		band_(cv::Rect(x, 0, tileSize_, tileSize_)).copyTo(tile);
+		const ttile_t index = TIFFComputeTile(tiff_, static_cast<uint32_t>(x), y, 0, 0);
+		if (TIFFWriteEncodedTile(tiff_, index, tileBuffer_.data(), static_cast<tmsize_t>(tileBuffer_.size())) < 0) {
+			if (errorMessage)
+				*errorMessage = QStringLiteral("Failed to write TIFF tile in %1").arg(path_);
+			return false;
+		}
+	}
+	bandRows_ = 0;
+	return true;
+}
+
+bool TiledTiffWriter::appendOverviews(const QString &overviewPath, QString *errorMessage) {
+	// Encoded tiles are copied as they are: every level uses the same
+	// compression and tile size
+	tiff *overview = TIFFOpen(QFile::encodeName(overviewPath).constData(), "r");
+	if (!overview) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Unable to open %1").arg(overviewPath);
+		return false;
+	}
+
+	bool ok = true;
+	std::vector<uchar> raw;
+	do {
+		QSize size, tileSize;
+		if (!readTiledRgbLayout(overview, &size, &tileSize) || tileSize != QSize(tileSize_, tileSize_)) {
+			ok = false;
+			break;
+		}
+		writeTags(size, true);
+
+		uint64_t *byteCounts = nullptr;
+		TIFFGetField(overview, TIFFTAG_TILEBYTECOUNTS, &byteCounts);
+		const ttile_t tiles = TIFFNumberOfTiles(overview);
+		for (ttile_t i = 0; ok && i < tiles; ++i) {
+			raw.resize(static_cast<size_t>(byteCounts[i]));
+			ok = TIFFReadRawTile(overview, i, raw.data(), static_cast<tmsize_t>(raw.size())) >= 0 &&
+			     TIFFWriteRawTile(tiff_, i, raw.data(), static_cast<tmsize_t>(raw.size())) >= 0;
+		}
+		ok = ok && TIFFWriteDirectory(tiff_) != 0;
+	} while (ok && TIFFReadDirectory(overview));
+	TIFFClose(overview);
+	QFile::remove(overviewPath);
+
+	if (!ok && errorMessage)
+		*errorMessage = QStringLiteral("Failed to append overviews to %1").arg(path_);
+	return ok;
+}
+
+bool TiledTiffWriter::close(QString *errorMessage) {
+	if (!tiff_)
+		return true;
+
+	const bool complete = nextRow_ == size_.height();
+
+	// The last odd row is averaged with itself
+	bool overviewsWritten = true;
+	QString overviewPath;
+	if (overview_) {
+		if (complete && !pendingRow_.empty()) {
+			cv::Mat pair;
+			cv::vconcat(pendingRow_, pendingRow_, pair);
+			overviewsWritten = writeHalved(pair, errorMessage);
+		}
+		pendingRow_.release();
+		overviewPath = overview_->path_;
+		if (!overview_->close(overviewsWritten ? errorMessage : nullptr))
+			overviewsWritten = false;
+		overview_.reset();
+	}
+
+	const bool written = complete && TIFFWriteDirectory(tiff_) != 0;
+	if (written && overviewsWritten && !overviewPath.isEmpty())
+		overviewsWritten = appendOverviews(overviewPath, errorMessage);
+	else if (!overviewPath.isEmpty())
+		QFile::remove(overviewPath);
+	TIFFClose(tiff_);
+	tiff_ = nullptr;
+	band_.release();
+
+	if (!complete) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("TIFF closed after %1 of %2 rows: %3").arg(nextRow_).arg(size_.height()).arg(path_);
+		return false;
+	}
+	if (!written) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Failed to write TIFF directory in %1").arg(path_);
+		return false;
+	}
+	return overviewsWritten;
+}
+
+TiledTiffPatcher::~TiledTiffPatcher() {
+	if (tiff_)
+		TIFFClose(tiff_);
+}
+
+bool TiledTiffPatcher::open(const QString &path, const QSize &size, QString *errorMessage) {
+	if (tiff_) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("TIFF patcher already open.");
+		return false;
+	}
+
+	tiff_ = TIFFOpen(QFile::encodeName(path).constData(), "r+");
+	if (!tiff_) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Unable to open %1 for update").arg(path);
+		return false;
+	}
+
+	QSize fileSize;
+	if (!readTiledRgbLayout(tiff_, &fileSize, &tileSize_)) {
+		TIFFClose(tiff_);
+		tiff_ = nullptr;
+		if (errorMessage)
+			*errorMessage = QStringLiteral("%1 is not an 8-bit RGB tiled TIFF").arg(path);
+		return false;
+	}
+	if (fileSize != size) {
+		TIFFClose(tiff_);
+		tiff_ = nullptr;
+		if (errorMessage)
+			*errorMessage = QStringLiteral("%1 is %2x%3, expected %4x%5").arg(path).arg(fileSize.width()).arg(fileSize.height())
+			                                                             .arg(size.width()).arg(size.height());
+		return false;
+	}
+
+	path_ = path;
+	size_ = size;
+	hasOverviews_ = TIFFNumberOfDirectories(tiff_) > 1;
+	tileBuffer_.resize(static_cast<size_t>(TIFFTileSize(tiff_)));
+	return true;
+}
+
+bool TiledTiffPatcher::writeRegion(const cv::Mat &image, const cv::Point &tl, QString *errorMessage) {
+	CV_Assert(image.type() == CV_8UC3);
+	const cv::Rect imageRect(0, 0, size_.width(), size_.height());
+	const cv::Rect region(tl, image.size());
+	if (!tiff_ || (region & imageRect) != region) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Region does not fit the TIFF being patched: %1").arg(path_);
+		return false;
+	}
+
+	const int tileWidth = tileSize_.width();
+	const int tileHeight = tileSize_.height();
+	cv::Mat tile(tileHeight, tileWidth, CV_8UC3, tileBuffer_.data());
+	for (int y = region.y / tileHeight * tileHeight; y < region.br().y; y += tileHeight) {
+		for (int x = region.x / tileWidth * tileWidth; x < region.br().x; x += tileWidth) {
+			const cv::Rect tileRect(x, y, tileWidth, tileHeight);
+			const cv::Rect covered = tileRect & region;
+			const ttile_t index = TIFFComputeTile(tiff_, static_cast<uint32_t>(x), static_cast<uint32_t>(y), 0, 0);
+
+			// Keep the pixels of partly covered tiles; beyond the image they are black, as written
+			if (covered != (tileRect & imageRect)) {
+				if (TIFFReadEncodedTile(tiff_, index, tileBuffer_.data(), static_cast<tmsize_t>(tileBuffer_.size())) < 0) {
+					if (errorMessage)
+						*errorMessage = QStringLiteral("Failed to read TIFF tile in %1").arg(path_);
+					return false;
+				}
+			} else {
+				tile.setTo(cv::Scalar::all(0));
+			}
+
+			cv::Mat dst = tile(covered - tileRect.tl());
+			cv::cvtColor(image(covered - tl), dst, cv::COLOR_BGR2RGB);
+			if (TIFFWriteEncodedTile(tiff_, index, tileBuffer_.data(), static_cast<tmsize_t>(tileBuffer_.size())) < 0) {
+				if (errorMessage)
+					*errorMessage = QStringLiteral("Failed to write TIFF tile in %1").arg(path_);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool TiledTiffPatcher::close(QString *errorMessage) {
+	if (!tiff_)
+		return true;
+
+	// Rewritten tiles that grew are appended: their offsets are updated by the flush
+	const bool flushed = TIFFFlush(tiff_) != 0;
+	TIFFClose(tiff_);
+	tiff_ = nullptr;
+
+	if (!flushed) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Failed to update TIFF directory in %1").arg(path_);
+		return false;
+	}
+	return true;
+}
+
+TiledTiffReader::~TiledTiffReader() {
+	if (tiff_)
+		TIFFClose(tiff_);
+}
+
+bool TiledTiffReader::open(const QString &path, QString *errorMessage) {
+	if (tiff_) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("TIFF reader already open.");
+		return false;
+	}
+
+	tiff_ = TIFFOpen(QFile::encodeName(path).constData(), "r");
+	if (!tiff_) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Unable to open %1").arg(path);
+		return false;
+	}
+	if (!readTiledRgbLayout(tiff_, &size_, &tileSize_)) {
+		TIFFClose(tiff_);
+		tiff_ = nullptr;
+		if (errorMessage)
+			*errorMessage = QStringLiteral("%1 is not an 8-bit RGB tiled TIFF").arg(path);
+		return false;
+	}
+
+	path_ = path;
+	tileBuffer_.resize(static_cast<size_t>(TIFFTileSize(tiff_)));
+	return true;
+}
+
+bool TiledTiffReader::readRegion(const cv::Rect &region, cv::Mat &image, QString *errorMessage) {
+	const cv::Rect imageRect(0, 0, size_.width(), size_.height());
+	if (!tiff_ || (region & imageRect) != region) {
+		if (errorMessage)
+			*errorMessage = QStringLiteral("Region does not fit the TIFF being read: %1").arg(path_);
+		return false;
+	}
+	image.create(region.size(), CV_8UC3);
+
+	const int tileWidth = tileSize_.width();
+	const int tileHeight = tileSize_.height();
+	const cv::Mat tile(tileHeight, tileWidth, CV_8UC3, tileBuffer_.data());
+	for (int y = region.y / tileHeight * tileHeight; y < region.br().y; y += tileHeight) {
+		for (int x = region.x / tileWidth * tileWidth; x < region.br().x; x += tileWidth) {
+			const cv::Rect tileRect(x, y, tileWidth, tileHeight);
+			const cv::Rect covered = tileRect & region;
+			const ttile_t index = TIFFComputeTile(tiff_, static_cast<uint32_t>(x), static_cast<uint32_t>(y), 0, 0);
+			if (TIFFReadEncodedTile(tiff_, index, tileBuffer_.data(), static_cast<tmsize_t>(tileBuffer_.size())) < 0) {
+				if (errorMessage)
+					*errorMessage = QStringLiteral("Failed to read TIFF tile in %1").arg(path_);
+				return false;
+			}
+
+			cv::Mat dst = image(covered - region.tl());
+			cv::cvtColor(tile(covered - tileRect.tl()), dst, cv::COLOR_RGB2BGR);
+		}
+	}
+	return true;
+}
@@ -0,0 +1,131 @@
+#ifndef TIFFWRITER_H
+#define TIFFWRITER_H
+
+#include <QSize>
+#include <QString>
+
+#include <opencv2/core.hpp>
+
+#include <memory>
+#include <vector>
+
+struct tiff;
+
+// Writes an 8-bit RGB image as a tiled TIFF, band of tiles by band of tiles,
+// so the full image never has to be held in memory. Rows are appended top to
+// bottom in chunks of any height; BigTIFF is used when the image may not fit
+// a classic TIFF. Internal overviews can be built from the same rows as they
+// arrive, without reading the image back.
+class TiledTiffWriter {
+public:
+	enum class Compression {
+		None,
+		Lzw,
+		Deflate
+	};
+
+	static constexpr int kDefaultTileSize = 512;
+
+	explicit TiledTiffWriter(int tileSize = kDefaultTileSize);
+	~TiledTiffWriter();
+
+	TiledTiffWriter(const TiledTiffWriter &) = delete;
+	TiledTiffWriter &operator=(const TiledTiffWriter &) = delete;
+
+	// Reduced-resolution levels, each half the previous one (2x2 average), appended
+	// as extra directories on close(): 0 = none, -1 = until the image fits one tile.
+	// Call before open().
+	void setOverviewLevels(int levels);
+
+	bool open(const QString &path, const QSize &size, Compression compression, QString *errorMessage = nullptr);
+	// Appends the next rows.rows rows of the image (CV_8UC3 BGR, full width)
+	bool writeRows(const cv::Mat &rows, QString *errorMessage = nullptr);
+	// Fails if not all rows were written; writes the overviews
+	bool close(QString *errorMessage = nullptr);
+
+	int rowsWritten() const { return nextRow_; }
+
+	// "none", "lzw" or "deflate"
+	static bool parseCompression(const QString &name, Compression *compression);
+
+private:
+	void writeTags(const QSize &size, bool reduced);
+	bool flushBand(QString *errorMessage);
+	bool writeOverviewRows(const cv::Mat &rows, QString *errorMessage);
+	bool writeHalved(const cv::Mat &rows, QString *errorMessage);
+	bool appendOverviews(const QString &overviewPath, QString *errorMessage);
+
+	const int tileSize_;
+	tiff *tiff_ = nullptr;
+	QString path_;
+	QSize size_;
+	Compression compression_ = Compression::None;
+	int nextRow_ = 0;
+	int bandRows_ = 0;
+	cv::Mat band_;               // tileSize_ rows of RGB, width padded to whole tiles
+	std::vector<uchar> tileBuffer_;
+
+	int overviewLevels_ = 0;
+	int depth_ = 0;              // overview level written by this writer (0 = full resolution)
+	QString rootPath_;           // full-resolution output, naming the temporary overview files
+	std::unique_ptr<TiledTiffWriter> overview_; // writer of the next level
+	cv::Mat pendingRow_;         // odd row (BGR) waiting for its pair
+};
+
+// Rewrites a region of an existing 8-bit RGB tiled TIFF in place, tile by
+// tile, leaving the tiles outside it untouched. Tiles only partly covered by
+// a region are read back and merged first, so regions need no alignment.
+class TiledTiffPatcher {
+public:
+	TiledTiffPatcher() = default;
+	~TiledTiffPatcher();
+
+	TiledTiffPatcher(const TiledTiffPatcher &) = delete;
+	TiledTiffPatcher &operator=(const TiledTiffPatcher &) = delete;
+
+	// Fails unless path is an 8-bit RGB tiled TIFF of the given size
+	bool open(const QString &path, const QSize &size, QString *errorMessage = nullptr);
+	// Replaces the pixels at tl with image (CV_8UC3 BGR), which must lie inside the TIFF
+	bool writeRegion(const cv::Mat &image, const cv::Point &tl, QString *errorMessage = nullptr);
+	bool close(QString *errorMessage = nullptr);
+
+	// Valid after open()
+	QSize tileSize() const { return tileSize_; }
+	// Only the full-resolution image is patched: overviews are left as they were
+	bool hasOverviews() const { return hasOverviews_; }
+
+private:
+	tiff *tiff_ = nullptr;
+	QString path_;
+	QSize size_;
+	QSize tileSize_;
+	bool hasOverviews_ = false;
+	std::vector<uchar> tileBuffer_;
+};
+
+// Reads regions of an 8-bit RGB tiled TIFF, such as the output of TiledTiffWriter
+class TiledTiffReader {
+public:
+	TiledTiffReader() = default;
+	~TiledTiffReader();
+
+	TiledTiffReader(const TiledTiffReader &) = delete;
+	TiledTiffReader &operator=(const TiledTiffReader &) = delete;
+
+	bool open(const QString &path, QString *errorMessage = nullptr);
+	// Reads the pixels of region, which must lie inside the TIFF, into image (CV_8UC3 BGR)
+	bool readRegion(const cv::Rect &region, cv::Mat &image, QString *errorMessage = nullptr);
+
+	// Valid after open()
+	QSize size() const { return size_; }
+	QSize tileSize() const { return tileSize_; }
+
+private:
+	tiff *tiff_ = nullptr;
+	QString path_;
+	QSize size_;
+	QSize tileSize_;
+	std::vector<uchar> tileBuffer_;
+};
+
+#endif // TIFFWRITER_H
@@ -0,0 +1,65 @@
+#include "tileprefetcher.h"
+
+#include <algorithm>
+#include <utility>
+
+TilePrefetcher::TilePrefetcher(int count, int workers, int depth, Job job)
+    : count_(count), depth_(std::max(1, depth)), job_(std::move(job)) {
+	for (int i = 0; i < std::min(workers, count); ++i)
+		threads_.emplace_back(&TilePrefetcher::run, this);
+}
+
+TilePrefetcher::~TilePrefetcher() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	spaceFree_.notify_all();
+	for (std::thread &thread : threads_)
+		thread.join();
+}
+
+bool TilePrefetcher::next(PreparedTile *tile) {
+	if (nextConsumed_ >= count_)
+		return false;
+
+	if (threads_.empty()) {
+		*tile = PreparedTile();
+		tile->index = nextConsumed_;
+		job_(nextConsumed_++, tile);
+		return true;
+	}
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	ready_.wait(lock, [this] { return done_.count(nextConsumed_) != 0; });
+	auto it = done_.find(nextConsumed_);
+	*tile = std::move(it->second);
+	done_.erase(it);
+	++nextConsumed_;
+	spaceFree_.notify_all();
+	return true;
+}
+
+void TilePrefetcher::run() {
+	for (;;) {
+		int index;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			// Indices are taken in order, so only depth_ tiles can be ahead of the consumer
+			spaceFree_.wait(lock, [this] { return stopping_ || nextJob_ >= count_ || nextJob_ < nextConsumed_ + depth_; });
+			if (stopping_ || nextJob_ >= count_)
+				return;
+			index = nextJob_++;
+		}
+
+		PreparedTile tile;
+		tile.index = index;
+		job_(index, &tile);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			done_.emplace(index, std::move(tile));
+		}
+		ready_.notify_one();
+	}
+}
@@ -0,0 +1,67 @@
+#ifndef TILEPREFETCHER_H
+#define TILEPREFETCHER_H
+
+#include <QString>
+#include <QStringList>
+
+#include <opencv2/core.hpp>
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A tile decoded and ready to be fed to the blender
+struct PreparedTile {
+	int index = -1;
+	cv::Mat image;        // CV_8UC3, masked pixels not filled yet
+	cv::Scalar fillColor; // Mean colour under blendMask, for the pixels outside it
+	cv::Mat weightMask;   // CV_8U
+	cv::Mat blendMask;    // CV_8U
+	cv::Mat owned;        // CV_8U, pixels whose detail is copied with --direct-copy (may be empty)
+	cv::Point tl;
+	QStringList log;      // Messages to print when the tile is consumed
+	QString error;        // Non-empty when preparation failed
+	long long prepareMs = 0;
+	double decodeMs = 0.0; // Image decode
+	double maskMs = 0.0;   // Weight and blend masks
+	qint64 bytesRead = 0;  // Image and mask files
+};
+
+// Prepares tiles 0..count-1 on worker threads and hands them out in order.
+// At most depth tiles are prepared or waiting ahead of the consumer, which
+// caps the memory held by decoded tiles. With no workers, next() prepares
+// the tile itself.
+class TilePrefetcher {
+public:
+	using Job = std::function<void(int index, PreparedTile *tile)>;
+
+	TilePrefetcher(int count, int workers, int depth, Job job);
+	~TilePrefetcher();
+
+	TilePrefetcher(const TilePrefetcher &) = delete;
+	TilePrefetcher &operator=(const TilePrefetcher &) = delete;
+
+	// Next tile in index order; false once all tiles were handed out
+	bool next(PreparedTile *tile);
+
+private:
+	void run();
+
+	const int count_;
+	const int depth_;
+	const Job job_;
+
+	std::mutex mutex_;
+	std::condition_variable ready_;      // a tile finished preparing
+	std::condition_variable spaceFree_;  // the consumer took a tile
+	std::map<int, PreparedTile> done_;
+	int nextJob_ = 0;       // next index to prepare
+	int nextConsumed_ = 0;  // next index to hand out
+	bool stopping_ = false;
+	std::vector<std::thread> threads_;
+};
+
+#endif // TILEPREFETCHER_H